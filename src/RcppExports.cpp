@@ -36,11 +36,23 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// worker_threads
+Rcpp::List worker_threads(int limit);
+RcppExport SEXP _ABSEIR_worker_threads(SEXP limitSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type limit(limitSEXP);
+    rcpp_result_gen = Rcpp::wrap(worker_threads(limit));
+    return rcpp_result_gen;
+END_RCPP
+}
 
 RcppExport SEXP _rcpp_module_boot_mod_dataModel();
 RcppExport SEXP _rcpp_module_boot_mod_distanceModel();
 RcppExport SEXP _rcpp_module_boot_mod_exposureModel();
 RcppExport SEXP _rcpp_module_boot_mod_initialValueContainer();
+RcppExport SEXP _rcpp_module_boot_mod_modelChoice();
 RcppExport SEXP _rcpp_module_boot_mod_reinfectionModel();
 RcppExport SEXP _rcpp_module_boot_mod_samplingControl();
 RcppExport SEXP _rcpp_module_boot_mod_spatialSEIRModel();
@@ -49,10 +61,12 @@ RcppExport SEXP _rcpp_module_boot_mod_transitionPriors();
 static const R_CallMethodDef CallEntries[] = {
     {"_ABSEIR_calculate_weights_DM", (DL_FUNC) &_ABSEIR_calculate_weights_DM, 4},
     {"_ABSEIR_solve_for_epsilon", (DL_FUNC) &_ABSEIR_solve_for_epsilon, 6},
+    {"_ABSEIR_worker_threads", (DL_FUNC) &_ABSEIR_worker_threads, 1},
     {"_rcpp_module_boot_mod_dataModel", (DL_FUNC) &_rcpp_module_boot_mod_dataModel, 0},
     {"_rcpp_module_boot_mod_distanceModel", (DL_FUNC) &_rcpp_module_boot_mod_distanceModel, 0},
     {"_rcpp_module_boot_mod_exposureModel", (DL_FUNC) &_rcpp_module_boot_mod_exposureModel, 0},
     {"_rcpp_module_boot_mod_initialValueContainer", (DL_FUNC) &_rcpp_module_boot_mod_initialValueContainer, 0},
+    {"_rcpp_module_boot_mod_modelChoice", (DL_FUNC) &_rcpp_module_boot_mod_modelChoice, 0},
     {"_rcpp_module_boot_mod_reinfectionModel", (DL_FUNC) &_rcpp_module_boot_mod_reinfectionModel, 0},
     {"_rcpp_module_boot_mod_samplingControl", (DL_FUNC) &_rcpp_module_boot_mod_samplingControl, 0},
     {"_rcpp_module_boot_mod_spatialSEIRModel", (DL_FUNC) &_rcpp_module_boot_mod_spatialSEIRModel, 0},
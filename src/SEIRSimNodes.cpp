@@ -6,9 +6,21 @@
 #include <Rcpp.h>
 #include <util.hpp>
 #include "SEIRSimNodes.hpp"
+#include "distanceNorm.hpp"
+#include "fastRandom.hpp"
+#include "infectionPressure.hpp"
+#include "posteriorSummary.hpp"
 #include "spatialSEIRModel.hpp" 
+#include "workerHost.hpp"
+#include "numaTopology.hpp"
 #include <chrono>
 #include <thread>
+#include <algorithm>
+
+// Prior blocks are large enough to amortize the queue, and small enough
+// to spread a typical initial batch over the workers.
+#define SPATIALSEIR_PRIOR_BLOCK 256
+
 using namespace std;
 
 #ifdef SPATIALSEIR_SINGLETHREAD
@@ -126,38 +138,33 @@ void printIVector(Eigen::VectorXi inVec, std::string name)
 
 NodeWorker::NodeWorker(NodePool* pl,
                        int sd,
-                       Eigen::VectorXi s,
-                       Eigen::VectorXi e,
-                       Eigen::VectorXi i,
-                       Eigen::VectorXi r,
-                       Eigen::VectorXd offs,
-                       Eigen::MatrixXi y,
-                       MatrixXb nm,
-                       int dmt,
-                       std::vector<Eigen::MatrixXd> dmv,
-                       std::vector<std::vector<Eigen::MatrixXd> > tdmv,
-                       std::vector<int> tdme,
-                       Eigen::MatrixXd x,
-                       Eigen::MatrixXd x_rs,
-                       std::string mode,
-                       Eigen::MatrixXd ei_prior,
-                       Eigen::MatrixXd ir_prior,
-                       double avgI,
-                       Eigen::VectorXd sp_prior,
-                       Eigen::VectorXd se_prec,
-                       Eigen::VectorXd rs_prec,
-                       Eigen::VectorXd se_mean,
-                       Eigen::VectorXd rs_mean,
-                       double ph,
-                       int dmc,
-                       bool cmltv,
-                       int m,
-					   double lp)
+                       const std::vector<std::shared_ptr<const simulationContext> >& ctx,
+                       int model_seed_stride,
+                       int node)
+    : reproductive_number(*ctx[0])
 {
     pool = pl;
-    node = std::unique_ptr<SEIR_sim_node>(new SEIR_sim_node(this, sd,s,e,i,
-                         r,offs,y,nm,dmt,dmv,tdmv,tdme,x,x_rs,mode,ei_prior,ir_prior,avgI,
-                         sp_prior,se_prec,rs_prec,se_mean,rs_mean, ph,dmc,cmltv, m, lp));
+    scheduled = false;
+    numa_node = node;
+    contexts = ctx;
+    for (unsigned int k = 0; k < contexts.size(); k++)
+    {
+        sim_nodes.push_back(std::unique_ptr<SEIR_sim_node>(new SEIR_sim_node(this, 
+                        sd + k*model_seed_stride, contexts[k])));
+    }
+}
+
+int NodeWorker::numaNode() const
+{
+    return(numa_node);
+}
+
+void NodeWorker::reseed(int sd, int model_seed_stride)
+{
+    for (unsigned int k = 0; k < sim_nodes.size(); k++)
+    {
+        sim_nodes[k] -> reseed(sd + k*model_seed_stride);
+    }
 }
 
 void NodeWorker::operator()()
@@ -169,18 +176,59 @@ void NodeWorker::operator()()
         task = (pool -> tasks).front();
         (pool -> nBusy)++;
         (pool -> tasks).pop_front();
+        SEIR_sim_node* node = sim_nodes[task.model_idx].get();
         if (task.action_type == sim_atom)
         {
-            Eigen::VectorXd result = node -> simulate(task.params, false).result;
-            (*(pool -> result_pointer)).row(task.param_idx) = result; 
+            simulationResultSet result = node -> simulateChecked(task.params,
+                    task.threshold);
+            (*(pool -> result_pointer)).row(task.param_idx) = result.result.transpose(); 
+            if (result.stepsSkipped > 0)
+            {
+                (pool -> screened)++;
+                (pool -> skipped_steps) += result.stepsSkipped;
+            }
+            countProgress(result);
         }
         else if (task.action_type == sim_result_atom)
         {
             // Do these need to be re-sorted?
             simulationResultSet result = node -> simulate(task.params, true);
-            (*(pool -> result_pointer)).row(task.param_idx) = result.result; 
+            (*(pool -> result_pointer)).row(task.param_idx) = result.result.transpose(); 
             pool -> result_complete_pointer -> push_back(result);
             pool -> index_pointer -> push_back(task.param_idx);
+            countProgress(result);
+        }
+        else if (task.action_type == sim_summary_atom)
+        {
+            simulationResultSet result = node -> simulate(task.params, true);
+            (*(pool -> result_pointer)).row(task.param_idx) = result.result.transpose(); 
+            pool -> summary_pointer -> add(result);
+            countProgress(result);
+        }
+        else if (task.action_type == sim_stream_atom)
+        {
+            simulationResultSet result = node -> simulateChecked(task.params,
+                    task.threshold);
+            if (task.generation == pool -> stream_generation)
+            {
+                (pool -> stream_results).push_back(
+                        std::pair<int, Eigen::VectorXd>(task.param_idx, result.result));
+            }
+            if (result.stepsSkipped > 0)
+            {
+                (pool -> screened)++;
+                (pool -> skipped_steps) += result.stepsSkipped;
+            }
+            countProgress(result);
+        }
+        else if (task.action_type == prior_sample_atom || 
+                 task.action_type == prior_eval_atom)
+        {
+            runPriorTask(task);
+        }
+        else if (task.action_type == r0_atom)
+        {
+            runR0Task(task);
         }
         (pool -> nBusy)--;
     }
@@ -189,29 +237,30 @@ void NodeWorker::operator()()
     {
         {
             std::unique_lock<std::mutex> lock(pool -> queue_mutex);
-
-            while (!pool -> exit && (pool -> tasks).empty())
+            if ((pool -> tasks).empty())
             {
-                (pool -> condition).wait(lock);
-            }
-            if (pool -> exit)
+                // Back to the pool; later tasks dispatch the worker again
+                scheduled = false;
+                (pool -> finished).notify_all();
                 return;
+            }
             task = (pool -> tasks).front();
             (pool -> nBusy)++;
             (pool -> tasks).pop_front();
         }
+        SEIR_sim_node* node = sim_nodes[task.model_idx].get();
         if (task.action_type == sim_atom)
         {
-            Eigen::VectorXd result = node -> simulate(task.params, false).result;
+            simulationResultSet result = node -> simulateChecked(task.params,
+                    task.threshold);
+            // Every task has its own row, and the counters are atomic
+            (*(pool -> result_pointer)).row(task.param_idx) = result.result.transpose(); 
+            if (result.stepsSkipped > 0)
             {
-				std::lock_guard<std::mutex> lock(pool -> result_mutex);
-                (*(pool -> result_pointer)).row(task.param_idx) = result; 
-				while (!(node -> messages).empty()) 
-				{
-					(pool -> messages).push_back((node -> messages).front()); 
-					(node -> messages).pop_front();
-				}
+                (pool -> screened)++;
+                (pool -> skipped_steps) += result.stepsSkipped;
             }
+            countProgress(result);
         }
         else if (task.action_type == sim_result_atom)
         {
@@ -220,13 +269,47 @@ void NodeWorker::operator()()
                 std::lock_guard<std::mutex> lock(pool -> result_mutex);
                 pool -> index_pointer -> push_back(task.param_idx);
                 pool -> result_complete_pointer -> push_back(result);
-                (*(pool -> result_pointer)).row(task.param_idx) = result.result; 
-                while (!((node -> messages).empty())) 
+                (*(pool -> result_pointer)).row(task.param_idx) = result.result.transpose(); 
+            }
+            countProgress(result);
+        }
+        else if (task.action_type == sim_summary_atom)
+        {
+            simulationResultSet result = node -> simulate(task.params, true);
+            // The summary has its own locks; only the compartments are
+            // kept, so memory does not grow with the number of tasks.
+            pool -> summary_pointer -> add(result);
+            (*(pool -> result_pointer)).row(task.param_idx) = result.result.transpose(); 
+            countProgress(result);
+        }
+        else if (task.action_type == sim_stream_atom)
+        {
+            simulationResultSet result = node -> simulateChecked(task.params,
+                    task.threshold);
+            {
+                std::lock_guard<std::mutex> lock(pool -> result_mutex);
+                if (task.generation == pool -> stream_generation)
                 {
-                    (pool -> messages).push_back((node -> messages).front()); 
-                    (node -> messages).pop_front();
+                    (pool -> stream_results).push_back(
+                            std::pair<int, Eigen::VectorXd>(task.param_idx, result.result));
                 }
             }
+            if (result.stepsSkipped > 0)
+            {
+                (pool -> screened)++;
+                (pool -> skipped_steps) += result.stepsSkipped;
+            }
+            countProgress(result);
+            (pool -> result_ready).notify_one();
+        }
+        else if (task.action_type == prior_sample_atom || 
+                 task.action_type == prior_eval_atom)
+        {
+            runPriorTask(task);
+        }
+        else if (task.action_type == r0_atom)
+        {
+            runR0Task(task);
         }
 
         {
@@ -238,59 +321,176 @@ void NodeWorker::operator()()
 #endif
 }
 
+void NodeWorker::addMessage(std::string msg)
+{
+    log.push(msg);
+}
+
+void NodeWorker::countProgress(const simulationResultSet& result)
+{
+    (pool -> progress_simulations).fetch_add(1, std::memory_order_relaxed);
+    if (result.result(0) < pool -> acceptance_threshold)
+    {
+        (pool -> progress_accepted).fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void NodeWorker::runPriorTask(const instruction& task)
+{
+    const priorDensity& prior = contexts[task.model_idx] -> prior;
+    if (task.action_type == prior_sample_atom)
+    {
+        std::mt19937 block_generator(task.seed);
+        int failures = prior.sample(*(pool -> prior_dest), task.param_idx,
+                task.block_size, &block_generator);
+        if (failures > 0)
+        {
+            std::lock_guard<std::mutex> lock(pool -> result_mutex);
+            (pool -> prior_failures) += failures;
+        }
+    }
+    else
+    {
+        // Blocks write disjoint entries of the destination
+        prior.logDensity(*(pool -> prior_source), task.param_idx, 
+                task.block_size, *(pool -> prior_density));
+    }
+    finishBlock();
+}
+
+void NodeWorker::runR0Task(const instruction& task)
+{
+    // Simulations write disjoint rows and columns of the outputs
+    for (int i = task.param_idx; i < task.param_idx + task.block_size; i++)
+    {
+        reproductive_number.compute(*(pool -> r0_batch), i);
+    }
+    finishBlock();
+}
+
+void NodeWorker::finishBlock()
+{
+    {
+        std::lock_guard<std::mutex> lock(pool -> queue_mutex);
+        (pool -> block_pending)--;
+    }
+    (pool -> finished).notify_all();
+}
+
 NodePool::NodePool(Eigen::MatrixXd* rslt_ptr,
                    std::vector<simulationResultSet>* rslt_c_ptr,
                    std::vector<int>* idx_ptr,
-                       int threads,
-                       int sd,
-                       Eigen::VectorXi s,
-                       Eigen::VectorXi e,
-                       Eigen::VectorXi i,
-                       Eigen::VectorXi r,
-                       Eigen::VectorXd offs,
-                       Eigen::MatrixXi y,
-                       MatrixXb nm,
-                       int dmt,
-                       std::vector<Eigen::MatrixXd> dmv,
-                       std::vector<std::vector<Eigen::MatrixXd> > tdmv,
-                       std::vector<int> tdme,
-                       Eigen::MatrixXd x,
-                       Eigen::MatrixXd x_rs,
-                       std::string mode,
-                       Eigen::MatrixXd ei_prior,
-                       Eigen::MatrixXd ir_prior,
-                       double avgI,
-                       Eigen::VectorXd sp_prior,
-                       Eigen::VectorXd se_prec,
-                       Eigen::VectorXd rs_prec,
-                       Eigen::VectorXd se_mean,
-                       Eigen::VectorXd rs_mean,
-                       double ph,
-                       int dmc,
-                       bool cmltv,
-                       int m,
-                       double lp)
+                   int threads,
+                   int sd,
+                   std::shared_ptr<const simulationContext> context,
+                   int backend,
+                   int placement)
+    : NodePool(rslt_ptr, rslt_c_ptr, idx_ptr, threads, sd, 
+               std::vector<std::shared_ptr<const simulationContext> >(1, context),
+               backend, placement)
+{
+}
+
+NodePool::NodePool(Eigen::MatrixXd* rslt_ptr,
+                   std::vector<simulationResultSet>* rslt_c_ptr,
+                   std::vector<int>* idx_ptr,
+                   int threads,
+                   int sd,
+                   const std::vector<std::shared_ptr<const simulationContext> >& contexts,
+                   int backend,
+                   int placement)
 {
     result_pointer = rslt_ptr;
     result_complete_pointer = rslt_c_ptr;
     index_pointer = idx_ptr;
-    exit = false;
+    summary_pointer = nullptr;
     nBusy = 0;
+    screen_threshold = std::numeric_limits<double>::infinity();
+    stream_generation = 0;
+    common_streams = false;
+    common_seed = 0;
+    screened = 0;
+    skipped_steps = 0;
+    progress_simulations = 0;
+    progress_accepted = 0;
+    acceptance_threshold = std::numeric_limits<double>::infinity();
+    progress_interval = 0;
+    prior_dest = nullptr;
+    prior_source = nullptr;
+    prior_density = nullptr;
+    prior_failures = 0;
+    r0_batch = nullptr;
+    block_pending = 0;
 #ifdef SPATIALSEIR_SINGLETHREAD
     // Single threaded mode only needs single worker
-    nodes.push_back(NodeWorker(this,
-                                           sd + 1000*(1),s,e,i,
-                     r,offs,y,nm,dmt,dmv,tdmv,tdme,x,x_rs,mode,ei_prior,ir_prior,avgI,
-                     sp_prior,se_prec,rs_prec,se_mean,rs_mean,ph,dmc,cmltv, m, lp
-                    ));
+    workers.push_back(std::unique_ptr<NodeWorker>(new NodeWorker(this, 
+                    sd + 1000*(1), contexts, 1000)));
 #else
-    for (int itr = 0; itr < threads; itr++)
+    if (backend == SIM_BACKEND_PROCESSES && !ProcessPool::available())
+    {
+        messages.push_back("The process backend is not available on this platform, using threads.");
+        backend = SIM_BACKEND_THREADS;
+    }
+    if (backend == SIM_BACKEND_PROCESSES && contexts.size() > 1)
+    {
+        messages.push_back("The process backend serves a single model, using threads.");
+        backend = SIM_BACKEND_THREADS;
+    }
+    if (backend == SIM_BACKEND_PROCESSES)
+    {
+        // The pool forks all of its processes now, before any thread of
+        // this pool is started.
+        // Plain simulations go to the worker processes; a single worker
+        // handles the rarer requests which return full compartment results.
+        processes = std::unique_ptr<ProcessPool>(new ProcessPool(threads, 
+                    sd, contexts[0]));
+        threads = 1;
+    }
+    // Workers run on the threads of the workerHost. Seeds of later models
+    // follow those of every worker for the first, wherever it is placed.
+    const numaTopology& topology = numaTopology::instance();
+    const int nodes = (placement == SIM_PLACEMENT_FLOATING ? 1 :
+                       topology.nodeCount());
+    workers.resize(threads);
+    // Workers are dealt to the nodes in turn, so with fewer workers than
+    // nodes the later nodes get none, and need no replica.
+    for (int node = 0; node < std::min(nodes, threads); node++)
     {
-        nodes.push_back(std::thread(NodeWorker(this,
-                                               sd + 1000*(itr+1),s,e,i,
-                         r,offs,y,nm,dmt,dmv,tdmv,tdme,x,x_rs,mode,ei_prior,ir_prior,avgI,
-                         sp_prior,se_prec,rs_prec,se_mean,rs_mean,ph,dmc,cmltv, m, lp
-                        )));
+        auto build = [&, node](){
+            std::vector<std::shared_ptr<const simulationContext> > local = contexts;
+            if (placement == SIM_PLACEMENT_REPLICATED && nodes > 1)
+            {
+                for (unsigned int k = 0; k < contexts.size(); k++)
+                {
+                    // Models of the same data keep sharing one copy of it
+                    std::shared_ptr<const observedData> observed = nullptr;
+                    for (unsigned int j = 0; j < k; j++)
+                    {
+                        if (contexts[j] -> observed == contexts[k] -> observed)
+                        {
+                            observed = local[j] -> observed;
+                            break;
+                        }
+                    }
+                    local[k] = copySimulationContext(*contexts[k], observed);
+                }
+            }
+            for (int itr = node; itr < threads; itr += nodes)
+            {
+                workers[itr] = std::unique_ptr<NodeWorker>(new NodeWorker(this,
+                            sd + 1000*(itr+1), local, 1000*threads,
+                            (placement == SIM_PLACEMENT_FLOATING ? -1 : node)));
+            }
+        };
+        if (nodes > 1)
+        {
+            // Allocate the workers, and any replica, in memory of the node
+            topology.runOnNode(node, build);
+        }
+        else
+        {
+            build();
+        }
     }
 #endif
 }
@@ -304,23 +504,299 @@ void NodePool::setResultsDest(Eigen::MatrixXd* rslt_ptr,
     index_pointer = rslt_idx;
 }
 
+void NodePool::setSummaryDest(posteriorSummary* summary)
+{
+    summary_pointer = summary;
+}
+
 
 void NodePool::awaitFinished()
 {
 #ifdef SPATIALSEIR_SINGLETHREAD
-    nodes[0]();
+    (*workers[0])();
 #else
+    if (processes)
+    {
+        awaitProcesses();
+    }
     {
         std::unique_lock<std::mutex> lock(queue_mutex);
-        finished.wait(lock, [this](){return tasks.empty() && (nBusy == 0); });
+        auto idle = [this](){return tasks.empty() && (nBusy == 0); };
+        if (progress_interval > 0)
+        {
+            const std::chrono::milliseconds interval(progress_interval);
+            while (!finished.wait_for(lock, interval, idle))
+            {
+                lock.unlock();
+                reportProgress();
+                lock.lock();
+            }
+        }
+        else
+        {
+            finished.wait(lock, idle);
+        }
     }
 	resolveMessages();
+#endif
+    collectDiagnostics();
+}
+
+void NodePool::setAcceptanceThreshold(double threshold)
+{
+    acceptance_threshold = threshold;
+    progress_simulations = 0;
+    progress_accepted = 0;
+}
+
+void NodePool::setProgressInterval(int milliseconds)
+{
+    progress_interval = milliseconds;
+}
+
+void NodePool::reportProgress()
+{
+    resolveMessages();
+    Rcpp::Rcout << "  progress: " 
+        << progress_simulations.load(std::memory_order_relaxed)
+        << " simulations finished";
+    if (std::isfinite(acceptance_threshold))
+    {
+        Rcpp::Rcout << ", " << progress_accepted.load(std::memory_order_relaxed)
+            << " within tolerance";
+    }
+    Rcpp::Rcout << "\n";
+}
+
+void NodePool::awaitProcesses()
+{
+    std::vector<std::pair<int, Eigen::VectorXd> > completed;
+    int idle_us = 10;
+    int outstanding;
+    do
+    {
+        completed.clear();
+        processes -> restartWorkers();
+        {
+            std::lock_guard<std::mutex> lock(result_mutex);
+            outstanding = processes -> poll(completed, messages);
+            for (unsigned int i = 0; i < completed.size(); i++)
+            {
+                (*result_pointer).row(completed[i].first) = completed[i].second;
+            }
+        }
+        if (completed.empty() && outstanding > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(idle_us));
+            idle_us = (idle_us < 500 ? 2*idle_us : 500);
+        }
+        else
+        {
+            idle_us = 10;
+        }
+    } while (outstanding > 0);
+}
+
+void NodePool::awaitStreamResults(std::vector<std::pair<int, Eigen::VectorXd> >& completed)
+{
+    completed.clear();
+#ifdef SPATIALSEIR_SINGLETHREAD
+    (*workers[0])();
+    completed.insert(completed.end(), stream_results.begin(), stream_results.end());
+    stream_results.clear();
+#else
+    if (processes)
+    {
+        int idle_us = 10;
+        while (completed.empty())
+        {
+            processes -> restartWorkers();
+            {
+                std::lock_guard<std::mutex> lock(result_mutex);
+                if (processes -> poll(completed, messages) == 0)
+                {
+                    break;
+                }
+            }
+            if (completed.empty())
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(idle_us));
+                idle_us = (idle_us < 500 ? 2*idle_us : 500);
+            }
+        }
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock(result_mutex);
+        result_ready.wait(lock, [this](){return !stream_results.empty();});
+        completed.insert(completed.end(), stream_results.begin(), stream_results.end());
+        stream_results.clear();
+    }
+    resolveMessages();
+#endif
+}
+
+int NodePool::cancelStream()
+{
+    int drained = 0;
+#ifndef SPATIALSEIR_SINGLETHREAD
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        tasks.erase(std::remove_if(tasks.begin(), tasks.end(), 
+                    [](const instruction& inst){
+                        return(inst.action_type == sim_stream_atom);}), 
+                    tasks.end());
+        finished.wait(lock, [this](){return tasks.empty() && (nBusy == 0); });
+    }
+    if (processes)
+    {
+        std::vector<std::pair<int, Eigen::VectorXd> > completed;
+        processes -> cancelPending();
+        int outstanding;
+        do
+        {
+            completed.clear();
+            processes -> restartWorkers();
+            {
+                std::lock_guard<std::mutex> lock(result_mutex);
+                outstanding = processes -> poll(completed, messages);
+            }
+            drained += completed.size();
+            if (outstanding > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        } while (outstanding > 0);
+    }
+#else
+    tasks.clear();
+#endif
+    {
+        std::lock_guard<std::mutex> lock(result_mutex);
+        drained += stream_results.size();
+        stream_results.clear();
+        stream_generation++;
+    }
+    resolveMessages();
+    collectDiagnostics();
+    return(drained);
+}
+
+void NodePool::collectDiagnostics()
+{
+    for (unsigned int i = 0; i < workers.size(); i++)
+    {
+        for (unsigned int k = 0; k < (workers[i] -> sim_nodes).size(); k++)
+        {
+            diagnostics.add((workers[i] -> sim_nodes)[k] -> diagnostics);
+            ((workers[i] -> sim_nodes)[k] -> diagnostics).reset();
+        }
+    }
+}
+
+simulationDiagnostics NodePool::takeDiagnostics()
+{
+    simulationDiagnostics out = diagnostics;
+    diagnostics.reset();
+    return(out);
+}
+
+void NodePool::setCacheSize(int entries)
+{
+    for (unsigned int i = 0; i < workers.size(); i++)
+    {
+        for (unsigned int k = 0; k < (workers[i] -> sim_nodes).size(); k++)
+        {
+            (workers[i] -> sim_nodes)[k] -> setCacheSize(entries);
+        }
+    }
+}
+
+void NodePool::takeCacheCounts(long* hits, long* lookups)
+{
+    *hits = 0;
+    *lookups = 0;
+    for (unsigned int i = 0; i < workers.size(); i++)
+    {
+        for (unsigned int k = 0; k < (workers[i] -> sim_nodes).size(); k++)
+        {
+            long node_hits, node_lookups;
+            (workers[i] -> sim_nodes)[k] -> takeCacheCounts(&node_hits, &node_lookups);
+            *hits += node_hits;
+            *lookups += node_lookups;
+        }
+    }
+}
+
+void NodePool::setCommonStreams(bool enabled, unsigned int seed)
+{
+    common_streams = enabled;
+    common_seed = seed;
+    for (unsigned int i = 0; i < workers.size(); i++)
+    {
+        for (unsigned int k = 0; k < (workers[i] -> sim_nodes).size(); k++)
+        {
+            (workers[i] -> sim_nodes)[k] -> setCommonStreams(enabled, seed);
+        }
+    }
+#ifndef SPATIALSEIR_SINGLETHREAD
+    if (processes)
+    {
+        processes -> setCommonStreams(enabled, seed);
+    }
+#endif
+}
+
+void NodePool::takeApproximationCheck(std::vector<double>& exact,
+                                      std::vector<double>& approximate)
+{
+    for (unsigned int i = 0; i < workers.size(); i++)
+    {
+        for (unsigned int k = 0; k < (workers[i] -> sim_nodes).size(); k++)
+        {
+            (workers[i] -> sim_nodes)[k] -> takeApproximationCheck(exact, approximate);
+        }
+    }
+}
+
+void NodePool::setScreeningThreshold(double threshold)
+{
+    screen_threshold = threshold;
+}
+
+void NodePool::takeScreeningStats(int* scr, long* steps)
+{
+    *scr = screened.exchange(0);
+    *steps = skipped_steps.exchange(0);
+#ifndef SPATIALSEIR_SINGLETHREAD
+    if (processes)
+    {
+        int process_screened;
+        long process_steps;
+        processes -> takeScreeningStats(&process_screened, &process_steps);
+        *scr += process_screened;
+        *steps += process_steps;
+    }
 #endif
 }
 
 void NodePool::resolveMessages()
 {    
 	// 2020-02-27: Changed to only be called in master thread, avoid synchronization issues. 
+    // Workers log to their own rings, which only this thread drains.
+    std::string text;
+    for (auto& worker : workers)
+    {
+        while ((worker -> log).pop(text))
+        {
+            Rcpp::Rcout << text << "\n";
+        }
+        int dropped = (worker -> log).takeDropped();
+        if (dropped > 0)
+        {
+            Rcpp::Rcout << dropped << " log records of a worker were dropped\n";
+        }
+    }
 	while (!(messages.empty())) 
 	{
 		Rcpp::Rcout << messages.front() << "\n"; 
@@ -328,104 +804,208 @@ void NodePool::resolveMessages()
 	}
 }
 
-void NodePool::enqueue(std::string action_type, int param_idx, Eigen::VectorXd params)
+void NodePool::enqueue(std::string action_type, int param_idx, Eigen::VectorXd params,
+                       int model)
 {
     instruction inst;
     inst.param_idx = param_idx;
     inst.action_type = action_type;
     inst.params = params;
+    inst.model_idx = model;
+    inst.generation = stream_generation;
+    // Full compartment results are always simulated to the end
+    inst.threshold = (action_type == sim_result_atom || action_type == sim_summary_atom ? 
+            std::numeric_limits<double>::infinity() : screen_threshold);
+#ifndef SPATIALSEIR_SINGLETHREAD
+    if (processes && (action_type == sim_atom || action_type == sim_stream_atom))
+    {
+        processes -> enqueue(param_idx, params, inst.threshold);
+        return;
+    }
+#endif
     {
         std::lock_guard<std::mutex> lock(queue_mutex);
         tasks.push_back(inst);
     }
-    //resolveMessages();
-    condition.notify_one();
+    dispatch();
 }
 
-NodePool::~NodePool()
+void NodePool::dispatch()
 {
-	{
-		std::lock_guard<std::mutex> lock(queue_mutex);
-		exit = true;
-	}
-    condition.notify_all();
-    for (unsigned int i = 0; i < nodes.size(); i++)
+#ifndef SPATIALSEIR_SINGLETHREAD
+    std::vector<NodeWorker*> idle;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        int pending = tasks.size();
+        for (unsigned int i = 0; i < workers.size() && pending > 0; i++)
+        {
+            if (!(workers[i] -> scheduled))
+            {
+                workers[i] -> scheduled = true;
+                idle.push_back(workers[i].get());
+                pending--;
+            }
+        }
+    }
+    for (unsigned int i = 0; i < idle.size(); i++)
     {
+        workerHost::instance().submit(idle[i]);
+    }
+#endif
+}
+
+void NodePool::runBlocks(std::string action_type, int nRows, int blockRows,
+                         unsigned int seed, int model)
+{
+    if (nRows == 0)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        // Queued in front of any pending simulations, last block first
+        for (int start = ((nRows - 1)/blockRows)*blockRows; start >= 0; 
+                start -= blockRows)
+        {
+            instruction inst;
+            inst.action_type = action_type;
+            inst.param_idx = start;
+            inst.block_size = (nRows - start < blockRows ? nRows - start : blockRows);
+            inst.seed = seed + (unsigned int) start;
+            inst.threshold = std::numeric_limits<double>::infinity();
+            inst.model_idx = model;
+            inst.generation = stream_generation;
+            tasks.push_front(inst);
+            block_pending++;
+        }
+    }
 #ifdef SPATIALSEIR_SINGLETHREAD
-        nodes.pop_back();
+    (*workers[0])();
 #else
-        nodes[i].join();
+    dispatch();
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    finished.wait(lock, [this](){return block_pending == 0; });
 #endif
+}
+
+int NodePool::samplePrior(Eigen::MatrixXd& dest, unsigned int seed, int model)
+{
+    prior_dest = &dest;
+    prior_failures = 0;
+    runBlocks(prior_sample_atom, dest.rows(), SPATIALSEIR_PRIOR_BLOCK, seed, model);
+    prior_dest = nullptr;
+    return(prior_failures);
+}
+
+void NodePool::evaluatePrior(const Eigen::MatrixXd& params, 
+                             Eigen::VectorXd& logDensity, int model)
+{
+    logDensity.resize(params.rows());
+    prior_source = &params;
+    prior_density = &logDensity;
+    runBlocks(prior_eval_atom, params.rows(), SPATIALSEIR_PRIOR_BLOCK, 0, model);
+    prior_source = nullptr;
+    prior_density = nullptr;
+}
+
+void NodePool::computeReproductiveNumbers(const reproductiveNumberBatch& batch,
+                                          int nSimulations)
+{
+    r0_batch = &batch;
+    // Each simulation is costly, so they are dispatched one at a time
+    runBlocks(r0_atom, nSimulations, 1, 0);
+    r0_batch = nullptr;
+}
+
+bool NodePool::reseed(int sd)
+{
+#ifdef SPATIALSEIR_SINGLETHREAD
+    workers[0] -> reseed(sd + 1000*(1), 1000);
+#else
+    if (processes)
+    {
+        return(false);
+    }
+    const int threads = workers.size();
+    for (int itr = 0; itr < threads; itr++)
+    {
+        workers[itr] -> reseed(sd + 1000*(itr+1), 1000*threads);
     }
+#endif
+    return(true);
+}
+
+NodePool::~NodePool()
+{
+#ifndef SPATIALSEIR_SINGLETHREAD
+    // Detach from the host: the workers may not be freed while a host
+    // thread still holds them.
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    tasks.clear();
+    finished.wait(lock, [this](){
+            for (unsigned int i = 0; i < workers.size(); i++)
+            {
+                if (workers[i] -> scheduled)
+                {
+                    return(false);
+                }
+            }
+            return(true);
+        });
+#endif
 }
 
 
 SEIR_sim_node::SEIR_sim_node(NodeWorker* worker,
                              int sd,
-                             Eigen::VectorXi s,
-                             Eigen::VectorXi e,
-                             Eigen::VectorXi i,
-                             Eigen::VectorXi r,
-                             Eigen::VectorXd offs,
-                             Eigen::MatrixXi y,
-                             MatrixXb nm,
-                             int dmt,
-                             std::vector<Eigen::MatrixXd> dmv,
-                             std::vector<std::vector<Eigen::MatrixXd> > tdmv,
-                             std::vector<int> tdme,
-                             Eigen::MatrixXd x,
-                             Eigen::MatrixXd x_rs,
-                             std::string mode,
-                             Eigen::MatrixXd ei_prior,
-                             Eigen::MatrixXd ir_prior,
-                             double avgI,
-                             Eigen::VectorXd sp_prior,
-                             Eigen::VectorXd se_prec,
-                             Eigen::VectorXd rs_prec,
-                             Eigen::VectorXd se_mean,
-                             Eigen::VectorXd rs_mean,
-                             double ph,
-                             int dmc,
-                             bool cmltv,
-                             int m_,
-							 double lp
+                             std::shared_ptr<const simulationContext> ctx
                              ) : parent(worker),
+                                 context(ctx),
                                  random_seed(sd),
-                                 S0(s),
-                                 E0(e),
-                                 I0(i),
-                                 R0(r),
-                                 offset(offs),
-                                 Y(y),
-                                 na_mask(nm),
-                                 dataModelType(dmt),
-                                 DM_vec(dmv),
-                                 TDM_vec(tdmv),
-                                 TDM_empty(tdme),
-                                 X(x),
-                                 X_rs(x_rs),
-                                 transitionMode(mode),
-                                 E_to_I_prior(ei_prior),
-                                 I_to_R_prior(ir_prior),
-                                 inf_mean(avgI),
-                                 spatial_prior(sp_prior),
-                                 exposure_precision(se_prec),
-                                 reinfection_precision(rs_prec),
-                                 exposure_mean(se_mean),
-                                 reinfection_mean(rs_mean),
-                                 phi(ph),
-                                 data_compartment(dmc),
-                                 cumulative(cmltv),
-                                 m(m_),
-								 lpow(lp)
+                                 S0(ctx -> S0),
+                                 E0(ctx -> E0),
+                                 I0(ctx -> I0),
+                                 R0(ctx -> R0),
+                                 offset(ctx -> offset),
+                                 Y(ctx -> observed -> Y),
+                                 obs_start(ctx -> observed -> obs_start),
+                                 obs_loc(ctx -> observed -> obs_loc),
+                                 obs_value(ctx -> observed -> obs_value),
+                                 dataModelType(ctx -> dataModelType),
+                                 DM_vec(ctx -> DM_vec),
+                                 TDM_index(ctx -> TDM_index),
+                                 TDM_store(ctx -> TDM_store),
+                                 TDM_empty(ctx -> TDM_empty),
+                                 X(ctx -> X),
+                                 X_rs(ctx -> X_rs),
+                                 transitionMode(ctx -> transitionMode),
+                                 E_to_I_prior(ctx -> E_to_I_prior),
+                                 I_to_R_prior(ctx -> I_to_R_prior),
+                                 inf_mean(ctx -> inf_mean),
+                                 spatial_prior(ctx -> spatial_prior),
+                                 exposure_precision(ctx -> exposure_precision),
+                                 reinfection_precision(ctx -> reinfection_precision),
+                                 exposure_mean(ctx -> exposure_mean),
+                                 reinfection_mean(ctx -> reinfection_mean),
+                                 phi(ctx -> phi),
+                                 data_compartment(ctx -> data_compartment),
+                                 cumulative(ctx -> cumulative),
+                                 m(ctx -> m),
+                                 lpow(ctx -> lpow),
+                                 distance_norm(distanceNormType(ctx -> lpow))
 {
     try
     {
-        std::minstd_rand0 lc_generator(sd);
-        std::uint_least32_t seed_data[std::mt19937::state_size];
-        std::generate_n(seed_data, std::mt19937::state_size, std::ref(lc_generator));
-        std::seed_seq q(std::begin(seed_data), std::end(seed_data));
-        generator = new mt19937{q};   
+        generator = nullptr;
+        reseed(sd);
+        common_streams = false;
+        common_seed = 0;
+        use_streams = false;
+        streams = std::vector<streamEngine>(m);
+        binomial_approximation = ctx -> binomial_approximation;
+        approximation_threshold = ctx -> approximation_threshold;
+        approximation_verify = ctx -> approximation_verify;
+        check_credit = 0.0;
         int i;
  
         E_paths = std::vector<Eigen::MatrixXi>();
@@ -457,12 +1037,16 @@ SEIR_sim_node::SEIR_sim_node(NodeWorker* worker,
                 I_paths.push_back(Eigen::MatrixXi(1,Y.cols()));
             }
         }
+        noise_mean = 0.0;
+        noise_sd = 1.0;
         if (dataModelType == 1 && phi > 0)
         {   
             // We take the floor of the resulting continuous normal, so shift by 0.5
-            overdispersion_distribution = std::normal_distribution<double>(0.5, 
-                    1.0/phi);
+            noise_mean = 0.5;
+            noise_sd = 1.0/phi;
         }
+        observation_noise = Eigen::ArrayXd(Y.cols());
+        step_difference = Eigen::ArrayXd(Y.cols());
     }
     catch (int e)
     {
@@ -471,40 +1055,144 @@ SEIR_sim_node::SEIR_sim_node(NodeWorker* worker,
     }
     has_reinfection = (reinfection_precision(0) > 0); 
     has_spatial = (Y.cols() > 1);
-    has_ts_spatial = (TDM_vec[0].size() > 0);
+    has_ts_spatial = (TDM_index[0].size() > 0);
+    single_precision = ctx -> single_precision;
+
+    // Applying I + sum(rho_k DM_k) costs one product per time step with the
+    // operator as stored, but the operator is assembled for every particle:
+    // sparsely from sparse inputs, otherwise densely. Fuse only when that
+    // is repaid over the time steps of all replicates.
+    fuse_contacts = false;
+    fuse_sparse = false;
+    if (has_spatial && DM_vec.size() > 1)
+    {
+        const long n = Y.cols();
+        const long steps = (long) m*Y.rows();
+        long inputs = 0;
+        for (unsigned int d = 0; d < DM_vec.size(); d++)
+        {
+            inputs += DM_vec[d].cost();
+        }
+        const long separate = n + inputs;
+        const long fused = n + contactMatrix::identityPlusCost(DM_vec, &fuse_sparse);
+        const long assembly = (fuse_sparse ? fused + inputs : n*n + inputs);
+        fuse_contacts = (assembly + steps*fused < steps*separate);
+    }
     
-    const int nRho = (has_spatial && has_ts_spatial ? DM_vec.size() + TDM_vec[0].size() :
+    const int nRho = (has_spatial && has_ts_spatial ? DM_vec.size() + TDM_index[0].size() :
                      (has_spatial ? DM_vec.size() : 0));
     const int nReinf = (has_reinfection ? X_rs.cols() : 0);
-    const int nBeta = X.cols();
+    const int nBeta = context -> nBeta;
     const int nTrans = (transitionMode == "exponential" ? 2 : 
                        (transitionMode == "weibull" ? 4 : 0));
     total_size = nRho + nReinf + nBeta + nTrans;
 }
 
-simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCompartments)
+void SEIR_sim_node::setCacheSize(int entries)
+{
+    pressure_cache.setCapacity(entries);
+}
+
+void SEIR_sim_node::takeCacheCounts(long* hits, long* lookups)
+{
+    pressure_cache.takeCounts(hits, lookups);
+}
+
+void SEIR_sim_node::setCommonStreams(bool enabled, unsigned int seed)
 {
-    // Params is a vector made of:
-    // [Beta, Beta_RS, rho, gamma_ei, gamma_ir]    
+    common_streams = enabled;
+    common_seed = seed;
+}
+
+inline int SEIR_sim_node::binomial(int n, double p, int w)
+{
+    SEIR_DIAGNOSTIC(diagnostics.countBinomial(n, p));
+    if (use_streams)
+    {
+        // One uniform per draw keeps the streams of particles aligned
+        return(binomialInversion(n, p, uniformOpenClosed(streams[w])));
+    }
+    // Both approximations need enough of the rarer outcome, and the
+    // Poisson draw also needs it to be rare
+    const double rarer = (p > 0.5 ? 1.0 - p : p);
+    if (binomial_approximation != SIM_APPROX_NONE && 
+        n*rarer >= approximation_threshold)
+    {
+        return(binomial_approximation == SIM_APPROX_POISSON &&
+               rarer <= SIM_APPROX_POISSON_MAX_PROBABILITY ?
+               binomialPoisson(n, p, *generator) :
+               binomialNormal(n, p, normal, *generator));
+    }
+    return(std::binomial_distribution<int>(n, p)(*generator));
+}
+
+simulationResultSet SEIR_sim_node::simulateChecked(Eigen::VectorXd params,
+                                                   double screenThreshold)
+{
+    if (binomial_approximation == SIM_APPROX_NONE || common_streams ||
+        !(approximation_verify > 0))
+    {
+        return(simulate(params, false, screenThreshold));
+    }
+    check_credit += approximation_verify;
+    if (check_credit < 1.0)
+    {
+        return(simulate(params, false, screenThreshold));
+    }
+    check_credit -= 1.0;
+    // Neither run is screened, so that both distances are complete
+    simulationResultSet approximate = simulate(params, false);
+    binomial_approximation = SIM_APPROX_NONE;
+    simulationResultSet exact = simulate(params, false);
+    binomial_approximation = context -> binomial_approximation;
+    for (int w = 0; w < m; w++)
+    {
+        check_exact.push_back(exact.result(w));
+        check_approximate.push_back(approximate.result(w));
+    }
+    return(approximate);
+}
+
+void SEIR_sim_node::takeApproximationCheck(std::vector<double>& exact,
+                                           std::vector<double>& approximate)
+{
+    exact.insert(exact.end(), check_exact.begin(), check_exact.end());
+    approximate.insert(approximate.end(), check_approximate.begin(),
+                       check_approximate.end());
+    check_exact.clear();
+    check_approximate.clear();
+}
+
+simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCompartments,
+                                            double screenThreshold)
+{
+    // Params is a compact vector (see parameterLayout) made of:
+    // [Beta, Beta_RS, rho, gamma_ei, gamma_ir, report fraction, E0, I0, R0]
     int time_idx, i, j, k;   
-    unsigned int idx; 
+    SEIR_DIAGNOSTIC(const auto started = std::chrono::steady_clock::now());
 
-    const int nRho = (has_spatial && has_ts_spatial ? DM_vec.size() + TDM_vec[0].size() :
+    const int nRho = (has_spatial && has_ts_spatial ? DM_vec.size() + TDM_index[0].size() :
                      (has_spatial ? DM_vec.size() : 0));
     const int nReinf = (has_reinfection ? X_rs.cols() : 0);
-    const int nBeta = X.cols();
+    const int nBeta = context -> nBeta;
 	const int nTrans = (transitionMode == "exponential" ? 2 :
                        (transitionMode == "weibull" ? 4 : 0));
-    const int nReport = (dataModelType == 2 ? 1: 0);
-	const int nIVC = S0.size()*4;
     
 					   
     double report_fraction;
     
     simulationResultSet compartmentResults;
+    compartmentResults.stepsSkipped = 0;
  
     Eigen::VectorXd results = Eigen::VectorXd::Zero(m); 
 
+    // The running distance total never decreases, so once it reaches the
+    // threshold the replicate can no longer be accepted.
+    const double screenBound = (keepCompartments ? 
+            std::numeric_limits<double>::infinity() : 
+            distanceBound(distance_norm, screenThreshold, lpow));
+    Eigen::ArrayXd observed_value(Y.cols());
+
     // Load Beta
     Eigen::VectorXd beta = params.segment(0, nBeta); 
 
@@ -563,19 +1251,8 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
     }
 	
     
-	// Load IVC values
-	int sz = S0.size();
-	auto S0tmp = params.segment(nBeta + nReinf + nRho + nTrans + nReport, sz);
-	auto E0tmp = params.segment(nBeta + nReinf + nRho + nTrans + nReport + sz, sz);
-	auto I0tmp = params.segment(nBeta + nReinf + nRho + nTrans + nReport + 2*sz, sz);
-	auto R0tmp = params.segment(nBeta + nReinf + nRho + nTrans + nReport + 3*sz, sz);
-
-	for (int idx = 0; idx < sz; idx++){
-		S0(idx) = (int) S0tmp(idx);
-		E0(idx) = (int) E0tmp(idx);
-		I0(idx) = (int) I0tmp(idx);
-		R0(idx) = (int) R0tmp(idx);
-	}
+	// Load IVC values; params carries them only when they are estimated
+    (context -> layout).initialValues(params, S0, E0, I0, R0);
 
 	
     // Both Weibull and arbitrary path specific priors require
@@ -605,30 +1282,27 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
     Eigen::VectorXi N(S0.size());
     N = (S0 + E0 + I0 + R0);
 
-    Eigen::MatrixXd p_se_cache(S0.size(), m);
-
-    Eigen::MatrixXi current_S(S0.size(), m);
-    Eigen::MatrixXi current_E(S0.size(), m);
-    Eigen::MatrixXi current_I(S0.size(), m);
-    Eigen::MatrixXi current_R(S0.size(), m);
-
-    std::vector<compartment_tap> I_lag;
-    for (i = 0; i < m; i++)
-    {
-        I_lag.push_back(compartment_tap(TDM_vec[0].size(), S0.size()));
-    }
+    // Compartment buffers are allocated for every simulation
+    auto compartmentBuffer = [&](int rows, int cols){
+        SEIR_DIAGNOSTIC(diagnostics.allocations++);
+        return(Eigen::MatrixXi(rows, cols));
+    };
+    Eigen::MatrixXi current_S = compartmentBuffer(S0.size(), m);
+    Eigen::MatrixXi current_E = compartmentBuffer(S0.size(), m);
+    Eigen::MatrixXi current_I = compartmentBuffer(S0.size(), m);
+    Eigen::MatrixXi current_R = compartmentBuffer(S0.size(), m);
 
-    Eigen::MatrixXi previous_S(S0.size(), m);
-    Eigen::MatrixXi previous_E(S0.size(), m);
-    Eigen::MatrixXi previous_I(S0.size(), m);
-    Eigen::MatrixXi previous_R(S0.size(), m);
+    Eigen::MatrixXi previous_S = compartmentBuffer(S0.size(), m);
+    Eigen::MatrixXi previous_E = compartmentBuffer(S0.size(), m);
+    Eigen::MatrixXi previous_I = compartmentBuffer(S0.size(), m);
+    Eigen::MatrixXi previous_R = compartmentBuffer(S0.size(), m);
 
-    Eigen::MatrixXi previous_S_star(S0.size(), m);
-    Eigen::MatrixXi previous_E_star(S0.size(), m);
-    Eigen::MatrixXi previous_I_star(S0.size(), m);
-    Eigen::MatrixXi previous_R_star(S0.size(), m); 
+    Eigen::MatrixXi previous_S_star = compartmentBuffer(S0.size(), m);
+    Eigen::MatrixXi previous_E_star = compartmentBuffer(S0.size(), m);
+    Eigen::MatrixXi previous_I_star = compartmentBuffer(S0.size(), m);
+    Eigen::MatrixXi previous_R_star = compartmentBuffer(S0.size(), m); 
 
-    Eigen::MatrixXi cumulative_compartment(S0.size(), m);
+    Eigen::MatrixXi cumulative_compartment = compartmentBuffer(S0.size(), m);
 
     Eigen::MatrixXi* comparison_compartment = (data_compartment == 0 ?
                                                &previous_I_star : 
@@ -637,20 +1311,37 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
                                               (data_compartment == 2 ? 
                                                &previous_I : &previous_I_star)));
 
-    // Calculate probabilities
-    // p_se calculation
-    // Equivalent R expression: 
-    // exp(matrix(X %*% beta, nrow = nrow(Y), ncol = ncol(Y)))
-    Eigen::MatrixXd eta = (X*beta).unaryExpr([](double elem){return(
-                std::exp(elem));
-            });
-    //printDMatrix(eta, "eta");
-
-    Eigen::Map<Eigen::MatrixXd, Eigen::ColMajor> p_se_components(eta.data(), 
-                Y.rows(), Y.cols());
-
-    //printDMatrix(p_se_components, "p_se_components");
-
+    // Force of infection arithmetic, in single precision when requested
+    std::shared_ptr<infectionPressure> pressure;
+    Eigen::VectorXd pressure_key;
+    if (pressure_cache.enabled())
+    {
+        pressure_key = Eigen::VectorXd(beta.size() + rho.size());
+        pressure_key << beta, rho;
+        std::shared_ptr<infectionPressure>* cached = pressure_cache.find(pressure_key);
+        pressure_cache.count(cached != nullptr);
+        if (cached != nullptr)
+        {
+            pressure = *cached;
+        }
+    }
+    if (!pressure)
+    {
+        if (single_precision)
+        {
+            pressure = std::make_shared<infectionPressureImpl<float> >(*context, 
+                    beta, rho, has_spatial, has_ts_spatial, fuse_contacts,
+                    fuse_sparse);
+        }
+        else
+        {
+            pressure = std::make_shared<infectionPressureImpl<double> >(*context, 
+                    beta, rho, has_spatial, has_ts_spatial, fuse_contacts,
+                    fuse_sparse);
+        }
+        SEIR_DIAGNOSTIC(diagnostics.allocations++);
+        pressure_cache.insert(pressure_key, pressure);
+    }
 
     time_idx = 0;
     for (i = 0; i < m; i++)
@@ -664,14 +1355,6 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
         previous_I_star.col(i) = Eigen::VectorXi::Zero(S0.size());
         previous_R_star.col(i) = Eigen::VectorXi::Zero(S0.size());
     }
-    if (has_ts_spatial)
-    {
-        for (i = 0; i < m; i++)
-        {
-            I_lag[i].push(previous_I.col(i));
-        }
-    }
-
     if (transitionMode != "exponential")
     {
         for (i = 0; i < m; i++)
@@ -681,25 +1364,9 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
         }
     }
 
-    p_se_cache = (((previous_I.cast<double>().array().colwise())
-        /N.cast<double>().array()).array().colwise()*
-        p_se_components.row(0).transpose().array()).unaryExpr([](double e){
-            // Protect against overflow in components
-            return(e == e ? e : 0);
-        });
-
-    Eigen::MatrixXd p_se = 1*p_se_cache; 
-
-    if (has_spatial)
-    {
-        for (idx = 0; idx < DM_vec.size(); idx++)
-        {
-            p_se += rho[idx]*(DM_vec[idx] * (p_se_cache));
-        }
-    }
-    p_se = (((-1.0*p_se.array()) * (offset(0)))).unaryExpr([](double e){
-            return(1-std::exp(e));
-            }); 
+    // Every replicate starts from I0
+    Eigen::VectorXd p_se;
+    pressure -> initial(I0, N, p_se);
 
     // Not used if transitionMode != "exponential"
     Eigen::VectorXd p_ei = (-1.0*gamma_ei*offset)
@@ -727,18 +1394,19 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
         {
             compartmentResults.result(i) = 0.0;
         }
-        compartmentResults.S = Eigen::MatrixXi(Y.rows(), Y.cols());
-        compartmentResults.E = Eigen::MatrixXi(Y.rows(), Y.cols());
-        compartmentResults.I = Eigen::MatrixXi(Y.rows(), Y.cols());
-        compartmentResults.R = Eigen::MatrixXi(Y.rows(), Y.cols());
-
-        compartmentResults.S_star = Eigen::MatrixXi(Y.rows(), Y.cols());
-        compartmentResults.E_star = Eigen::MatrixXi(Y.rows(), Y.cols());
-        compartmentResults.I_star = Eigen::MatrixXi(Y.rows(), Y.cols());
-        compartmentResults.R_star = Eigen::MatrixXi(Y.rows(), Y.cols());
+        compartmentResults.S = compartmentBuffer(Y.rows(), Y.cols());
+        compartmentResults.E = compartmentBuffer(Y.rows(), Y.cols());
+        compartmentResults.I = compartmentBuffer(Y.rows(), Y.cols());
+        compartmentResults.R = compartmentBuffer(Y.rows(), Y.cols());
+
+        compartmentResults.S_star = compartmentBuffer(Y.rows(), Y.cols());
+        compartmentResults.E_star = compartmentBuffer(Y.rows(), Y.cols());
+        compartmentResults.I_star = compartmentBuffer(Y.rows(), Y.cols());
+        compartmentResults.R_star = compartmentBuffer(Y.rows(), Y.cols());
         
-        compartmentResults.X = Eigen::MatrixXd(X.rows(), X.cols());  
-        compartmentResults.X = X; 
+        // The design matrix as the simulation read it
+        compartmentResults.X = (single_precision ? 
+                Eigen::MatrixXd(context -> X_single.cast<double>()) : X);
         compartmentResults.beta = Eigen::MatrixXd(1, beta.size());
         compartmentResults.beta = beta.transpose(); 
 
@@ -769,21 +1437,32 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
     time_idx = 0;     
 
     int tmpDraw, w;
+    // With common streams every particle starts replicate w at the head of
+    // stream w. Empty path cells are then drawn too, so that each draw
+    // takes the same uniform in every particle.
+    use_streams = common_streams && !keepCompartments;
+    if (use_streams)
+    {
+        for (w = 0; w < m; w++)
+        {
+            streams[w].seed(common_seed, w);
+        }
+    }
     for (w = 0; w < m; w++)
     {
         for (i = 0; i < Y.cols(); i++)
         {
-            previous_S_star(i, w) = std::binomial_distribution<int>(
-                    previous_R(i, w), p_rs(0))(*generator);
-            previous_E_star(i, w) = std::binomial_distribution<int>(
-                    previous_S(i, w), p_se(i, w))(*generator);
+            previous_S_star(i, w) = binomial(
+                    previous_R(i, w), p_rs(0), w);
+            previous_E_star(i, w) = binomial(
+                    previous_S(i, w), p_se(i), w);
 
             if (transitionMode == "exponential")
             {
-                previous_I_star(i, w) = std::binomial_distribution<int>(
-                        previous_E(i, w), p_ei(0))(*generator);
-                previous_R_star(i, w) = std::binomial_distribution<int>(
-                        previous_I(i, w), p_ir(0))(*generator);
+                previous_I_star(i, w) = binomial(
+                        previous_E(i, w), p_ei(0), w);
+                previous_R_star(i, w) = binomial(
+                        previous_I(i, w), p_ir(0), w);
             }
             else if (transitionMode == "path_specific")
             {
@@ -793,15 +1472,16 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
                 E_paths[w](E_paths[w].rows() -1, i) = 0;
                 for (j = 0; j < offset(0); j++)
                 {
+                    SEIR_DIAGNOSTIC(diagnostics.path_iterations += E_paths[w].rows() - 1);
                     // TODO: stop early when possible
                     // idea: cache previous max?
                     for (k = E_paths[w].rows() - 2; 
                             k >= 0; k--)
                     {
-                        if (E_paths[w](k,i) > 0)
+                        if (E_paths[w](k,i) > 0 || use_streams)
                         {
-                            tmpDraw = std::binomial_distribution<int>(
-                                    E_paths[w](k,i), E_to_I_prior(k,5))(*generator);
+                            tmpDraw = binomial(
+                                    E_paths[w](k,i), E_to_I_prior(k,5), w);
                             previous_I_star(i, w) += tmpDraw;
                             E_paths[w](k,i) -= tmpDraw;
                             E_paths[w](k+1, i) = E_paths[w](k,i);
@@ -813,15 +1493,16 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
                 I_paths[w](I_paths[w].rows() -1, i) = 0;
                 for (j = 0; j < offset(0); j++)
                 {
+                    SEIR_DIAGNOSTIC(diagnostics.path_iterations += I_paths[w].rows() - 1);
                     // TODO: stop early when possible
                     // idea: cache previous max?
                     for (k = I_paths[w].rows() - 2; 
                             k >= 0; k--)
                     {
-                        if (I_paths[w](k,i) > 0)
+                        if (I_paths[w](k,i) > 0 || use_streams)
                         {
-                            tmpDraw = std::binomial_distribution<int>(
-                                    I_paths[w](k,i), I_to_R_prior(k,5))(*generator);
+                            tmpDraw = binomial(
+                                    I_paths[w](k,i), I_to_R_prior(k,5), w);
                             previous_R_star(i,w) += tmpDraw;
                             I_paths[w](k, i) -= tmpDraw;
                             I_paths[w](k+1, i) = I_paths[w](k,i);
@@ -838,17 +1519,18 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
                 E_paths[w](E_paths[w].rows() - 1, i) = 0;
                 for (j = 0; j < offset(0); j++)
                 {
+                    SEIR_DIAGNOSTIC(diagnostics.path_iterations += E_paths[w].rows() - 1);
                     // TODO: stop early when possible
                     // idea: cache previous max?
                     for (k = E_paths[w].rows() - 2; 
                             k >= 0; k--)
                     {
-                        if (E_paths[w](k,i) > 0)
+                        if (E_paths[w](k,i) > 0 || use_streams)
                         { 
-                            tmpDraw = std::binomial_distribution<int>(
+                            tmpDraw = binomial(
                                         E_paths[w](k,i),
-                                        EI_transition_dist -> getTransitionProb(k, k+1)
-                                        )(*generator);
+                                        EI_transition_dist -> getTransitionProb(k, k+1), w
+                                        );
                             previous_I_star(i,w) += tmpDraw;
                             E_paths[w](k,i) -= tmpDraw;
                             E_paths[w](k+1, i) = E_paths[w](k,i);
@@ -860,17 +1542,18 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
                 I_paths[w](I_paths[w].rows() -1, i) = 0;
                 for (j = 0; j < offset(0); j++)
                 {
+                    SEIR_DIAGNOSTIC(diagnostics.path_iterations += I_paths[w].rows() - 1);
                     // TODO: stop early when possible
                     // idea: cache previous max?
                     for (k = I_paths[w].rows() - 2; 
                             k >= 0; k--)
                     {
-                        if (I_paths[w](k,i) > 0)
+                        if (I_paths[w](k,i) > 0 || use_streams)
                         {
-                            tmpDraw = std::binomial_distribution<int>(
+                            tmpDraw = binomial(
                                         I_paths[w](k,i),
-                                        IR_transition_dist -> getTransitionProb(k, k+1)
-                                        )(*generator);
+                                        IR_transition_dist -> getTransitionProb(k, k+1), w
+                                        );
                             previous_R_star(i,w) += tmpDraw;
                             I_paths[w](k,i) -= tmpDraw;
                             I_paths[w](k+1, i) = I_paths[w](k,i);
@@ -882,29 +1565,17 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
 
             if (cumulative)
             {
-                cumulative_compartment(i) = (*comparison_compartment)(i);
+                cumulative_compartment(i, w) = (*comparison_compartment)(i, w);
             }
 
-            
-            if (!na_mask(0,i))
-            {
-                if (dataModelType == 1){
-                    results(w) += std::pow((*comparison_compartment)(i,w) + 
-                        std::floor(overdispersion_distribution(*generator)) -
-                        Y(0, i), lpow);
-                }
-                else if (dataModelType == 2){
-                    results(w) += std::pow(std::abs(std::binomial_distribution<int>(
-                                (*comparison_compartment)(i,w),
-                            report_fraction)(*generator) - Y(0,i)), lpow);
-                }
-                else{
-                    results(w) += std::pow(std::abs((*comparison_compartment)(i,w) -
-                        Y(0, i)), lpow);
-                }
-            }
+            observed_value(i) = (*comparison_compartment)(i,w);
         }// End i loop
+        // Observation noise and the distance are computed for all locations
+        // at once when the time step is complete
+        observe(observed_value, 0, report_fraction, w);
+        results(w) = stepDistance(results(w), observed_value, 0);
     }// End w loop
+    SEIR_DIAGNOSTIC(diagnostics.time_steps += m);
 
     if (keepCompartments)
     {
@@ -942,58 +1613,36 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
     previous_R = current_R;
 
     // Simulation: iterative case
-    //printDMatrix(p_se_components, "p_se_components");
-    int lag;
     for (w = 0; w < m; w++)
     {
+        if (w > 0 && results(0) >= screenBound)
+        {
+            // Only replicate 0 decides acceptance; once it is screened out
+            // the other replicates are not simulated at all.
+            compartmentResults.stepsSkipped += (m - w)*(Y.rows() - 1);
+            results.segment(w, m - w).fill(std::numeric_limits<double>::infinity());
+            break;
+        }
+        pressure -> startReplicate();
         for (time_idx = 1; time_idx < Y.rows(); time_idx++)
         {
-            p_se_cache = ((previous_I.cast<double>().array().col(w)).array()
-                /N.cast<double>().array()*
-                p_se_components.row(time_idx).transpose().array()
-                ).unaryExpr([](double e){
-                    // Protect against overflow in components
-                    return(e == e ? e : 0);
-                });
-
-            p_se = 1*p_se_cache; 
-            if (has_spatial)
+            if (w == 0 && results(0) >= screenBound)
             {
-                for (idx = 0; idx < DM_vec.size(); idx++)
-                {
-                    p_se += rho[idx]*(DM_vec[idx] * p_se_cache);
-                }
+                compartmentResults.stepsSkipped += Y.rows() - time_idx;
+                break;
             }
+            SEIR_DIAGNOSTIC(diagnostics.time_steps++);
+            pressure -> step(time_idx, previous_I.col(w), p_se);
 
-            if (has_ts_spatial && !TDM_empty[time_idx])
-            {   
-                for (lag = 0; time_idx - lag - 1 >= 0 && lag < (int) TDM_vec[0].size(); lag++)
-                {
-                    p_se_cache = ((I_lag[w].get(lag).cast<double>()).array()
-                        /N.cast<double>().array()*
-                        p_se_components.row(time_idx - lag - 1).transpose().array()
-                        ).unaryExpr([](double e){
-                            // Protect against overflow in components
-                            return(e == e ? e : 0);}
-                        );
-                    p_se += rho[DM_vec.size() + lag]*(TDM_vec[time_idx-lag - 1][lag] * p_se_cache);
-                }
-            }
-
-
-            //Rcpp::Rcout << "offset(" << time_idx << "): " << offset(time_idx) << "\n";
-            p_se = ((-1.0*p_se.array() * offset(time_idx)).matrix()
-                    ).unaryExpr([](double e){return(1-std::exp(e));});
-     
             for (i = 0; i < Y.cols(); i++)
             {
-                previous_S_star(i,w) = std::binomial_distribution<int>(previous_R(i,w), p_rs(time_idx))(*generator);
-                previous_E_star(i,w) = std::binomial_distribution<int>(previous_S(i,w), p_se(i,0))(*generator);
+                previous_S_star(i,w) = binomial(previous_R(i,w), p_rs(time_idx), w);
+                previous_E_star(i,w) = binomial(previous_S(i,w), p_se(i), w);
 
                 if (transitionMode == "exponential")
                 {
-                    previous_I_star(i,w) = std::binomial_distribution<int>(previous_E(i,w), p_ei(time_idx))(*generator);
-                    previous_R_star(i,w) = std::binomial_distribution<int>(previous_I(i,w), p_ir(time_idx))(*generator);
+                    previous_I_star(i,w) = binomial(previous_E(i,w), p_ei(time_idx), w);
+                    previous_R_star(i,w) = binomial(previous_I(i,w), p_ir(time_idx), w);
                 }
                 else if (transitionMode == "path_specific")
                 {
@@ -1003,14 +1652,15 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
                     E_paths[w](E_paths[w].rows() -1, i) = 0;
                     for (j = 0; j < offset(time_idx); j++)
                     {
+                        SEIR_DIAGNOSTIC(diagnostics.path_iterations += E_paths[w].rows() - 1);
                         // TODO: stop early when possible
                         // idea: cache previous max?
                         for (k = E_paths[w].rows() - 2; 
                                 k >= 0; k--)
                         {
-                            if (E_paths[w](k,i) > 0)
+                            if (E_paths[w](k,i) > 0 || use_streams)
                             {
-                                tmpDraw = std::binomial_distribution<int>(E_paths[w](k,i), E_to_I_prior(k,5))(*generator);
+                                tmpDraw = binomial(E_paths[w](k,i), E_to_I_prior(k,5), w);
                                 previous_I_star(i,w) += tmpDraw;
                                 E_paths[w](k,i) -= tmpDraw;
                                 E_paths[w](k+1, i) = E_paths[w](k,i);
@@ -1022,14 +1672,15 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
                     I_paths[w](I_paths[w].rows() -1, i) = 0;
                     for (j = 0; j < offset(time_idx); j++)
                     {
+                        SEIR_DIAGNOSTIC(diagnostics.path_iterations += I_paths[w].rows() - 1);
                         // TODO: stop early when possible
                         // idea: cache previous max?
                         for (k = I_paths[w].rows() - 2; 
                                 k >= 0; k--)
                         {
-                            if (I_paths[w](k,i) > 0)
+                            if (I_paths[w](k,i) > 0 || use_streams)
                             {
-                                tmpDraw = std::binomial_distribution<int>(I_paths[w](k,i), I_to_R_prior(k,5))(*generator);
+                                tmpDraw = binomial(I_paths[w](k,i), I_to_R_prior(k,5), w);
                                 previous_R_star(i,w) += tmpDraw;
                                 I_paths[w](k,i) -= tmpDraw;
                                 I_paths[w](k+1, i) = I_paths[w](k,i);
@@ -1046,16 +1697,17 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
                     E_paths[w](E_paths[w].rows() - 1, i) = 0;
                     for (j = 0; j < offset(time_idx); j++)
                     {
+                        SEIR_DIAGNOSTIC(diagnostics.path_iterations += E_paths[w].rows() - 1);
                         // TODO: stop early when possible
                         // idea: cache previous max?
                         for (k = E_paths[w].rows() - 2; 
                                 k >= 0; k--)
                         {
-                            if (E_paths[w](k,i) > 0)
+                            if (E_paths[w](k,i) > 0 || use_streams)
                             {
-                                tmpDraw = std::binomial_distribution<int>(
+                                tmpDraw = binomial(
                                         E_paths[w](k,i), 
-                                        EI_transition_dist -> getTransitionProb(k, k+1))(*generator); 
+                                        EI_transition_dist -> getTransitionProb(k, k+1), w); 
                                 previous_I_star(i,w) += tmpDraw;
                                 E_paths[w](k,i) -= tmpDraw;
                                 E_paths[w](k+1, i) = E_paths[w](k,i);
@@ -1067,17 +1719,18 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
                     I_paths[w](I_paths[w].rows() -1, i) = 0;
                     for (j = 0; j < offset(time_idx); j++)
                     {
+                        SEIR_DIAGNOSTIC(diagnostics.path_iterations += I_paths[w].rows() - 1);
                         // TODO: stop early when possible
                         // idea: cache previous max?
                         for (k = I_paths[w].rows() - 2; 
                                 k >= 0; k--)
                         {
-                            if (I_paths[w](k,i) > 0)
+                            if (I_paths[w](k,i) > 0 || use_streams)
                             {
-                                tmpDraw = std::binomial_distribution<int>(
+                                tmpDraw = binomial(
                                         I_paths[w](k,i), 
-                                        IR_transition_dist -> getTransitionProb(k,k+1)
-                                        )(*generator); 
+                                        IR_transition_dist -> getTransitionProb(k,k+1), w
+                                        ); 
                                 previous_R_star(i,w) += tmpDraw;
                                 I_paths[w](k,i) -= tmpDraw;
                                 I_paths[w](k+1, i) = I_paths[w](k,i);
@@ -1090,46 +1743,12 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
                 if (cumulative)
                 {
                     cumulative_compartment(i,w) += (*comparison_compartment)(i,w); 
-
-                    if (!na_mask(time_idx,i))
-                    {
-                        if (dataModelType == 1){
-                            results(w) += std::pow(std::abs((cumulative_compartment)(i,w) + 
-                                std::floor(overdispersion_distribution(*generator)) -
-                                Y(time_idx, i)), lpow);
-                        }
-                        else if (dataModelType == 2){
-                            results(w) += std::pow(std::abs(std::binomial_distribution<int>(
-                                        (cumulative_compartment)(i,w),
-                                    report_fraction)(*generator) - Y(time_idx,i)), lpow);
-                        }
-                        else{
-                            results(w) += std::pow(std::abs((cumulative_compartment)(i,w) -
-                                                   Y(time_idx, i)), lpow);
-                        }
-                    }
-                }
-                else
-                {
-                    if (!na_mask(time_idx,i))
-                    {
-                        if (dataModelType == 1){
-                            results(w) += std::pow(std::abs((*comparison_compartment)(i,w) + 
-                                std::floor(overdispersion_distribution(*generator)) -
-                                Y(time_idx, i)), lpow);
-                        }
-                        else if (dataModelType == 2){
-                            results(w) += std::pow(std::abs(std::binomial_distribution<int>(
-                                        (*comparison_compartment)(i,w),
-                                    report_fraction)(*generator) - Y(time_idx,i)), lpow);
-                        }
-                        else{
-                            results(w) += std::pow(std::abs((*comparison_compartment)(i,w) -
-                                Y(time_idx, i)), lpow);
-                        }
-                    }
                 }
+                observed_value(i) = (cumulative ? cumulative_compartment(i,w) :
+                                      (*comparison_compartment)(i,w));
             }
+            observe(observed_value, time_idx, report_fraction, w);
+            results(w) = stepDistance(results(w), observed_value, time_idx);
 
             if (keepCompartments)
             {
@@ -1160,10 +1779,6 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
                 I_paths[w].row(0) = previous_I_star.col(w);
             }
 
-            if (has_ts_spatial)
-            {
-                I_lag[w].push(previous_I.col(w));
-            }
             previous_S.col(w) = current_S.col(w);
             previous_E.col(w) = current_E.col(w);
             previous_I.col(w) = current_I.col(w);
@@ -1171,17 +1786,81 @@ simulationResultSet SEIR_sim_node::simulate(Eigen::VectorXd params, bool keepCom
 
         }
         
-        results(w) = std::pow(results(w), 1.0/lpow);
+        results(w) = finishDistance(distance_norm, results(w), lpow);
         
     }
 
     compartmentResults.result = results;
+    SEIR_DIAGNOSTIC(diagnostics.recordTime(std::chrono::duration_cast<
+                std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                    started).count()/1000.0));
     return(compartmentResults);
 }
 
+void SEIR_sim_node::observe(Eigen::ArrayXd& value, int time_idx, 
+                            double report_fraction, int w)
+{
+    if (dataModelType == 1)
+    {
+        // Noise for the whole time step is drawn as one batch
+        if (use_streams)
+        {
+            normalBatch(observation_noise, noise_mean, noise_sd, streams[w]);
+        }
+        else
+        {
+            normalBatch(observation_noise, noise_mean, noise_sd, *generator);
+        }
+        value += observation_noise.floor();
+    }
+    else if (dataModelType == 2)
+    {
+        // Missing cells do not contribute to the distance
+        for (int k = obs_start[time_idx]; k < obs_start[time_idx + 1]; k++)
+        {
+            SEIR_DIAGNOSTIC(diagnostics.countBinomial((int) value(obs_loc[k]),
+                                                      report_fraction));
+            value(obs_loc[k]) = (use_streams ? 
+                    binomialInversion((int) value(obs_loc[k]), report_fraction,
+                                      uniformOpenClosed(streams[w])) :
+                    binomialDraw((int) value(obs_loc[k]), report_fraction,
+                                 *generator));
+        }
+    }
+}
+
+double SEIR_sim_node::stepDistance(double total, const Eigen::ArrayXd& value, 
+                                   int time_idx)
+{
+    const int start = obs_start[time_idx];
+    const int n = obs_start[time_idx + 1] - start;
+    for (int k = 0; k < n; k++)
+    {
+        step_difference(k) = std::abs(value(obs_loc[start + k]) - obs_value(start + k));
+    }
+    return(accumulateDistance(distance_norm, total, step_difference.head(n), lpow));
+}
+
 void SEIR_sim_node::nodeMessage(std::string msg)
 {
-    messages.push_back(msg);
+    // Nodes in forked worker processes have no worker to log through
+    if (parent != nullptr)
+    {
+        parent -> addMessage(msg);
+    }
+}
+
+void SEIR_sim_node::reseed(int sd)
+{
+    std::minstd_rand0 lc_generator(sd);
+    std::uint_least32_t seed_data[std::mt19937::state_size];
+    std::generate_n(seed_data, std::mt19937::state_size, std::ref(lc_generator));
+    std::seed_seq q(std::begin(seed_data), std::end(seed_data));
+    delete generator;
+    generator = new mt19937{q};   
+    normal.reset();
+    check_credit = 0.0;
+    random_seed = sd;
 }
 
 SEIR_sim_node::~SEIR_sim_node()
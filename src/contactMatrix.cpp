@@ -0,0 +1,441 @@
+#include <cmath>
+#include <functional>
+#include <contactMatrix.hpp>
+
+// Above this fraction of non-zero entries a dense product is faster than
+// walking the compressed columns.
+#define CONTACT_MATRIX_SPARSE_DENSITY 0.25
+
+// Store mat in dense or sparse form according to its density
+template <typename Scalar>
+static bool storeMatrix(const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& mat,
+                        Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& dense,
+                        Eigen::SparseMatrix<Scalar>& sparse)
+{
+    long nonZeros = (mat.array() != Scalar(0)).count();
+    bool isSparse = (nonZeros <= CONTACT_MATRIX_SPARSE_DENSITY*mat.size());
+    if (isSparse)
+    {
+        sparse = mat.sparseView();
+        sparse.makeCompressed();
+    }
+    else
+    {
+        dense = mat;
+    }
+    return(isSparse);
+}
+
+template <typename Scalar>
+static void addMatrix(Scalar scale, const Eigen::SparseMatrix<Scalar>& sparse,
+                      Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& target)
+{
+    for (int j = 0; j < sparse.outerSize(); j++)
+    {
+        for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(sparse, j); 
+                it; ++it)
+        {
+            target(it.row(), it.col()) += scale*it.value();
+        }
+    }
+}
+
+// Column sums of w(b)*(1 - exp(-scale*x(a)*M(b, a))); zero entries add
+// nothing, so only the stored entries of a sparse matrix are visited.
+template <typename Scalar>
+static void addExposures(double scale, const Eigen::SparseMatrix<Scalar>& sparse,
+                         const Eigen::Ref<const Eigen::VectorXd>& x,
+                         const Eigen::Ref<const Eigen::VectorXd>& w,
+                         Eigen::Ref<Eigen::VectorXd> out)
+{
+    for (int a = 0; a < sparse.outerSize(); a++)
+    {
+        if (x(a) == 0)
+        {
+            continue;
+        }
+        for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(sparse, a); 
+                it; ++it)
+        {
+            out(a) += w(it.row())*(1.0 - std::exp(-scale*x(a)*it.value()));
+        }
+    }
+}
+
+template <typename Scalar>
+static void addExposures(double scale, 
+                         const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& dense,
+                         const Eigen::Ref<const Eigen::VectorXd>& x,
+                         const Eigen::Ref<const Eigen::VectorXd>& w,
+                         Eigen::Ref<Eigen::VectorXd> out)
+{
+    for (int a = 0; a < dense.cols(); a++)
+    {
+        if (x(a) == 0)
+        {
+            continue;
+        }
+        for (int b = 0; b < dense.rows(); b++)
+        {
+            out(a) += w(b)*(1.0 - std::exp(-scale*x(a)*dense(b, a)));
+        }
+    }
+}
+
+contactMatrix::contactMatrix(const Eigen::MatrixXd& mat, bool singlePrecision)
+{
+    single = singlePrecision;
+    if (single)
+    {
+        sparse = storeMatrix<float>(mat.cast<float>(), dense_mat_f, sparse_mat_f);
+    }
+    else
+    {
+        sparse = storeMatrix<double>(mat, dense_mat, sparse_mat);
+    }
+}
+
+contactMatrix::contactMatrix(const Eigen::MatrixXf& mat)
+{
+    single = true;
+    sparse = storeMatrix<float>(mat, dense_mat_f, sparse_mat_f);
+}
+
+void contactMatrix::multiplyAdd(double scale, 
+                                const Eigen::Ref<const Eigen::VectorXd>& x,
+                                Eigen::Ref<Eigen::VectorXd> y) const
+{
+    if (single)
+    {
+        Eigen::VectorXf yf = y.cast<float>();
+        multiplyAdd((float) scale, x.cast<float>(), yf);
+        y = yf.cast<double>();
+    }
+    else if (sparse)
+    {
+        y += scale*(sparse_mat*x);
+    }
+    else
+    {
+        y += scale*(dense_mat*x);
+    }
+}
+
+void contactMatrix::multiplyAdd(float scale, 
+                                const Eigen::Ref<const Eigen::VectorXf>& x,
+                                Eigen::Ref<Eigen::VectorXf> y) const
+{
+    if (!single)
+    {
+        Eigen::VectorXd yd = y.cast<double>();
+        multiplyAdd((double) scale, x.cast<double>(), yd);
+        y = yd.cast<float>();
+    }
+    else if (sparse)
+    {
+        y += scale*(sparse_mat_f*x);
+    }
+    else
+    {
+        y += scale*(dense_mat_f*x);
+    }
+}
+
+void contactMatrix::expectedExposures(double scale,
+                                      const Eigen::Ref<const Eigen::VectorXd>& x,
+                                      const Eigen::Ref<const Eigen::VectorXd>& w,
+                                      Eigen::Ref<Eigen::VectorXd> out) const
+{
+    if (single && sparse)
+    {
+        addExposures<float>(scale, sparse_mat_f, x, w, out);
+    }
+    else if (single)
+    {
+        addExposures<float>(scale, dense_mat_f, x, w, out);
+    }
+    else if (sparse)
+    {
+        addExposures<double>(scale, sparse_mat, x, w, out);
+    }
+    else
+    {
+        addExposures<double>(scale, dense_mat, x, w, out);
+    }
+}
+
+bool contactMatrix::equals(const Eigen::MatrixXd& mat) const
+{
+    if (mat.rows() != rows() || mat.cols() != rows())
+    {
+        return(false);
+    }
+    if (single)
+    {
+        return((sparse ? Eigen::MatrixXf(sparse_mat_f) : dense_mat_f) == 
+                mat.cast<float>());
+    }
+    if (sparse)
+    {
+        return(Eigen::MatrixXd(sparse_mat) == mat);
+    }
+    return(dense_mat == mat);
+}
+
+bool contactMatrix::isSparse() const
+{
+    return(sparse);
+}
+
+bool contactMatrix::isSingle() const
+{
+    return(single);
+}
+
+int contactMatrix::rows() const
+{
+    if (single)
+    {
+        return(sparse ? sparse_mat_f.rows() : dense_mat_f.rows());
+    }
+    return(sparse ? sparse_mat.rows() : dense_mat.rows());
+}
+
+long contactMatrix::cost() const
+{
+    if (single)
+    {
+        return(sparse ? (long) sparse_mat_f.nonZeros() : (long) dense_mat_f.size());
+    }
+    return(sparse ? (long) sparse_mat.nonZeros() : (long) dense_mat.size());
+}
+
+void contactMatrix::addTo(double scale, Eigen::MatrixXd& target) const
+{
+    if (single)
+    {
+        Eigen::MatrixXf tf = target.cast<float>();
+        addTo((float) scale, tf);
+        target = tf.cast<double>();
+    }
+    else if (sparse)
+    {
+        addMatrix<double>(scale, sparse_mat, target);
+    }
+    else
+    {
+        target += scale*dense_mat;
+    }
+}
+
+void contactMatrix::addTo(float scale, Eigen::MatrixXf& target) const
+{
+    if (!single)
+    {
+        Eigen::MatrixXd td = target.cast<double>();
+        addTo((double) scale, td);
+        target = td.cast<float>();
+    }
+    else if (sparse)
+    {
+        addMatrix<float>(scale, sparse_mat_f, target);
+    }
+    else
+    {
+        target += scale*dense_mat_f;
+    }
+}
+
+void contactMatrix::addTo(double scale, Eigen::SparseMatrix<double>& target) const
+{
+    if (single)
+    {
+        Eigen::SparseMatrix<float> tf = target.cast<float>();
+        addTo((float) scale, tf);
+        target = tf.cast<double>();
+    }
+    else if (sparse)
+    {
+        target = target + scale*sparse_mat;
+    }
+    else
+    {
+        target = target + scale*Eigen::SparseMatrix<double>(dense_mat.sparseView());
+    }
+}
+
+void contactMatrix::addTo(float scale, Eigen::SparseMatrix<float>& target) const
+{
+    if (!single)
+    {
+        Eigen::SparseMatrix<double> td = target.cast<double>();
+        addTo((double) scale, td);
+        target = td.cast<float>();
+    }
+    else if (sparse)
+    {
+        target = target + scale*sparse_mat_f;
+    }
+    else
+    {
+        target = target + scale*Eigen::SparseMatrix<float>(dense_mat_f.sparseView());
+    }
+}
+
+contactMatrix contactMatrix::toSingle() const
+{
+    if (single)
+    {
+        return(*this);
+    }
+    return(contactMatrix(sparse ? Eigen::MatrixXd(sparse_mat) : dense_mat, true));
+}
+
+contactMatrix::contactMatrix()
+{
+    sparse = false;
+    single = false;
+}
+
+long contactMatrix::identityPlusCost(const std::vector<contactMatrix>& mats,
+                                     bool* isSparse)
+{
+    const long n = (mats.size() > 0 ? mats[0].rows() : 0);
+    *isSparse = false;
+    for (unsigned int k = 0; k < mats.size(); k++)
+    {
+        if (!mats[k].isSparse())
+        {
+            // The sum is at least as dense as any of its terms
+            return(n*n);
+        }
+    }
+    // Entries of the sum are the union of those of the terms
+    Eigen::SparseMatrix<double> pattern(n, n);
+    pattern.setIdentity();
+    for (unsigned int k = 0; k < mats.size(); k++)
+    {
+        Eigen::SparseMatrix<double> term(n, n);
+        mats[k].addTo(1.0, term);
+        pattern = pattern + term.unaryExpr([](double){return(1.0);});
+    }
+    *isSparse = (pattern.nonZeros() <= CONTACT_MATRIX_SPARSE_DENSITY*n*n);
+    return(*isSparse ? (long) pattern.nonZeros() : n*n);
+}
+
+contactMatrix contactMatrix::identityPlus(const std::vector<contactMatrix>& mats,
+                                          const Eigen::VectorXd& weights,
+                                          bool singlePrecision,
+                                          bool sparseForm)
+{
+    const int n = (mats.size() > 0 ? mats[0].rows() : 0);
+    if (!sparseForm)
+    {
+        if (singlePrecision)
+        {
+            Eigen::MatrixXf op = Eigen::MatrixXf::Identity(n, n);
+            for (unsigned int k = 0; k < mats.size(); k++)
+            {
+                mats[k].addTo((float) weights(k), op);
+            }
+            return(contactMatrix(op));
+        }
+        Eigen::MatrixXd op = Eigen::MatrixXd::Identity(n, n);
+        for (unsigned int k = 0; k < mats.size(); k++)
+        {
+            mats[k].addTo(weights(k), op);
+        }
+        return(contactMatrix(op));
+    }
+    contactMatrix out;
+    out.sparse = true;
+    out.single = singlePrecision;
+    if (singlePrecision)
+    {
+        out.sparse_mat_f.resize(n, n);
+        out.sparse_mat_f.setIdentity();
+        for (unsigned int k = 0; k < mats.size(); k++)
+        {
+            mats[k].addTo((float) weights(k), out.sparse_mat_f);
+        }
+        // Entries which cancel are not kept, as for a dense sum
+        out.sparse_mat_f.prune(0.0f);
+        out.sparse_mat_f.makeCompressed();
+    }
+    else
+    {
+        out.sparse_mat.resize(n, n);
+        out.sparse_mat.setIdentity();
+        for (unsigned int k = 0; k < mats.size(); k++)
+        {
+            mats[k].addTo(weights(k), out.sparse_mat);
+        }
+        out.sparse_mat.prune(0.0);
+        out.sparse_mat.makeCompressed();
+    }
+    return(out);
+}
+
+contactMatrixStore::contactMatrixStore()
+{
+}
+
+size_t contactMatrixStore::hashMatrix(const Eigen::MatrixXd& mat)
+{
+    std::hash<double> hasher;
+    size_t seed = (size_t) mat.rows();
+    for (int i = 0; i < mat.size(); i++)
+    {
+        // equals() compares by value, so -0.0 must hash like 0.0
+        const double value = (mat.data()[i] == 0.0 ? 0.0 : mat.data()[i]);
+        seed ^= hasher(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+    return(seed);
+}
+
+int contactMatrixStore::add(const Eigen::MatrixXd& mat)
+{
+    size_t key = hashMatrix(mat);
+    auto range = lookup.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (matrices[it -> second].equals(mat))
+        {
+            return(it -> second);
+        }
+    }
+    matrices.push_back(contactMatrix(mat));
+    lookup.insert(std::make_pair(key, (int) matrices.size() - 1));
+    return((int) matrices.size() - 1);
+}
+
+const contactMatrix& contactMatrixStore::get(int idx) const
+{
+    return(matrices[idx]);
+}
+
+int contactMatrixStore::size() const
+{
+    return((int) matrices.size());
+}
+
+contactMatrixStore contactMatrixStore::toSingle() const
+{
+    contactMatrixStore out;
+    out.lookup = lookup;
+    for (unsigned int i = 0; i < matrices.size(); i++)
+    {
+        out.matrices.push_back(matrices[i].toSingle());
+    }
+    return(out);
+}
+
+int contactMatrixStore::sparseCount() const
+{
+    int out = 0;
+    for (unsigned int i = 0; i < matrices.size(); i++)
+    {
+        out += matrices[i].isSparse();
+    }
+    return(out);
+}
@@ -0,0 +1,234 @@
+#include <Rcpp.h>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <distanceEmulator.hpp>
+
+// Pairs added since the tree was built which are scanned directly, at the
+// least; beyond this, and an eighth of the stored pairs, the tree is rebuilt.
+#define SPATIALSEIR_EMULATOR_RECENT 256
+
+distanceEmulator::distanceEmulator(int nParams, int cap, int nNeighbors)
+    : points(cap, nParams), distances(cap), lower(cap, false),
+      weights(Eigen::VectorXd::Ones(nParams)),
+      capacity(cap), k(nNeighbors), count(0), next(0), replaced(cap, false)
+{
+    if (cap < nNeighbors || nNeighbors < 1)
+    {
+        Rcpp::stop("Emulator capacity must be at least the number of neighbors.\n");
+    }
+}
+
+void distanceEmulator::setScale(const Eigen::VectorXd& scale)
+{
+    for (int j = 0; j < weights.size(); j++)
+    {
+        weights(j) = (!(scale(j) > 0) ? 0.0 : 1.0/(scale(j)*scale(j)));
+    }
+    buildTree();
+}
+
+void distanceEmulator::add(const Eigen::VectorXd& params, double distance,
+                           bool lowerBound)
+{
+    if (!std::isfinite(distance))
+    {
+        // A failed simulation says nothing about its neighbours
+        return;
+    }
+    points.row(next) = params.transpose();
+    distances(next) = distance;
+    lower[next] = lowerBound;
+    replaced[next] = (next < tree_points.rows());
+    recent.push_back(next);
+    next = (next + 1) % capacity;
+    count = (count < capacity ? count + 1 : capacity);
+    if ((int) recent.size() > std::max(SPATIALSEIR_EMULATOR_RECENT, count/8))
+    {
+        buildTree();
+    }
+}
+
+void distanceEmulator::add(const Eigen::MatrixXd& params,
+                           const Eigen::MatrixXd& results,
+                           double screenThreshold)
+{
+    for (int i = 0; i < params.rows(); i++)
+    {
+        add(params.row(i).transpose(), results(i, 0),
+            results(i, 0) >= screenThreshold);
+    }
+}
+
+bool distanceEmulator::ready() const
+{
+    return(count >= 10*k);
+}
+
+void distanceEmulator::buildTree()
+{
+    const int p = weights.size();
+    Eigen::VectorXd sd = weights.cwiseSqrt();
+    std::vector<int> order(count);
+    int i, lo, hi;
+    for (i = 0; i < count; i++)
+    {
+        order[i] = i;
+    }
+    tree_dim.assign(count, 0);
+    // Each range is split at its middle along its widest dimension
+    std::vector<std::pair<int, int> > ranges;
+    if (count > 0)
+    {
+        ranges.push_back(std::pair<int, int>(0, count));
+    }
+    while (!ranges.empty())
+    {
+        lo = ranges.back().first;
+        hi = ranges.back().second;
+        ranges.pop_back();
+        const int mid = (lo + hi)/2;
+        int dim = 0;
+        double widest = -1.0;
+        for (int j = 0; j < p; j++)
+        {
+            double mn = std::numeric_limits<double>::infinity();
+            double mx = -mn;
+            for (i = lo; i < hi; i++)
+            {
+                mn = std::min(mn, points(order[i], j));
+                mx = std::max(mx, points(order[i], j));
+            }
+            if (sd(j)*(mx - mn) > widest)
+            {
+                widest = sd(j)*(mx - mn);
+                dim = j;
+            }
+        }
+        std::nth_element(order.begin() + lo, order.begin() + mid,
+                         order.begin() + hi, [&](int a, int b){
+                return(points(a, dim) < points(b, dim));});
+        tree_dim[mid] = dim;
+        if (mid - lo > 1)
+        {
+            ranges.push_back(std::pair<int, int>(lo, mid));
+        }
+        if (hi - mid > 2)
+        {
+            ranges.push_back(std::pair<int, int>(mid + 1, hi));
+        }
+    }
+    tree_points.resize(count, p);
+    tree_distances.resize(count);
+    tree_slot = order;
+    for (i = 0; i < count; i++)
+    {
+        tree_points.row(i) = points.row(order[i]).cwiseProduct(sd.transpose());
+        tree_distances(i) = distances(order[i]);
+    }
+    replaced.assign(capacity, false);
+    recent.clear();
+}
+
+// nearest is a max-heap of (squared scaled distance, entry), where entries
+// of the tree are numbered from zero and recent slots from -1 down.
+void distanceEmulator::offer(double d2, int idx,
+                             std::vector<std::pair<double, int> >& nearest) const
+{
+    if ((int) nearest.size() < k)
+    {
+        nearest.push_back(std::pair<double, int>(d2, idx));
+        std::push_heap(nearest.begin(), nearest.end());
+    }
+    else if (d2 < nearest.front().first)
+    {
+        std::pop_heap(nearest.begin(), nearest.end());
+        nearest.back() = std::pair<double, int>(d2, idx);
+        std::push_heap(nearest.begin(), nearest.end());
+    }
+}
+
+void distanceEmulator::searchTree(int lo, int hi, const Eigen::VectorXd& query,
+                                  std::vector<std::pair<double, int> >& nearest) const
+{
+    if (lo >= hi)
+    {
+        return;
+    }
+    const int mid = (lo + hi)/2;
+    if (!replaced[tree_slot[mid]])
+    {
+        offer((tree_points.row(mid).transpose() - query).squaredNorm(), mid, nearest);
+    }
+    const double gap = query(tree_dim[mid]) - tree_points(mid, tree_dim[mid]);
+    // The side of the split holding the query first, the other only if it
+    // may hold something nearer
+    if (gap < 0)
+    {
+        searchTree(lo, mid, query, nearest);
+        if ((int) nearest.size() < k || gap*gap < nearest.front().first)
+        {
+            searchTree(mid + 1, hi, query, nearest);
+        }
+    }
+    else
+    {
+        searchTree(mid + 1, hi, query, nearest);
+        if ((int) nearest.size() < k || gap*gap < nearest.front().first)
+        {
+            searchTree(lo, mid, query, nearest);
+        }
+    }
+}
+
+bool distanceEmulator::exceeds(const Eigen::VectorXd& params, double bound) const
+{
+    if (!ready())
+    {
+        return(false);
+    }
+    std::vector<std::pair<double, int> > nearest;
+    nearest.reserve(k);
+    const Eigen::VectorXd query = params.cwiseProduct(weights.cwiseSqrt());
+    searchTree(0, tree_points.rows(), query, nearest);
+    double d2, diff;
+    int j;
+    for (unsigned int r = 0; r < recent.size(); r++)
+    {
+        d2 = 0.0;
+        for (j = 0; j < weights.size(); j++)
+        {
+            diff = points(recent[r], j) - params(j);
+            d2 += weights(j)*diff*diff;
+        }
+        offer(d2, -1 - recent[r], nearest);
+    }
+    for (unsigned int i = 0; i < nearest.size(); i++)
+    {
+        const int idx = nearest[i].second;
+        const double distance = (idx >= 0 ? tree_distances(idx) :
+                                 distances(-1 - idx));
+        // A lower bound short of bound leaves the distance unknown, and
+        // an exact distance short of it leaves the proposal a chance.
+        if (distance < bound)
+        {
+            return(false);
+        }
+    }
+    return(true);
+}
+
+int distanceEmulator::size() const
+{
+    return(count);
+}
+
+int distanceEmulator::lowerBounds() const
+{
+    int total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        total += (lower[i] ? 1 : 0);
+    }
+    return(total);
+}
@@ -9,7 +9,7 @@ distanceModel::distanceModel()
     numLocations=-1;
     spatial_prior = Eigen::VectorXd(2);
     dm_list = std::vector<Eigen::MatrixXd>();
-    tdm_list = std::vector<std::vector<Eigen::MatrixXd> >();
+    tdm_list = std::vector<std::vector<int> >();
     tdm_empty = std::vector<int>();
     currentTDistIdx = 0;
 }
@@ -29,7 +29,7 @@ void distanceModel::setupTemporalDistanceMatrices(int nTpt)
 {
     for (int i = 0; i < nTpt; i++)
     {
-        tdm_list.push_back(std::vector<Eigen::MatrixXd>());
+        tdm_list.push_back(std::vector<int>());
         tdm_empty.push_back(1);
     }
 }
@@ -54,8 +54,10 @@ void distanceModel::addTDistanceMatrix(int tpt, NumericMatrix distMat)
             new_mat(i,j) = distMat(i,j);
         }
     }
-    tdm_list[tpt].push_back(new_mat);
-    if (!empty)
+    tdm_list[tpt].push_back(tdm_store.add(new_mat));
+    // A matrix at lag l is applied at time point tpt + l + 1, which may lie
+    // beyond the end of the study period.
+    if (!empty && tpt + tdm_list[tpt].size() < tdm_empty.size())
     {
         tdm_empty[tpt + tdm_list[tpt].size()] = 0;
     }
@@ -99,7 +101,10 @@ void distanceModel::summary()
         if (tdm_list.size() > 0)
         {
             Rcpp::Rcout << "Number of time varying distance lags: " 
-                << tdm_list[0].size();
+                << tdm_list[0].size() << "\n";
+            Rcpp::Rcout << "Distinct time varying distance matrices: " 
+                << tdm_store.size() << " (" << tdm_store.sparseCount() 
+                << " sparse)";
         }
     }
     else
@@ -121,6 +126,11 @@ int distanceModel::getNumDistanceMatrices()
     return(dm_list.size()); 
 }
 
+int distanceModel::getNumTemporalMatrices()
+{
+    return(tdm_store.size());
+}
+
 RCPP_MODULE(mod_distanceModel)
 {
     using namespace Rcpp;
@@ -132,7 +142,8 @@ RCPP_MODULE(mod_distanceModel)
             &distanceModel::setupTemporalDistanceMatrices)
     .method("summary", &distanceModel::summary)
     .method("setPriorParameters", &distanceModel::setPriorParameters)
-    .property("numMatrices", &distanceModel::getNumDistanceMatrices, "Number of distict distance matrices.");
+    .property("numMatrices", &distanceModel::getNumDistanceMatrices, "Number of distict distance matrices.")
+    .property("numTemporalMatrices", &distanceModel::getNumTemporalMatrices, "Number of distinct time varying distance matrices.");
 }
 
 
@@ -3,5 +3,10 @@
 
 static const std::string sim_atom = "sim";
 static const std::string sim_result_atom = "sim_rslt";
+static const std::string sim_stream_atom = "sim_strm";
+static const std::string sim_summary_atom = "sim_smry";
+static const std::string prior_sample_atom = "prior_smp";
+static const std::string prior_eval_atom = "prior_eval";
+static const std::string r0_atom = "r0";
 
 #endif
@@ -2,6 +2,7 @@
 #define ACTOR_SEIRSIM_HEADER
 
 #include <map>
+#include <limits>
 #include <vector>
 #include <random>
 #include <sstream>
@@ -10,11 +11,19 @@
 #include <ABSEIR_constants.hpp>
 #include <samplingControl.hpp>
 #include <dataModel.hpp>
+#include <simulationContext.hpp>
+#include <simulationDiagnostics.hpp>
+#include <logRing.hpp>
+#include <fastRandom.hpp>
+#include <particleCache.hpp>
+#include <reproductiveNumber.hpp>
+#include <processPool.hpp>
 #include <thread>
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
 #include <memory>
+#include <utility>
 
 using namespace std;
 
@@ -27,82 +36,107 @@ using exit_atom = "exit";
 */
 
 struct simulationResultSet;
+class posteriorSummary;
 class transitionDistribution;
 class NodePool;
 class NodeWorker;
+class infectionPressure;
 
 struct instruction{
    int param_idx; 
    std::string action_type;
+   double threshold;
    Eigen::VectorXd params;
+   /** Rows handled by a prior task, starting at param_idx */
+   int block_size;
+   unsigned int seed;
+   /** The model simulated or evaluated, for pools serving several */
+   int model_idx;
+   /** The stream a sim_stream_atom task was issued to */
+   int generation;
 };
 
 class SEIR_sim_node {
     public:
         SEIR_sim_node(NodeWorker* worker,
                       int random_seed,
-                      Eigen::VectorXi S0,
-                      Eigen::VectorXi E0,
-                      Eigen::VectorXi I0,
-                      Eigen::VectorXi R0,
-                      Eigen::VectorXd offset,
-                      Eigen::MatrixXi Y,
-                      MatrixXb na_mask,
-                      int dataModelType,
-                      std::vector<Eigen::MatrixXd> DM_vec,
-                      std::vector<std::vector<Eigen::MatrixXd> > tdm_vec,
-                      std::vector<int> tdm_empty,
-                      Eigen::MatrixXd X, 
-                      Eigen::MatrixXd X_rs,
-                      std::string transitionMode,
-                      Eigen::MatrixXd ei_prior,
-                      Eigen::MatrixXd ir_prior,
-                      double avgI,
-                      Eigen::VectorXd sp_prior,
-                      Eigen::VectorXd se_prec,
-                      Eigen::VectorXd rs_prec,
-                      Eigen::VectorXd se_mean,
-                      Eigen::VectorXd rs_mean,
-                      double phi,
-                      int data_compartment,
-                      bool cumulative,
-                      int m, 
-					  double lpow);
+                      std::shared_ptr<const simulationContext> context);
         ~SEIR_sim_node();
-        std::deque<std::string> messages;
-        simulationResultSet simulate(Eigen::VectorXd param_vals, bool keepCompartments);
+        /** Simulate an epidemic for each of the m replicates. Replicate 0
+         * is abandoned as soon as its partial distance reaches
+         * screenThreshold: the remaining time steps can only add to it, so
+         * the distance reported is a lower bound which is still at least
+         * the threshold. The other replicates of such a simulation are not
+         * run and report infinity; replicates of a simulation which is not
+         * screened out are always complete.*/
+        simulationResultSet simulate(Eigen::VectorXd param_vals, bool keepCompartments,
+                double screenThreshold = std::numeric_limits<double>::infinity());
+        /** Simulate without keeping compartments, as simulate does. When
+         * binomial draws are approximated, a share approximation_verify of
+         * the simulations is run to the end and then again with exact
+         * draws, and the distances of both are kept for
+         * takeApproximationCheck.*/
+        simulationResultSet simulateChecked(Eigen::VectorXd param_vals,
+                                            double screenThreshold);
+        /** Append, and forget, the replicate distances of the checked
+         * simulations with exact and with approximate draws */
+        void takeApproximationCheck(std::vector<double>& exact,
+                                    std::vector<double>& approximate);
+        /** Restart the generator as if the node had been created with
+         * random_seed */
+        void reseed(int random_seed);
+        /** Work done by the simulations of this node since the pool last
+         * collected it */
+        simulationDiagnostics diagnostics;
+        /** Keep the force of infection setup of up to entries particles,
+         * dropping any already kept */
+        void setCacheSize(int entries);
+        /** Return, and reset, the simulations which looked up their setup
+         * and those which found it */
+        void takeCacheCounts(long* hits, long* lookups);
+        /** When enabled, replicate w of every later simulation which keeps
+         * no compartments draws from stream w of seed, so that particles
+         * simulated with the same seed share their random numbers.*/
+        void setCommonStreams(bool enabled, unsigned int seed);
 
     private: 
+        /** A binomial draw for replicate w, counted for the diagnostics */
+        int binomial(int n, double p, int w);
         NodeWorker* parent;
+        std::shared_ptr<const simulationContext> context;
         unsigned int random_seed;
         Eigen::VectorXi S0;
         Eigen::VectorXi E0;
         Eigen::VectorXi I0;
         Eigen::VectorXi R0;
-        Eigen::VectorXd offset;
-        Eigen::MatrixXi Y;
-        MatrixXb na_mask;
+        const Eigen::VectorXd& offset;
+        const Eigen::MatrixXi& Y;
+        const std::vector<int>& obs_start;
+        const std::vector<int>& obs_loc;
+        const Eigen::ArrayXd& obs_value;
         int dataModelType;
-        std::vector<Eigen::MatrixXd> DM_vec;
-        std::vector<std::vector<Eigen::MatrixXd> > TDM_vec;
-        std::vector<int> TDM_empty;
+        const std::vector<contactMatrix>& DM_vec;
+        const std::vector<std::vector<int> >& TDM_index;
+        const contactMatrixStore& TDM_store;
+        const std::vector<int>& TDM_empty;
 
-        Eigen::MatrixXd X;
-        Eigen::MatrixXd X_rs;
+        const Eigen::MatrixXd& X;
+        const Eigen::MatrixXd& X_rs;
         std::string transitionMode;
-        Eigen::MatrixXd E_to_I_prior;
-        Eigen::MatrixXd I_to_R_prior;
+        const Eigen::MatrixXd& E_to_I_prior;
+        const Eigen::MatrixXd& I_to_R_prior;
         double inf_mean;
-        Eigen::VectorXd spatial_prior;
-        Eigen::VectorXd exposure_precision;
-        Eigen::VectorXd reinfection_precision;
-        Eigen::VectorXd exposure_mean;
-        Eigen::VectorXd reinfection_mean;
+        const Eigen::VectorXd& spatial_prior;
+        const Eigen::VectorXd& exposure_precision;
+        const Eigen::VectorXd& reinfection_precision;
+        const Eigen::VectorXd& exposure_mean;
+        const Eigen::VectorXd& reinfection_mean;
         double phi;
         int data_compartment;
         bool cumulative;
         int m;
-		double lpow;
+        double lpow;
+        int distance_norm;
 
         std::vector<Eigen::MatrixXi> E_paths;
         std::vector<Eigen::MatrixXi> I_paths;
@@ -111,61 +145,106 @@ class SEIR_sim_node {
         std::unique_ptr<transitionDistribution> EI_transition_dist;
         /** General I to R transition Distribution*/
         std::unique_ptr<transitionDistribution> IR_transition_dist;
+        /** Log a message through the worker */
         void nodeMessage(std::string);
 
         int seed;
         double value;
         bool has_spatial;
         bool has_ts_spatial;
+        /** Whether the static contact matrices are combined with their rho
+         * weights into a single operator for each particle, and whether
+         * that operator is held in sparse form*/
+        bool fuse_contacts;
+        bool fuse_sparse;
+        /** Whether the force of infection is computed in float */
+        bool single_precision;
+        /** Force of infection setup (exposure components and fused
+         * contacts), keyed by beta and rho. The setup holds no state from
+         * one replicate to the next, so a particle simulated again reuses
+         * it unchanged.*/
+        particleCache<std::shared_ptr<infectionPressure> > pressure_cache;
         bool has_reinfection;
         bool has_report_fraction;
         int total_size;
 
         int sim_width;
         mt19937* generator;
-        std::normal_distribution<double> overdispersion_distribution;
+        bool common_streams;
+        unsigned int common_seed;
+        /** Whether the current simulation draws from streams */
+        bool use_streams;
+        /** SIM_APPROX_NONE while a checked simulation is repeated exactly */
+        int binomial_approximation;
+        double approximation_threshold;
+        double approximation_verify;
+        /** Simulations owed a check, accumulated by approximation_verify */
+        double check_credit;
+        std::vector<double> check_exact;
+        std::vector<double> check_approximate;
+        std::normal_distribution<double> normal;
+        /** The stream of each replicate */
+        std::vector<streamEngine> streams;
+        /** Overdispersion noise for dataModelType 1 */
+        double noise_mean;
+        double noise_sd;
+        Eigen::ArrayXd observation_noise;
+        Eigen::ArrayXd step_difference;
+        /** Add the differences between value and the observed cells at
+         * time_idx to a running distance total */
+        double stepDistance(double total, const Eigen::ArrayXd& value, int time_idx);
+        /** Apply the observation model to the compared compartment of
+         * replicate w for one time step, in place */
+        void observe(Eigen::ArrayXd& value, int time_idx, double report_fraction,
+                     int w);
 };
 
 
 
 class NodeWorker{
     public:
+        /** A worker with a simulation node for each model. The node of
+         * model k is seeded with random_seed + k*model_seed_stride. A
+         * worker with a NUMA node runs on the CPUs of that node only.*/
         NodeWorker(NodePool* pl, 
                    int random_seed,
-                   Eigen::VectorXi S0,
-                   Eigen::VectorXi E0,
-                   Eigen::VectorXi I0,
-                   Eigen::VectorXi R0,
-                   Eigen::VectorXd offset,
-                   Eigen::MatrixXi Y,
-                   MatrixXb na_mask,
-                   int dataModelType,
-                   std::vector<Eigen::MatrixXd> DM_vec,
-                   std::vector<std::vector<Eigen::MatrixXd> > TDM_vec,
-                   std::vector<int> TDM_empty,
-                   Eigen::MatrixXd X, 
-                   Eigen::MatrixXd X_rs,
-                   std::string transitionMode,
-                   Eigen::MatrixXd ei_prior,
-                   Eigen::MatrixXd ir_prior,
-                   double avgI,
-                   Eigen::VectorXd sp_prior,
-                   Eigen::VectorXd se_prec,
-                   Eigen::VectorXd rs_prec,
-                   Eigen::VectorXd se_mean,
-                   Eigen::VectorXd rs_mean,
-                   double phi,
-                   int data_compartment,
-                   bool cumulative,
-                   int m, 
-				   double lpow);
+                   const std::vector<std::shared_ptr<const simulationContext> >& contexts,
+                   int model_seed_stride,
+                   int numa_node = -1);
+        /** Run tasks of the pool until its queue is empty */
         void operator()();
+        /** The NUMA node the worker is placed on, or -1 for any */
+        int numaNode() const;
+        /** Log a message, to be printed when the pool next resolves its
+         * messages */
         void addMessage(std::string);
+        /** Restart the generators of the nodes, seeded as by the
+         * constructor */
+        void reseed(int random_seed, int model_seed_stride);
 
     private:
         friend class SEIR_sim_node;
+        friend class NodePool;
+        /** Draw or evaluate one block of rows of the prior */
+        void runPriorTask(const instruction& task);
+        /** Reproductive numbers of one block of simulations */
+        void runR0Task(const instruction& task);
+        /** Mark a block task as done */
+        void finishBlock();
+        /** Add a finished simulation to the progress counters of the
+         * pool */
+        void countProgress(const simulationResultSet& result);
         NodePool* pool;
-        std::unique_ptr<SEIR_sim_node> node;
+        /** Messages of the worker, drained by resolveMessages */
+        logRing log;
+        /** Whether the worker is queued or running on the host; guarded by
+         * the queue mutex of the pool */
+        bool scheduled;
+        int numa_node;
+        std::vector<std::shared_ptr<const simulationContext> > contexts;
+        std::vector<std::unique_ptr<SEIR_sim_node> > sim_nodes;
+        /** Reproductive numbers of the first model */
+        reproductiveNumber reproductive_number;
 };
 
 class NodePool{
@@ -175,63 +254,159 @@ class NodePool{
                  std::vector<int>* index_pointer,
                  int threads,
                  int random_seed,
-                 Eigen::VectorXi S0,
-                 Eigen::VectorXi E0,
-                 Eigen::VectorXi I0,
-                 Eigen::VectorXi R0,
-                 Eigen::VectorXd offset,
-                 Eigen::MatrixXi Y,
-                 MatrixXb na_mask,
-                 int dataModelType,
-                 std::vector<Eigen::MatrixXd> DM_vec,
-                 std::vector<std::vector<Eigen::MatrixXd> > TDM_vec,
-                 std::vector<int> TDM_empty,
-                 Eigen::MatrixXd X, 
-                 Eigen::MatrixXd X_rs,
-                 std::string transitionMode,
-                 Eigen::MatrixXd ei_prior,
-                 Eigen::MatrixXd ir_prior,
-                 double avgI,
-                 Eigen::VectorXd sp_prior,
-                 Eigen::VectorXd se_prec,
-                 Eigen::VectorXd rs_prec,
-                 Eigen::VectorXd se_mean,
-                 Eigen::VectorXd rs_mean,
-                 double phi,
-                 int data_compartment,
-                 bool cumulative,
-                 int m, 
-				 double lpow
-              );
+                 std::shared_ptr<const simulationContext> context,
+                 int backend,
+                 int placement = SIM_PLACEMENT_FLOATING);
+        /** A pool shared by several models of the same data: tasks carry
+         * the index of their model in contexts. The process backend serves
+         * a single model, so threads are used for more.
+         *
+         * Unless placement is SIM_PLACEMENT_FLOATING, worker threads are
+         * spread round robin over the NUMA nodes of the host and each is
+         * built, and runs, on the CPUs of its node. With
+         * SIM_PLACEMENT_REPLICATED each node also gets its own copy of the
+         * contexts, made there, which its workers read instead of the
+         * shared one.*/
+        NodePool(Eigen::MatrixXd* result_pointer,
+                 std::vector<simulationResultSet>* result_complete_pointer,
+                 std::vector<int>* index_pointer,
+                 int threads,
+                 int random_seed,
+                 const std::vector<std::shared_ptr<const simulationContext> >& contexts,
+                 int backend,
+                 int placement = SIM_PLACEMENT_FLOATING);
         void setResultsDest(Eigen::MatrixXd* result_pointer,
                             std::vector<simulationResultSet>* result_complete_pointer,
                             std::vector<int>* rslt_idx_pointer);
+        /** Set the summary which sim_summary_atom tasks add their
+         * compartments to */
+        void setSummaryDest(posteriorSummary* summary);
+        /** Wait for every queued task to finish. When a progress interval
+         * is set, messages and progress are printed at that interval while
+         * waiting.*/
         void awaitFinished();
+        /** Print the messages of the workers and of the pool; called from
+         * the thread which owns the pool only */
         void resolveMessages();
-        void enqueue(std::string action_type, int param_idx, Eigen::VectorXd params);
+        void enqueue(std::string action_type, int param_idx, Eigen::VectorXd params,
+                     int model = 0);
+        /** Wait for at least one sim_stream_atom task to finish, and move
+         * all finished ones into completed.*/
+        void awaitStreamResults(std::vector<std::pair<int, Eigen::VectorXd> >& completed);
+        /** Drop queued sim_stream_atom tasks and wait out running ones.
+         * Returns the number of simulations which finished unused.*/
+        int cancelStream();
+        /** Set the distance at which subsequently queued simulations are
+         * screened out; infinity disables screening.*/
+        void setScreeningThreshold(double threshold);
+        /** Return, and reset, the number of simulations cut short by
+         * screening and the number of time steps they skipped.*/
+        void takeScreeningStats(int* screened, long* skipped_steps);
+        /** Restart the progress counters, counting simulations with a
+         * first distance below threshold as accepted.*/
+        void setAcceptanceThreshold(double threshold);
+        /** Print progress every milliseconds while awaiting tasks; zero
+         * disables reporting.*/
+        void setProgressInterval(int milliseconds);
+        /** Return, and reset, the diagnostics of the simulations finished
+         * on the worker threads when the pool was last idle. Simulations
+         * in forked worker processes are not included.*/
+        simulationDiagnostics takeDiagnostics();
+        /** Set the number of particles whose simulation setup each worker
+         * thread keeps; call while the pool is idle */
+        void setCacheSize(int entries);
+        /** Return, and reset, the setup cache lookups of the worker threads
+         * and those which hit */
+        void takeCacheCounts(long* hits, long* lookups);
+        /** Simulate the replicates of every later sim_atom and
+         * sim_stream_atom task from the common streams of seed, or stop
+         * doing so; call while the pool is idle */
+        void setCommonStreams(bool enabled, unsigned int seed);
+        /** Append, and forget, the replicate distances of the simulations
+         * checked by the worker threads, exact and approximate; the pool
+         * must be idle. Simulations in forked worker processes are not
+         * checked.*/
+        void takeApproximationCheck(std::vector<double>& exact,
+                                    std::vector<double>& approximate);
+        /** Fill every row of dest with a draw from the prior, in blocks on
+         * the worker threads. Each block has its own generator seeded from
+         * seed, so the draws do not depend on the number of threads.
+         * Returns the number of rows without valid rho values.*/
+        int samplePrior(Eigen::MatrixXd& dest, unsigned int seed, int model = 0);
+        /** Evaluate the log prior density of each row of params, in blocks
+         * on the worker threads */
+        void evaluatePrior(const Eigen::MatrixXd& params, Eigen::VectorXd& logDensity,
+                           int model = 0);
+        /** Compute the reproductive numbers of each simulation of batch
+         * on the worker threads */
+        void computeReproductiveNumbers(const reproductiveNumberBatch& batch, 
+                                        int nSimulations);
+        /** Restart every worker's generators as if the pool had been created
+         * with random_seed, so that a reused pool reproduces a new one. The
+         * pool must be idle. Returns false for the process backend, whose
+         * workers are seeded when forked.*/
+        bool reseed(int random_seed);
         Eigen::MatrixXd* result_pointer;
+        /** Messages of the pool itself and of forked worker processes,
+         * only touched by the thread which owns the pool */
         std::deque<std::string> messages;
         std::vector<simulationResultSet>* result_complete_pointer;
         std::vector<int>* index_pointer;
+        posteriorSummary* summary_pointer;
         ~NodePool();
 
     private:
         friend class NodeWorker;
         
 
-#ifdef SPATIALSEIR_SINGLETHREAD
-        std::vector<NodeWorker> nodes;
-#else
-        std::vector<std::thread> nodes;
-#endif
+        /** Owned here, so that they can be reseeded between calls, and
+         * run on the threads of the workerHost */
+        std::vector<std::unique_ptr<NodeWorker> > workers;
+        /** Hand idle workers to the host while there are queued tasks */
+        void dispatch();
+        /** Move the diagnostics of every worker into diagnostics; the
+         * workers must be idle */
+        void collectDiagnostics();
+        simulationDiagnostics diagnostics;
         std::deque<instruction>  tasks;
         std::atomic_int nBusy;
+        double screen_threshold;
+        bool common_streams;
+        unsigned int common_seed;
+        std::atomic<int> screened;
+        std::atomic<long> skipped_steps;
+        /** Progress counters, updated by the workers without locking and
+         * read while awaiting tasks */
+        std::atomic<long> progress_simulations;
+        std::atomic<long> progress_accepted;
+        double acceptance_threshold;
+        int progress_interval;
+        void reportProgress();
+        std::deque<std::pair<int, Eigen::VectorXd> > stream_results;
+        /** Bumped by cancelStream: results of tasks issued to an earlier
+         * stream are dropped rather than delivered to the next one */
+        int stream_generation;
+        Eigen::MatrixXd* prior_dest;
+        const Eigen::MatrixXd* prior_source;
+        Eigen::VectorXd* prior_density;
+        int prior_failures;
+        const reproductiveNumberBatch* r0_batch;
+        int block_pending;
+        /** Queue tasks covering nRows rows in blocks of blockRows, ahead of
+         * any simulations, and wait for them; simulations in flight are
+         * left running.*/
+        void runBlocks(std::string action_type, int nRows, int blockRows,
+                       unsigned int seed, int model = 0);
+
+        /** Forked worker processes, used for sim_atom tasks when the
+         * process backend is selected */
+        std::unique_ptr<ProcessPool> processes;
+        void awaitProcesses();
 
         std::mutex queue_mutex;
         std::mutex result_mutex;
-        std::condition_variable condition;
         std::condition_variable finished;
-        bool exit; 
+        std::condition_variable result_ready;
 };
 
 
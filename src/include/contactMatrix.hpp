@@ -0,0 +1,93 @@
+#ifndef SPATIALSEIR_CONTACT_MATRIX
+#define SPATIALSEIR_CONTACT_MATRIX
+
+#include <vector>
+#include <unordered_map>
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
+
+/** A square contact (distance) matrix, held in compressed sparse form
+ * when few of its entries are non-zero and densely otherwise, in double
+ * or (for the single precision simulation mode) float. Products in the
+ * other precision are supported, but convert their operands.*/
+class contactMatrix
+{
+    public:
+        explicit contactMatrix(const Eigen::MatrixXd& mat, 
+                               bool singlePrecision = false);
+        explicit contactMatrix(const Eigen::MatrixXf& mat);
+        /** y += scale * M * x */
+        void multiplyAdd(double scale, const Eigen::Ref<const Eigen::VectorXd>& x,
+                         Eigen::Ref<Eigen::VectorXd> y) const;
+        void multiplyAdd(float scale, const Eigen::Ref<const Eigen::VectorXf>& x,
+                         Eigen::Ref<Eigen::VectorXf> y) const;
+        /** out(a) += sum_b w(b)*(1 - exp(-scale*x(a)*M(b, a))): the
+         * expected number of the w(b) susceptibles at each location b
+         * exposed by a pressure x(a) exerted from location a alone */
+        void expectedExposures(double scale, 
+                               const Eigen::Ref<const Eigen::VectorXd>& x,
+                               const Eigen::Ref<const Eigen::VectorXd>& w,
+                               Eigen::Ref<Eigen::VectorXd> out) const;
+        /** Whether mat has exactly the entries of this matrix */
+        bool equals(const Eigen::MatrixXd& mat) const;
+        bool isSparse() const;
+        bool isSingle() const;
+        int rows() const;
+        /** Multiply-adds needed for one product with a vector */
+        long cost() const;
+        /** target += scale * M */
+        void addTo(double scale, Eigen::MatrixXd& target) const;
+        void addTo(float scale, Eigen::MatrixXf& target) const;
+        void addTo(double scale, Eigen::SparseMatrix<double>& target) const;
+        void addTo(float scale, Eigen::SparseMatrix<float>& target) const;
+        /** This matrix held in single precision */
+        contactMatrix toSingle() const;
+        /** I + sum_k weights(k)*mats[k], in single precision if requested.
+         * In sparse form, as chosen by identityPlusCost, the sum is
+         * accumulated sparsely and no dense copy is made.*/
+        static contactMatrix identityPlus(const std::vector<contactMatrix>& mats,
+                                          const Eigen::VectorXd& weights,
+                                          bool singlePrecision,
+                                          bool sparseForm);
+        /** Multiply-adds needed for one product with identityPlus(mats),
+         * and whether it is stored in sparse form: when the inputs are all
+         * sparse and so is the union of their entries.*/
+        static long identityPlusCost(const std::vector<contactMatrix>& mats,
+                                     bool* isSparse);
+
+    private:
+        contactMatrix();
+
+        bool sparse;
+        bool single;
+        Eigen::MatrixXd dense_mat;
+        Eigen::SparseMatrix<double> sparse_mat;
+        Eigen::MatrixXf dense_mat_f;
+        Eigen::SparseMatrix<float> sparse_mat_f;
+};
+
+/** Hash-consed collection of contact matrices: a matrix identical to one
+ * already stored is not stored again, and both share an index. Time
+ * varying contact structures repeat the same few matrices at many time
+ * points and lags.*/
+class contactMatrixStore
+{
+    public:
+        contactMatrixStore();
+        /** Return the index of mat, storing it if it is new */
+        int add(const Eigen::MatrixXd& mat);
+        const contactMatrix& get(int idx) const;
+        /** Number of distinct matrices stored */
+        int size() const;
+        /** Number of distinct matrices stored in sparse form */
+        int sparseCount() const;
+        /** This store with every matrix held in single precision */
+        contactMatrixStore toSingle() const;
+
+    private:
+        static size_t hashMatrix(const Eigen::MatrixXd& mat);
+        std::vector<contactMatrix> matrices;
+        std::unordered_multimap<size_t, int> lookup;
+};
+
+#endif
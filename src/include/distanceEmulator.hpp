@@ -0,0 +1,69 @@
+#ifndef SPATIALSEIR_DISTANCE_EMULATOR
+#define SPATIALSEIR_DISTANCE_EMULATOR
+
+#include <vector>
+#include <Eigen/Core>
+
+/** Nearest neighbour emulator of the simulated distance, trained on the
+ * (parameter, distance) pairs which the samplers have already simulated.
+ * Parameters are compared on the scale of the proposal kernel. The most
+ * recent capacity pairs are kept.
+ *
+ * Simulations cut short by screening only bound their distance from below;
+ * they are stored as such, and only ever show that a distance is at least
+ * as large as a bound. Stored pairs are searched through a kd-tree, built
+ * when the scale is set and again once enough pairs have been added since;
+ * the pairs added in between are scanned directly.*/
+class distanceEmulator
+{
+    public:
+        distanceEmulator(int nParams, int capacity, int k);
+        /** Set the per-parameter scale used to compare parameter vectors;
+         * parameters with a zero scale are ignored.*/
+        void setScale(const Eigen::VectorXd& scale);
+        /** Add one simulated pair, whose distance may be a lower bound */
+        void add(const Eigen::VectorXd& params, double distance,
+                 bool lowerBound);
+        /** Add each row of params with the first column of results. Results
+         * of at least screenThreshold are stored as lower bounds.*/
+        void add(const Eigen::MatrixXd& params, const Eigen::MatrixXd& results,
+                 double screenThreshold);
+        /** Whether the emulator has seen enough simulations to be used */
+        bool ready() const;
+        /** Whether all k nearest stored simulations have a distance of at
+         * least bound. Only then is a proposal considered hopeless.*/
+        bool exceeds(const Eigen::VectorXd& params, double bound) const;
+        int size() const;
+        /** Number of stored distances which are lower bounds */
+        int lowerBounds() const;
+
+    private:
+        void buildTree();
+        void searchTree(int lo, int hi, const Eigen::VectorXd& query,
+                        std::vector<std::pair<double, int> >& nearest) const;
+        void offer(double d2, int idx,
+                   std::vector<std::pair<double, int> >& nearest) const;
+
+        Eigen::MatrixXd points;
+        Eigen::VectorXd distances;
+        std::vector<bool> lower;
+        Eigen::VectorXd weights;
+        int capacity;
+        int k;
+        int count;
+        int next;
+
+        /** Scaled copies of the pairs in the tree, in tree order. Entry
+         * (lo + hi)/2 of each range splits it along tree_dim.*/
+        Eigen::MatrixXd tree_points;
+        Eigen::VectorXd tree_distances;
+        std::vector<int> tree_dim;
+        /** Slot of each pair in the tree, and whether a slot has been
+         * overwritten since the tree was built */
+        std::vector<int> tree_slot;
+        std::vector<bool> replaced;
+        /** Slots of the pairs added since the tree was built */
+        std::vector<int> recent;
+};
+
+#endif
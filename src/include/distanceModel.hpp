@@ -2,6 +2,7 @@
 #define SPATIALSEIR_DISTANCE_MODEL
 #include <Rcpp.h>
 #include<modelComponent.hpp>
+#include<contactMatrix.hpp>
 
 using namespace Rcpp;
 RCPP_EXPOSED_CLASS(distanceModel)
@@ -16,13 +17,16 @@ class distanceModel : public modelComponent
         virtual void summary();
         virtual void setPriorParameters(double alpha, double beta);
         virtual int getNumDistanceMatrices();
+        virtual int getNumTemporalMatrices();
 
         int numLocations;
         int currentTDistIdx;
         Eigen::VectorXd spatial_prior;
         std::vector<Eigen::MatrixXd> dm_list;
         std::vector<int> tdm_empty; 
-        std::vector<std::vector<Eigen::MatrixXd> > tdm_list;
+        /** Index into tdm_store of the matrix for each time point and lag */
+        std::vector<std::vector<int> > tdm_list;
+        contactMatrixStore tdm_store;
 
 
         ~distanceModel();
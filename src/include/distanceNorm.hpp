@@ -0,0 +1,119 @@
+#ifndef SPATIALSEIR_DISTANCE_NORM
+#define SPATIALSEIR_DISTANCE_NORM
+
+#include <cmath>
+#include <algorithm>
+#include <Eigen/Core>
+
+/** Distances between simulated and observed epidemics are Lp norms over
+ * all observed cells. Each time step adds the contribution of a vector of
+ * absolute differences across locations to a running total, which only
+ * ever increases; finishDistance turns the total into the distance.
+ * L1, L2 and L-infinity (lpow = Inf) are specialised, other values of
+ * lpow use std::pow.*/
+#define DISTANCE_LP 0
+#define DISTANCE_L1 1
+#define DISTANCE_L2 2
+#define DISTANCE_LINF 3
+
+inline int distanceNormType(double lpow)
+{
+    return(lpow == 1.0 ? DISTANCE_L1 : 
+          (lpow == 2.0 ? DISTANCE_L2 : 
+          (std::isinf(lpow) ? DISTANCE_LINF : DISTANCE_LP)));
+}
+
+template<int Norm> 
+struct distanceAccumulator
+{
+    template<class Derived>
+    static double add(double total, const Eigen::ArrayBase<Derived>& absDiff, 
+                      double lpow)
+    {
+        return(total + absDiff.pow(lpow).sum());
+    }
+};
+
+template<> 
+struct distanceAccumulator<DISTANCE_L1>
+{
+    template<class Derived>
+    static double add(double total, const Eigen::ArrayBase<Derived>& absDiff, 
+                      double lpow)
+    {
+        return(total + absDiff.sum());
+    }
+};
+
+template<> 
+struct distanceAccumulator<DISTANCE_L2>
+{
+    template<class Derived>
+    static double add(double total, const Eigen::ArrayBase<Derived>& absDiff, 
+                      double lpow)
+    {
+        return(total + absDiff.square().sum());
+    }
+};
+
+template<> 
+struct distanceAccumulator<DISTANCE_LINF>
+{
+    template<class Derived>
+    static double add(double total, const Eigen::ArrayBase<Derived>& absDiff, 
+                      double lpow)
+    {
+        return(absDiff.size() > 0 ? std::max(total, absDiff.maxCoeff()) : total);
+    }
+};
+
+/** Add one time step to the running total */
+template<class Derived>
+inline double accumulateDistance(int norm, double total, 
+                                 const Eigen::ArrayBase<Derived>& absDiff, 
+                                 double lpow)
+{
+    switch (norm)
+    {
+        case DISTANCE_L1: 
+            return(distanceAccumulator<DISTANCE_L1>::add(total, absDiff, lpow));
+        case DISTANCE_L2: 
+            return(distanceAccumulator<DISTANCE_L2>::add(total, absDiff, lpow));
+        case DISTANCE_LINF: 
+            return(distanceAccumulator<DISTANCE_LINF>::add(total, absDiff, lpow));
+        default: 
+            return(distanceAccumulator<DISTANCE_LP>::add(total, absDiff, lpow));
+    }
+}
+
+/** Convert a running total into a distance */
+inline double finishDistance(int norm, double total, double lpow)
+{
+    switch (norm)
+    {
+        case DISTANCE_L1: 
+        case DISTANCE_LINF: 
+            return(total);
+        case DISTANCE_L2: 
+            return(std::sqrt(total));
+        default: 
+            return(std::pow(total, 1.0/lpow));
+    }
+}
+
+/** Convert a distance into the scale of the running total */
+inline double distanceBound(int norm, double distance, double lpow)
+{
+    switch (norm)
+    {
+        case DISTANCE_L1: 
+        case DISTANCE_LINF: 
+            return(distance);
+        case DISTANCE_L2: 
+            return(distance*distance);
+        default: 
+            return(std::pow(distance, lpow));
+    }
+}
+
+#endif
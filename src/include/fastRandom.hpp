@@ -0,0 +1,231 @@
+#ifndef SPATIALSEIR_FAST_RANDOM
+#define SPATIALSEIR_FAST_RANDOM
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <Eigen/Core>
+
+/** A uniform draw on (0, 1] from a single engine output */
+template<class RNG>
+inline double uniformOpenClosed(RNG& generator)
+{
+    return((static_cast<double>(generator() - RNG::min()) + 1.0)/
+           (static_cast<double>(RNG::max() - RNG::min()) + 1.0));
+}
+
+/** Fill out with independent normal draws. Uniforms are drawn for the
+ * whole batch first, and the Box-Muller transform is then applied to the
+ * arrays as a whole so that Eigen can vectorize log, sqrt, sin and cos.*/
+template<class RNG>
+void normalBatch(Eigen::ArrayXd& out, double mean, double sd, RNG& generator)
+{
+    const int n = out.size();
+    const int half = (n + 1)/2;
+    Eigen::ArrayXd u1(half);
+    Eigen::ArrayXd u2(half);
+    for (int i = 0; i < half; i++)
+    {
+        u1(i) = uniformOpenClosed(generator);
+        u2(i) = uniformOpenClosed(generator);
+    }
+    Eigen::ArrayXd radius = (-2.0*u1.log()).sqrt()*sd;
+    Eigen::ArrayXd angle = 6.283185307179586*u2;
+    out.head(half) = mean + radius*angle.cos();
+    out.tail(n - half) = mean + (radius*angle.sin()).head(n - half);
+}
+
+/** A binomial draw which avoids constructing a std::binomial_distribution
+ * in the common cheap cases: empty or certain trials, and small expected
+ * counts, which are drawn by inverting the CDF with a single uniform.*/
+template<class RNG>
+inline int binomialDraw(int n, double p, RNG& generator)
+{
+    if (n <= 0 || !(p > 0))
+    {
+        return(0);
+    }
+    if (p >= 1)
+    {
+        return(n);
+    }
+    const bool flip = (p > 0.5);
+    const double pp = (flip ? 1.0 - p : p);
+    if (n*pp >= 10.0)
+    {
+        return(std::binomial_distribution<int>(n, p)(generator));
+    }
+    const double q = 1.0 - pp;
+    const double s = pp/q;
+    const double a = (n + 1)*s;
+    double r = std::exp(n*std::log(q));
+    double u = uniformOpenClosed(generator);
+    int x = 0;
+    while (u > r && x < n)
+    {
+        u -= r;
+        x++;
+        r *= (a/x - s);
+    }
+    return(flip ? n - x : x);
+}
+
+/** A binomial draw from the normal distribution with the same mean and
+ * variance, rounded to the nearest count and kept within [0, n]. Once the
+ * expected successes and failures are both in the hundreds the two can
+ * hardly be told apart, and the normal costs a fraction of an exact
+ * draw.*/
+template<class RNG>
+inline int binomialNormal(int n, double p, std::normal_distribution<double>& normal,
+                          RNG& generator)
+{
+    const double mean = n*p;
+    const double x = std::floor(mean + std::sqrt(mean*(1.0 - p))*normal(generator) + 0.5);
+    return(x < 0 ? 0 : (x > n ? n : (int) x));
+}
+
+/** A binomial draw from the Poisson distribution of the rarer outcome,
+ * kept within [0, n]. Its variance is that of the binomial divided by the
+ * probability of the commoner outcome, so it suits probabilities near
+ * zero or one.*/
+template<class RNG>
+inline int binomialPoisson(int n, double p, RNG& generator)
+{
+    const bool flip = (p > 0.5);
+    int x = std::poisson_distribution<int>(n*(flip ? 1.0 - p : p))(generator);
+    x = (x > n ? n : x);
+    return(flip ? n - x : x);
+}
+
+/** A small engine for numbered streams: xoshiro256** with its state
+ * filled by splitmix64 from the seed and the stream number, so that stream
+ * k of a seed is the same sequence on whichever worker starts it.*/
+class streamEngine
+{
+    public:
+        typedef std::uint64_t result_type;
+        static constexpr result_type min() { return(0); }
+        static constexpr result_type max() { return(~((result_type) 0)); }
+
+        streamEngine()
+        {
+            seed(0, 0);
+        }
+
+        /** Restart at the beginning of stream of seed */
+        void seed(unsigned int sd, unsigned int stream)
+        {
+            std::uint64_t x = (((std::uint64_t) sd) << 32) | stream;
+            for (int i = 0; i < 4; i++)
+            {
+                x += 0x9E3779B97F4A7C15ULL;
+                std::uint64_t z = x;
+                z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+                state[i] = z ^ (z >> 31);
+            }
+        }
+
+        result_type operator()()
+        {
+            const std::uint64_t out = rotate(state[1]*5, 7)*9;
+            const std::uint64_t t = state[1] << 17;
+            state[2] ^= state[0];
+            state[3] ^= state[1];
+            state[1] ^= state[2];
+            state[0] ^= state[3];
+            state[2] ^= t;
+            state[3] = rotate(state[3], 45);
+            return(out);
+        }
+
+    private:
+        static std::uint64_t rotate(std::uint64_t x, int k)
+        {
+            return((x << k) | (x >> (64 - k)));
+        }
+        std::uint64_t state[4];
+};
+
+/** The binomial quantile of u in (0, 1], found to within rounding. Unlike
+ * binomialDraw, every draw takes exactly one uniform and the count never
+ * decreases as u or p grows, so that draws made from the same uniforms
+ * with nearby probabilities stay close. Small expected counts are found
+ * by summing the CDF up from zero; otherwise the CDF at the mode is summed
+ * from the probabilities below it, and the search runs from the mode,
+ * which takes a number of steps of the order of the standard deviation.*/
+inline int binomialInversion(int n, double p, double u)
+{
+    if (n <= 0 || !(p > 0))
+    {
+        return(0);
+    }
+    if (p >= 1)
+    {
+        return(n);
+    }
+    // With p flipped the failures are counted, at the opposite quantile
+    const bool flip = (p > 0.5);
+    const double pp = (flip ? 1.0 - p : p);
+    const double q = 1.0 - pp;
+    const double v = (flip ? 1.0 - u : u);
+    int x;
+    if (n*pp < 30.0)
+    {
+        const double s = pp/q;
+        const double a = (n + 1)*s;
+        double r = std::exp(n*std::log(q));
+        double F = r;
+        x = 0;
+        while (F < v && x < n && r > 0)
+        {
+            x++;
+            r *= (a/x - s);
+            F += r;
+        }
+    }
+    else
+    {
+        x = (int) std::floor((n + 1)*pp);
+        x = (x > n ? n : x);
+        double f = std::exp(std::lgamma(n + 1.0) - std::lgamma(x + 1.0) -
+                            std::lgamma(n - x + 1.0) + x*std::log(pp) +
+                            (n - x)*std::log(q));
+        // The probabilities fall away from the mode faster than
+        // geometrically, so the sum stops once they no longer count
+        double below = 0.0;
+        double term = f;
+        for (int k = x; k > 0; k--)
+        {
+            term *= k*q/((n - k + 1)*pp);
+            below += term;
+            if (term < below*std::numeric_limits<double>::epsilon())
+            {
+                break;
+            }
+        }
+        double F = below + f;
+        if (v <= F)
+        {
+            while (x > 0 && F - f >= v)
+            {
+                F -= f;
+                f *= x*q/((n - x + 1)*pp);
+                x--;
+            }
+        }
+        else
+        {
+            while (x < n && F < v && f > std::numeric_limits<double>::min())
+            {
+                f *= (n - x)*pp/((x + 1)*q);
+                x++;
+                F += f;
+            }
+        }
+    }
+    return(flip ? n - x : x);
+}
+
+#endif
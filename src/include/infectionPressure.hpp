@@ -0,0 +1,190 @@
+#ifndef SPATIALSEIR_INFECTION_PRESSURE
+#define SPATIALSEIR_INFECTION_PRESSURE
+
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <Eigen/Core>
+#include <contactMatrix.hpp>
+#include <simulationContext.hpp>
+#include <util.hpp>
+
+/** Probability that a susceptible at each location is exposed during a
+ * time step: 1 - exp(-offset_t * p), where p passes the infectious
+ * fraction I/N, scaled by the exposure components exp(X beta), through
+ * the rho weighted contact matrices.*/
+class infectionPressure
+{
+    public:
+        virtual ~infectionPressure() {}
+        /** Probabilities for the first time step, from the initial
+         * infectious counts I out of N. The lagged contact terms of each
+         * replicate start from these counts.*/
+        virtual void initial(const Eigen::VectorXi& I, const Eigen::VectorXi& N,
+                             Eigen::VectorXd& p_se) = 0;
+        /** Begin a replicate */
+        virtual void startReplicate() = 0;
+        /** Probabilities for time step t > 0 */
+        virtual void step(int t, const Eigen::Ref<const Eigen::VectorXi>& I,
+                          Eigen::VectorXd& p_se) = 0;
+};
+
+/** The arithmetic is carried out in Scalar: double, or float in the
+ * single precision mode, where the contact matrices and covariates of the
+ * context are held as float. The probabilities only feed binomial draws,
+ * so they are returned in double precision.*/
+template <typename Scalar>
+class infectionPressureImpl : public infectionPressure
+{
+    public:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
+
+        infectionPressureImpl(const simulationContext& ctx,
+                              const Eigen::VectorXd& beta,
+                              const Eigen::VectorXd& rho_,
+                              bool hasSpatial,
+                              bool hasTSSpatial,
+                              bool fuseContacts,
+                              bool fuseSparse)
+            : context(ctx),
+              has_spatial(hasSpatial),
+              has_ts_spatial(hasTSSpatial),
+              rho(rho_.cast<Scalar>()),
+              infection_lag(ctx.TDM_index[0].size(), ctx.S0.size())
+        {
+            // Equivalent R expression:
+            // exp(matrix(X %*% beta, nrow = nrow(Y), ncol = ncol(Y)))
+            Vector eta = (design(ctx, Scalar())*beta.cast<Scalar>()).unaryExpr(
+                    [](Scalar elem){return(std::exp(elem));});
+            components = Eigen::Map<Matrix>(eta.data(), ctx.observed -> Y.rows(),
+                    ctx.observed -> Y.cols());
+            if (fuseContacts)
+            {
+                contact_operator = std::unique_ptr<contactMatrix>(
+                        new contactMatrix(contactMatrix::identityPlus(
+                                ctx.DM_vec, rho_.head(ctx.DM_vec.size()),
+                                isSingle(Scalar()), fuseSparse)));
+            }
+        }
+
+        void initial(const Eigen::VectorXi& I, const Eigen::VectorXi& N,
+                     Eigen::VectorXd& p_se)
+        {
+            population = N.cast<Scalar>().array();
+            infectious(0, I);
+            initial_infection = p_se_cache;
+            // No lagged terms enter the first time step
+            contacts();
+            probability(0, p_se);
+        }
+
+        void startReplicate()
+        {
+            if (has_ts_spatial)
+            {
+                infection_lag.push(initial_infection);
+            }
+        }
+
+        void step(int t, const Eigen::Ref<const Eigen::VectorXi>& I,
+                  Eigen::VectorXd& p_se)
+        {
+            infectious(t, I);
+            contacts();
+            if (has_ts_spatial)
+            {
+                // The term for lag l was this step's p_se_cache l + 1 steps
+                // ago, so all lags are applied from the ring in one pass.
+                if (!context.TDM_empty[t])
+                {
+                    const int nDM = context.DM_vec.size();
+                    for (int lag = 0; t - lag - 1 >= 0 &&
+                            lag < (int) context.TDM_index[0].size(); lag++)
+                    {
+                        context.TDM_store.get(context.TDM_index[t - lag - 1][lag]
+                                ).multiplyAdd(rho(nDM + lag),
+                                    infection_lag.get(lag), pressure);
+                    }
+                }
+                infection_lag.push(p_se_cache);
+            }
+            probability(t, p_se);
+        }
+
+    private:
+        static const Eigen::MatrixXd& design(const simulationContext& ctx, double)
+        {
+            return(ctx.X);
+        }
+        static const Eigen::MatrixXf& design(const simulationContext& ctx, float)
+        {
+            return(ctx.X_single);
+        }
+        static bool isSingle(double)
+        {
+            return(false);
+        }
+        static bool isSingle(float)
+        {
+            return(true);
+        }
+
+        /** p_se_cache = I/N scaled by the exposure components of time t */
+        void infectious(int t, const Eigen::Ref<const Eigen::VectorXi>& I)
+        {
+            p_se_cache = (I.cast<Scalar>().array()/population*
+                components.row(t).transpose().array()
+                ).unaryExpr([](Scalar e){
+                    // Protect against overflow in components
+                    return(e == e ? e : 0);
+                }).matrix();
+        }
+
+        /** pressure = p_se_cache passed through the static contacts */
+        void contacts()
+        {
+            if (contact_operator)
+            {
+                pressure = Vector::Zero(p_se_cache.size());
+                contact_operator -> multiplyAdd(Scalar(1), p_se_cache, pressure);
+            }
+            else
+            {
+                pressure = p_se_cache;
+                if (has_spatial)
+                {
+                    for (unsigned int idx = 0; idx < context.DM_vec.size(); idx++)
+                    {
+                        context.DM_vec[idx].multiplyAdd(rho(idx), p_se_cache,
+                                pressure);
+                    }
+                }
+            }
+        }
+
+        void probability(int t, Eigen::VectorXd& p_se) const
+        {
+            const Scalar scale = context.offset(t);
+            p_se = ((Scalar(-1)*pressure.array()*scale).matrix()
+                   ).unaryExpr([](Scalar e){return(1-std::exp(e));}
+                   ).template cast<double>();
+        }
+
+        const simulationContext& context;
+        const bool has_spatial;
+        const bool has_ts_spatial;
+        const Vector rho;
+        Matrix components;
+        Array population;
+        Vector p_se_cache;
+        Vector pressure;
+        Vector initial_infection;
+        /** Force of infection terms (I/N scaled by the exposure components)
+         * of the previous time steps, reused by each lagged contact matrix */
+        vector_tap<Scalar> infection_lag;
+        std::unique_ptr<contactMatrix> contact_operator;
+};
+
+#endif
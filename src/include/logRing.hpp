@@ -0,0 +1,71 @@
+#ifndef SPATIALSEIR_LOG_RING
+#define SPATIALSEIR_LOG_RING
+
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+/** Bytes kept per log record, terminator included; longer messages are
+ * truncated */
+#define LOG_RECORD_LENGTH 160
+/** Records held by each ring */
+#define LOG_RING_RECORDS 64
+
+/** A single producer, single consumer ring of fixed size log records.
+ * Each worker writes its messages to its own ring without locking or
+ * allocating, and the thread which owns the pool drains the rings when it
+ * prints. When a ring is full further records are counted and dropped
+ * rather than making the worker wait.*/
+class logRing
+{
+    public:
+        logRing() : head(0), tail(0), dropped(0) {}
+
+        /** Append a record; called by the producing worker only */
+        void push(const std::string& text)
+        {
+            const unsigned int h = head.load(std::memory_order_relaxed);
+            if (h - tail.load(std::memory_order_acquire) == LOG_RING_RECORDS)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            char* record = records[h % LOG_RING_RECORDS];
+            const size_t n = std::min(text.size(),
+                                      (size_t) (LOG_RECORD_LENGTH - 1));
+            std::memcpy(record, text.data(), n);
+            record[n] = '\0';
+            head.store(h + 1, std::memory_order_release);
+        }
+
+        /** Move the oldest record into text; called by the consumer only.
+         * Returns false when the ring is empty.*/
+        bool pop(std::string& text)
+        {
+            const unsigned int t = tail.load(std::memory_order_relaxed);
+            if (t == head.load(std::memory_order_acquire))
+            {
+                return(false);
+            }
+            text.assign(records[t % LOG_RING_RECORDS]);
+            tail.store(t + 1, std::memory_order_release);
+            return(true);
+        }
+
+        /** Return, and reset, the number of records dropped */
+        int takeDropped()
+        {
+            return(dropped.exchange(0));
+        }
+
+    private:
+        // The records lie between the producer and consumer positions, so
+        // that the two do not share a cache line.
+        std::atomic<unsigned int> head;
+        char records[LOG_RING_RECORDS][LOG_RECORD_LENGTH];
+        std::atomic<unsigned int> tail;
+        std::atomic<int> dropped;
+};
+
+#endif
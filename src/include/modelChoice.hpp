@@ -0,0 +1,83 @@
+#ifndef SPATIALSEIR_MODEL_CHOICE
+#define SPATIALSEIR_MODEL_CHOICE
+
+#include <Rcpp.h>
+#include <memory>
+#include <random>
+#include <vector>
+#include <Eigen/Core>
+#include "./spatialSEIRModel.hpp"
+#include "./simulationContext.hpp"
+
+/** ABC-SMC model choice between candidate models of the same data, with
+ * the model index as one more parameter (Toni et al. 2009). Every
+ * candidate is simulated on one worker pool, and all of them share one
+ * copy of the observations.
+ *
+ * Each proposal first picks a model, from the current estimate of the
+ * model posterior mixed with the model proposal the generation started
+ * from, and then perturbs a particle of that model. Simulation effort
+ * therefore follows the model posterior, and clearly losing models stop
+ * consuming simulations early. Importance weights correct for both the
+ * model and the parameter proposal, so the sums of the weights of each
+ * model estimate its posterior probability. A proposal outside the prior
+ * support is rejected with zero weight rather than drawn again, so the
+ * parameter proposal density is never truncated.*/
+class modelChoiceSampler
+{
+    public:
+        modelChoiceSampler(samplingControl& samplingControl_);
+        /** Add a candidate model with prior probability prior. Proposals
+         * for it start from the particles params (full layout, as returned
+         * to R) with the given weights, typically a fitted posterior. The
+         * sampling control of the sampler sets the replicates and distance
+         * used for every model.*/
+        void addModel(dataModel& dataModel_,
+                      exposureModel& exposureModel_,
+                      reinfectionModel& reinfectionModel_,
+                      distanceModel& distanceModel_,
+                      transitionPriors& transitionPriors_,
+                      initialValueContainer& initialValueContainer_,
+                      Eigen::MatrixXd params,
+                      Eigen::VectorXd weights,
+                      double prior);
+        /** Run the given number of generations, the first at tolerance
+         * epsilon and each later one at shrinkage times the previous. A
+         * generation ends after nSample acceptances or max_batches
+         * batches; one which ends short is the last.*/
+        Rcpp::List sample(int nSample, double epsilon, int generations,
+                          double shrinkage, int verbose);
+        ~modelChoiceSampler();
+
+    private:
+        /** Draw n proposals for model k into out, perturbing particles of
+         * its population or, for a defensive share, drawing from its prior,
+         * with their log prior densities. Perturbed particles outside the
+         * prior support are returned as they are, with a log prior density
+         * of -Inf.*/
+        void propose(int k, int n, Eigen::MatrixXd& out,
+                     Eigen::VectorXd& logPrior);
+        /** Log density of the parameter proposal of model k at params,
+         * given their log prior density */
+        double logProposalDensity(int k, const Eigen::VectorXd& params,
+                                  double logPrior) const;
+        /** Perturbation scales of model k, as in the Beaumont sampler */
+        void updateScales(int k);
+
+        samplingControl* samplingControlInstance;
+        std::vector<std::shared_ptr<const simulationContext> > contexts;
+        std::vector<double> model_prior;
+        /** Population of each model, compact layout, and its weights,
+         * which sum to one within the model */
+        std::vector<Eigen::MatrixXd> particles;
+        std::vector<Eigen::VectorXd> particle_weights;
+        std::vector<Eigen::VectorXd> tau;
+        Eigen::MatrixXd batch_results;
+        std::vector<simulationResultSet> batch_results_complete;
+        std::vector<int> batch_result_idx;
+        /** Shared by every model; rebuilt when models are added */
+        std::unique_ptr<NodePool> worker_pool;
+        std::mt19937* generator;
+};
+
+#endif
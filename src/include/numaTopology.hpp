@@ -0,0 +1,38 @@
+#ifndef SPATIALSEIR_NUMA_TOPOLOGY
+#define SPATIALSEIR_NUMA_TOPOLOGY
+
+#include <vector>
+#include <functional>
+
+/** The NUMA nodes of the host, as the CPUs of each node which the process
+ * may run on. They are read from sysfs on Linux; elsewhere, or when the
+ * kernel reports no nodes, the host is a single node holding every CPU.
+ *
+ * Workers placed on a node run on its CPUs only, and memory they touch
+ * first is allocated by the kernel on that node, so that read-only model
+ * data copied by a thread of the node is local to every worker of the
+ * node.*/
+class numaTopology
+{
+    public:
+        /** The topology of the host, read on first use */
+        static const numaTopology& instance();
+        /** Nodes with at least one CPU available to the process */
+        int nodeCount() const;
+        /** Restrict the calling thread to the CPUs of node, or let it run
+         * on every CPU of the process again for node -1. Returns false
+         * where thread affinity is not supported.*/
+        bool bindThread(int node) const;
+        /** Run f on a new thread bound to node and wait for it, rethrowing
+         * anything f throws. Memory first touched by f is thereby placed
+         * on node.*/
+        void runOnNode(int node, const std::function<void()>& f) const;
+
+    private:
+        numaTopology();
+        std::vector<std::vector<int> > node_cpus;
+        /** CPUs the process could run on when the topology was read */
+        std::vector<int> process_cpus;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef SPATIALSEIR_PARAMETER_LAYOUT
+#define SPATIALSEIR_PARAMETER_LAYOUT
+
+#include <Eigen/Core>
+
+/** Maps between the full parameter layout exchanged with R,
+ * [beta, beta_RS, rho, transition, report fraction, S0, E0, I0, R0],
+ * and the compact layout used by the samplers and workers, which holds
+ * only free parameters. Initial values are constants unless they are
+ * estimated; then E0, I0 and R0 are free and S0 is implied by the
+ * population size, so the compact layout ends with [E0, I0, R0].*/
+class parameterLayout
+{
+    public:
+        parameterLayout();
+        parameterLayout(int nHead,
+                        const Eigen::VectorXi& S0,
+                        const Eigen::VectorXi& E0,
+                        const Eigen::VectorXi& I0,
+                        const Eigen::VectorXi& R0,
+                        bool estimateIVC);
+        /** Rows in the full layout, with fixed and implied columns filled */
+        Eigen::MatrixXd expand(const Eigen::MatrixXd& compact) const;
+        /** Rows in the compact layout; fixed and implied columns are dropped */
+        Eigen::MatrixXd compress(const Eigen::MatrixXd& full) const;
+        /** Initial compartments of one compact parameter vector */
+        void initialValues(const Eigen::Ref<const Eigen::VectorXd>& compact,
+                           Eigen::VectorXi& S, Eigen::VectorXi& E,
+                           Eigen::VectorXi& I, Eigen::VectorXi& R) const;
+        /** Columns preceding the initial values in both layouts */
+        int nHead;
+        int nLoc;
+        int nFull;
+        int nFree;
+        bool estimateIVC;
+
+    private:
+        Eigen::VectorXi S0;
+        Eigen::VectorXi E0;
+        Eigen::VectorXi I0;
+        Eigen::VectorXi R0;
+        Eigen::VectorXd N;
+};
+
+#endif
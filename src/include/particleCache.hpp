@@ -0,0 +1,150 @@
+#ifndef SPATIALSEIR_PARTICLE_CACHE
+#define SPATIALSEIR_PARTICLE_CACHE
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+
+/** A bounded map from parameter vectors to values which depend on nothing
+ * else, such as the prior density of a particle. Entries are addressed by
+ * a hash of the bytes of the vector and compared in full, so that a
+ * collision only costs a miss. Once full, entries are replaced in the
+ * clock approximation of least recently used order: an entry found since
+ * the clock hand last passed it is kept for another round.
+ * A capacity of zero disables the cache. Not synchronized: each cache
+ * belongs to one thread.*/
+template <typename Value>
+class particleCache
+{
+    public:
+        explicit particleCache(int capacity = 0) : next(0), hits(0), lookups(0)
+        {
+            setCapacity(capacity);
+        }
+
+        /** Drop every entry and count, and hold at most capacity entries
+         * from now on */
+        void setCapacity(int capacity)
+        {
+            slots.clear();
+            index.clear();
+            limit = (capacity > 0 ? capacity : 0);
+            next = 0;
+            hits = 0;
+            lookups = 0;
+        }
+
+        bool enabled() const
+        {
+            return(limit > 0);
+        }
+
+        /** The value stored for key, or nullptr */
+        Value* find(const Eigen::VectorXd& key)
+        {
+            const std::size_t h = hashKey(key);
+            auto range = index.equal_range(h);
+            for (auto itr = range.first; itr != range.second; ++itr)
+            {
+                entry& slot = slots[itr -> second];
+                if (slot.key.size() == key.size() &&
+                    std::memcmp(slot.key.data(), key.data(),
+                                key.size()*sizeof(double)) == 0)
+                {
+                    slot.referenced = true;
+                    return(&(slot.value));
+                }
+            }
+            return(nullptr);
+        }
+
+        /** Store value for key, which must not be cached already */
+        void insert(const Eigen::VectorXd& key, Value value)
+        {
+            if (limit == 0)
+            {
+                return;
+            }
+            const std::size_t h = hashKey(key);
+            if ((int) slots.size() < limit)
+            {
+                slots.push_back(entry{key, std::move(value), h, false});
+                index.emplace(h, slots.size() - 1);
+                return;
+            }
+            while (slots[next].referenced)
+            {
+                slots[next].referenced = false;
+                next = (next + 1) % limit;
+            }
+            entry& slot = slots[next];
+            auto range = index.equal_range(slot.hash);
+            for (auto itr = range.first; itr != range.second; ++itr)
+            {
+                if ((int) itr -> second == next)
+                {
+                    index.erase(itr);
+                    break;
+                }
+            }
+            slot.key = key;
+            slot.value = std::move(value);
+            slot.hash = h;
+            slot.referenced = false;
+            index.emplace(h, next);
+            next = (next + 1) % limit;
+        }
+
+        /** Count a request, served from the cache or not */
+        void count(bool hit)
+        {
+            lookups++;
+            hits += hit;
+        }
+
+        /** Return, and reset, the requests counted and those served from
+         * the cache */
+        void takeCounts(long* outHits, long* outLookups)
+        {
+            *outHits = hits;
+            *outLookups = lookups;
+            hits = 0;
+            lookups = 0;
+        }
+
+    private:
+        struct entry
+        {
+            Eigen::VectorXd key;
+            Value value;
+            std::size_t hash;
+            bool referenced;
+        };
+
+        /** FNV-1a over the bytes of the vector */
+        static std::size_t hashKey(const Eigen::VectorXd& key)
+        {
+            std::uint64_t h = 14695981039346656037ULL;
+            const unsigned char* bytes =
+                reinterpret_cast<const unsigned char*>(key.data());
+            const std::size_t n = key.size()*sizeof(double);
+            for (std::size_t i = 0; i < n; i++)
+            {
+                h ^= bytes[i];
+                h *= 1099511628211ULL;
+            }
+            return((std::size_t) h);
+        }
+
+        std::vector<entry> slots;
+        std::unordered_multimap<std::size_t, std::size_t> index;
+        int limit;
+        int next;
+        long hits;
+        long lookups;
+};
+
+#endif
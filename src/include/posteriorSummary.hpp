@@ -0,0 +1,71 @@
+#ifndef SPATIALSEIR_POSTERIOR_SUMMARY
+#define SPATIALSEIR_POSTERIOR_SUMMARY
+
+#include <Rcpp.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+
+struct simulationResultSet;
+
+/** Running per-(time, location) summaries of simulated compartments:
+ * the mean and variance (Welford's algorithm) and P^2 estimates of a set
+ * of quantiles (Jain and Chlamtac, 1985). Memory is proportional to the
+ * number of cells and does not grow with the number of simulations.
+ *
+ * The cells are split into shards, each with its own lock, so that worker
+ * threads can add simulations concurrently. P^2 estimates depend on the
+ * order of the observations, so the quantiles (but not the moments) vary
+ * slightly with thread scheduling.*/
+class posteriorSummary
+{
+    public:
+        /** compartments are named as in simulationResultSet: S, E, I, R,
+         * S_star, E_star, I_star or R_star.*/
+        posteriorSummary(int nTpt, int nLoc,
+                         const std::vector<std::string>& compartments,
+                         const Eigen::VectorXd& probs,
+                         int shards);
+        /** Add the compartments of one simulation; safe to call from
+         * several threads.*/
+        void add(const simulationResultSet& result);
+        /** Number of simulations added */
+        int count() const;
+        /** A list with an element for each compartment, holding nTpt by
+         * nLoc matrices: mean, variance, and a list of quantiles in the
+         * order of probs.*/
+        Rcpp::List toList() const;
+
+    private:
+        /** Add the observations of shard s, whose lock is held */
+        void addShard(int s, const std::vector<const Eigen::MatrixXi*>& values);
+        /** Update the P^2 markers of one cell with observation x, the
+         * n-th (counting from one) */
+        void updateMarkers(double* height, int* position, double p,
+                           int n, double x) const;
+        /** Quantile estimate of one cell after n observations */
+        double estimate(const double* height, double p, int n) const;
+
+        int nTpt;
+        int nLoc;
+        int nCells;
+        std::vector<std::string> compartments;
+        std::vector<Eigen::MatrixXi simulationResultSet::*> members;
+        Eigen::VectorXd probs;
+        /** Cell ranges [shard_start[s], shard_start[s + 1]) */
+        std::vector<int> shard_start;
+        std::vector<int> shard_count;
+        std::unique_ptr<std::mutex[]> shard_mutex;
+        std::atomic<unsigned int> next_shard;
+        /** Indexed by compartment*nCells + cell */
+        std::vector<double> mean;
+        std::vector<double> m2;
+        /** Five markers per (compartment, probability, cell) */
+        std::vector<double> heights;
+        std::vector<int> positions;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SPATIALSEIR_PRIOR_DENSITY
+#define SPATIALSEIR_PRIOR_DENSITY
+
+#include <random>
+#include <Eigen/Core>
+
+class dataModel;
+class exposureModel;
+class reinfectionModel;
+class distanceModel;
+class transitionPriors;
+class initialValueContainer;
+
+/** Prior distribution of the compact parameter vector
+ * [beta, beta_RS, rho, transition, report fraction, E0, I0, R0], where
+ * the initial values are present only when estimated (see parameterLayout).
+ *
+ * Densities are evaluated without the R API, with their normalizing
+ * constants computed once, so that blocks of particles can be evaluated
+ * and drawn on worker threads. Member functions are const and may be
+ * called concurrently.*/
+class priorDensity
+{
+    public:
+        priorDensity();
+        priorDensity(dataModel* dataModel_,
+                     exposureModel* exposureModel_,
+                     reinfectionModel* reinfectionModel_,
+                     distanceModel* distanceModel_,
+                     transitionPriors* transitionPriors_,
+                     initialValueContainer* initialValueContainer_);
+        /** Log prior density of one parameter vector */
+        double logDensity(const Eigen::Ref<const Eigen::VectorXd>& params) const;
+        /** Log prior density of rows start to start + count - 1 of params,
+         * written to the same entries of out */
+        void logDensity(const Eigen::MatrixXd& params, int start, int count,
+                        Eigen::VectorXd& out) const;
+        /** Draw rows start to start + count - 1 of params from the prior.
+         * Returns the number of rows for which no rho values with a sum
+         * of at most one were found.*/
+        int sample(Eigen::MatrixXd& params, int start, int count,
+                   std::mt19937* generator) const;
+        /** Length of a compact parameter vector */
+        int nParams;
+
+    private:
+        bool validIVC(int S, int E, int I, int R, int loc) const;
+        int nBeta;
+        int nBetaRS;
+        int nRho;
+        int nTrans;
+        int nReport;
+        int nLoc;
+        /** 0: exponential, 1: weibull, 2: path specific */
+        int transitionType;
+        bool estimateIVC;
+        /** Whether constant initial values lie within their bounds */
+        bool fixedIVCValid;
+
+        Eigen::ArrayXd beta_mean;
+        Eigen::ArrayXd beta_sd;
+        Eigen::ArrayXd beta_const;
+        Eigen::ArrayXd rs_mean;
+        Eigen::ArrayXd rs_sd;
+        Eigen::ArrayXd rs_const;
+        double rho_alpha;
+        double rho_beta;
+        double rho_const;
+        /** Shape and rate of the gamma priors on the transition parameters,
+         * in parameter order */
+        Eigen::ArrayXd trans_shape;
+        Eigen::ArrayXd trans_rate;
+        Eigen::ArrayXd trans_const;
+        double rf_alpha;
+        double rf_beta;
+        double rf_const;
+        Eigen::ArrayXi N;
+        Eigen::ArrayXi S0;
+        Eigen::ArrayXi E0;
+        Eigen::ArrayXi I0;
+        Eigen::ArrayXi R0;
+        Eigen::ArrayXi S0_max;
+        Eigen::ArrayXi E0_max;
+        Eigen::ArrayXi I0_max;
+        Eigen::ArrayXi R0_max;
+};
+
+#endif
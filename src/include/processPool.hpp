@@ -0,0 +1,114 @@
+#ifndef SPATIALSEIR_PROCESS_POOL
+#define SPATIALSEIR_PROCESS_POOL
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <memory>
+#include <utility>
+#include <Eigen/Core>
+#include <simulationContext.hpp>
+
+struct processRingHeader;
+struct processRingSlot;
+struct processStandby;
+
+/** A parameter vector waiting for a free slot */
+struct processTask
+{
+    int param_idx;
+    /** Simulations of this task lost to a worker process exiting */
+    int attempts;
+    double threshold;
+    bool common_streams;
+    unsigned int common_seed;
+    Eigen::VectorXd params;
+};
+
+/** A set of forked local worker processes which simulate epidemics on
+ * behalf of a NodePool. Parameters and distances are exchanged through a
+ * ring of slots in an anonymous shared memory mapping; the read only
+ * simulationContext is inherited copy-on-write at fork time.
+ *
+ * A child inherits only the thread which forked it, along with whatever
+ * mutexes other threads held at that moment, so every process is forked by
+ * the constructor, after joining the threads of the workerHost if it has
+ * any; they start again as work is submitted. Besides the workers, a few
+ * standby processes are forked which wait to replace a worker that exits
+ * unexpectedly. restartWorkers hands the id of such a worker to a standby,
+ * and the particles it was simulating are queued once more. A particle
+ * which brings down a second worker is returned with an infinite distance.
+ *
+ * All member functions are called from the main thread only.*/
+class ProcessPool
+{
+    public:
+        ProcessPool(int processes,
+                    int random_seed,
+                    std::shared_ptr<const simulationContext> context);
+        ~ProcessPool();
+        /** Whether the platform supports the process backend */
+        static bool available();
+        /** Queue a parameter vector to be simulated. Replicates whose
+         * distance is certain to reach threshold are cut short.*/
+        void enqueue(int param_idx, const Eigen::VectorXd& params,
+                     double threshold);
+        /** Collect finished simulations into completed, hand queued
+         * parameters to free slots, and return the number of tasks which
+         * are still outstanding.*/
+        int poll(std::vector<std::pair<int, Eigen::VectorXd> >& completed,
+                 std::deque<std::string>& messages);
+        /** Replace the workers which exited unexpectedly by standby
+         * processes, while any are left */
+        void restartWorkers();
+        /** Forget parameters which have not yet been handed to a worker */
+        void cancelPending();
+        /** Return, and reset, the number of simulations cut short by
+         * screening and the number of time steps they skipped.*/
+        void takeScreeningStats(int* screened, long* skipped_steps);
+        /** Simulate parameters queued from now on from the common streams
+         * of seed, or stop doing so */
+        void setCommonStreams(bool enabled, unsigned int seed);
+
+    private:
+        /** Fork worker worker_id and return whether it started */
+        bool spawnWorker(int worker_id);
+        /** Fork standby process idx and return whether it started */
+        bool spawnStandby(int idx);
+        void workerMain(int worker_id, int random_seed);
+        void standbyMain(int idx);
+        /** Seed of the worker started by standby process idx, drawn from a
+         * stream of its own rather than the seeds of the first workers */
+        int restartSeed(int idx);
+        void reapWorkers(std::vector<std::pair<int, Eigen::VectorXd> >& completed,
+                         std::deque<std::string>& messages);
+        void shutdown();
+        processRingSlot* slot(int idx);
+        processStandby* standby(int idx);
+        double* slotParams(int idx);
+        double* slotResult(int idx);
+
+        std::shared_ptr<const simulationContext> context;
+        std::vector<int> pids;
+        std::vector<bool> alive;
+        /** Standby processes, in the order they are handed out */
+        std::vector<int> standby_pids;
+        int nextStandby;
+        int base_seed;
+        std::deque<processTask> pending;
+        processRingHeader* header;
+        char* mapping;
+        size_t mapping_size;
+        size_t slot_stride;
+        size_t slots_offset;
+        int nSlots;
+        int nParams;
+        int m;
+        int inFlight;
+        int screened;
+        long skippedSteps;
+        bool common_streams;
+        unsigned int common_seed;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SPATIALSEIR_REPRODUCTIVE_NUMBER
+#define SPATIALSEIR_REPRODUCTIVE_NUMBER
+
+#include <Eigen/Core>
+#include <simulationContext.hpp>
+
+/** Inputs and outputs of a batch of reproductive number calculations.
+ * Simulation i occupies rows i*nTpt to (i + 1)*nTpt - 1 of the stacked
+ * compartment and R_EA matrices, row i of params (compact layout) and N,
+ * and column i of R_NGM.*/
+struct reproductiveNumberBatch
+{
+    const Eigen::MatrixXd* params;
+    const Eigen::MatrixXi* S;
+    const Eigen::MatrixXi* I;
+    const Eigen::MatrixXd* N;
+    Eigen::MatrixXd* R_EA;
+    Eigen::MatrixXd* R_NGM;
+};
+
+/** Reproductive numbers of simulated epidemics, computed from the contact
+ * structure of a model. Member functions are const and may be called
+ * concurrently.
+ *
+ * The empirically adjusted reproductive number R_EA(t, a) is the expected
+ * number of infections caused by an individual infectious at location a
+ * from time t, given the simulated susceptible counts: the instantaneous
+ * expected infections per infectious individual, accumulated over the
+ * remaining infectious period.
+ *
+ * R_NGM(t) is the spectral radius of the next generation matrix at time t,
+ * K(b, a) = D S(t, b) (I + sum_k rho_k DM_k + sum_l rho_l TDM_l(t))(b, a)
+ * exp(X beta)(t, a)/N(a), for mean infectious period D; it is found by
+ * power iteration with the (possibly sparse) contact matrices, without
+ * forming K.*/
+class reproductiveNumber
+{
+    public:
+        explicit reproductiveNumber(const simulationContext& ctx);
+        /** Reproductive numbers of simulation i of a batch */
+        void compute(const reproductiveNumberBatch& batch, int i) const;
+
+    private:
+        /** Probabilities of remaining infectious 0, 1, 2, ... time steps
+         * after becoming infectious, truncated once negligible */
+        Eigen::VectorXd infectiousSurvival(const Eigen::VectorXd& params) const;
+        /** The spectral radius of K, starting the iteration from x, which
+         * is left holding the dominant eigenvector */
+        double spectralRadius(int t, double duration,
+                              const Eigen::VectorXd& rho,
+                              const Eigen::VectorXd& susceptible,
+                              const Eigen::VectorXd& transmissibility,
+                              Eigen::VectorXd& x) const;
+
+        const simulationContext& context;
+        bool has_spatial;
+        bool has_ts_spatial;
+        int nBeta;
+        int nReinf;
+        int nRho;
+};
+
+#endif
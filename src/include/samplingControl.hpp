@@ -8,6 +8,21 @@
 #define ALG_DelMoral2012 3
 #define ALG_Simulate 4
 
+#define SIM_BACKEND_THREADS 0
+#define SIM_BACKEND_PROCESSES 1
+
+#define SIM_PLACEMENT_FLOATING 0
+#define SIM_PLACEMENT_PINNED 1
+#define SIM_PLACEMENT_REPLICATED 2
+
+#define SIM_APPROX_NONE 0
+#define SIM_APPROX_NORMAL 1
+#define SIM_APPROX_POISSON 2
+// The Poisson draw inflates the binomial variance by 1/(1 - p) for the
+// rarer probability p, so it is only used up to this p, and the normal
+// draw above it
+#define SIM_APPROX_POISSON_MAX_PROBABILITY 0.05
+
 #include <Rcpp.h>
 #include<modelComponent.hpp>
 
@@ -23,6 +38,9 @@ class samplingControl : public modelComponent
         ~samplingControl();
     void summary();
     int getModelComponentType();
+    /** Where worker threads run: anywhere, pinned to NUMA nodes, or
+     * pinned with a copy of the model data on each node */
+    int workerPlacement();
     int simulation_width;
     int random_seed;
     int algorithm;
@@ -37,6 +55,34 @@ class samplingControl : public modelComponent
     int m;
 	double lpow;
     bool multivariatePerturbation;
+    int backend;
+    bool adaptive_batch;
+    int min_batch_size;
+    bool streaming;
+    bool screening;
+    bool emulator;
+    double emulator_verify;
+    double emulator_margin;
+    /** DelMoral2012 resamples once the effective sample size falls below
+     * this fraction of the particles */
+    double resample_ess;
+    bool single_precision;
+    bool affinity;
+    bool numa_replicas;
+    /** Parameter vectors whose prior density and simulation setup are
+     * cached, by the sampler and by each worker; zero disables caching */
+    int cache_size;
+    /** Replicate w of every particle simulated by a call to sample draws
+     * from the same random number stream */
+    bool common_random_numbers;
+    /** Binomial transitions whose expected successes and failures both
+     * reach approximation_threshold are drawn from a normal or Poisson
+     * approximation, one of SIM_APPROX_* */
+    int binomial_approximation;
+    double approximation_threshold;
+    /** Fraction of simulations repeated with exact draws, to measure the
+     * effect of the approximation on the distances */
+    double approximation_verify;
 };
 
 
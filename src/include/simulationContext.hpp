@@ -0,0 +1,122 @@
+#ifndef SPATIALSEIR_SIMULATION_CONTEXT
+#define SPATIALSEIR_SIMULATION_CONTEXT
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <Eigen/Core>
+#include <dataModel.hpp>
+#include <contactMatrix.hpp>
+#include <priorDensity.hpp>
+#include <parameterLayout.hpp>
+
+class exposureModel;
+class reinfectionModel;
+class distanceModel;
+class transitionPriors;
+class initialValueContainer;
+class samplingControl;
+
+/** The observed epidemic. Models of the same data share one copy.*/
+struct observedData
+{
+    Eigen::MatrixXi Y;
+    /** Observed (non-missing) cells of Y in time-major compressed form: 
+     * the observations at time t are entries obs_start[t] up to 
+     * obs_start[t+1] of obs_loc (location index) and obs_value.*/
+    std::vector<int> obs_start;
+    std::vector<int> obs_loc;
+    Eigen::ArrayXd obs_value;
+    bool operator==(const observedData& other) const;
+};
+
+/** Read-only description of a model, shared by every simulation worker.
+ * It is built once per model; worker threads hold a shared pointer to
+ * it, and forked worker processes inherit it copy-on-write.*/
+struct simulationContext
+{
+    Eigen::VectorXi S0;
+    Eigen::VectorXi E0;
+    Eigen::VectorXi I0;
+    Eigen::VectorXi R0;
+    Eigen::VectorXd offset;
+    std::shared_ptr<const observedData> observed;
+    int dataModelType;
+    /** Static contact matrices, in the precision of the simulations */
+    std::vector<contactMatrix> DM_vec;
+    /** Time varying contact matrices: TDM_index[t][lag] indexes the
+     * distinct matrices held in TDM_store.*/
+    std::vector<std::vector<int> > TDM_index;
+    contactMatrixStore TDM_store;
+    std::vector<int> TDM_empty;
+    /** The exposure design matrix, empty in the single precision mode,
+     * which reads only X_single */
+    Eigen::MatrixXd X;
+    /** X in single precision, present only in the single precision mode */
+    Eigen::MatrixXf X_single;
+    /** Columns of the design matrix, whichever precision holds it */
+    int nBeta;
+    Eigen::MatrixXd X_rs;
+    std::string transitionMode;
+    Eigen::MatrixXd E_to_I_prior;
+    Eigen::MatrixXd I_to_R_prior;
+    double inf_mean;
+    Eigen::VectorXd spatial_prior;
+    Eigen::VectorXd exposure_precision;
+    Eigen::VectorXd reinfection_precision;
+    Eigen::VectorXd exposure_mean;
+    Eigen::VectorXd reinfection_mean;
+    double phi;
+    int data_compartment;
+    bool cumulative;
+    int m;
+    double lpow;
+    /** Whether the force of infection, contact matrices and X_single are
+     * held and computed in float */
+    bool single_precision;
+    /** One of SIM_APPROX_*, applied to binomial draws whose expected
+     * successes and failures both reach approximation_threshold */
+    int binomial_approximation;
+    double approximation_threshold;
+    /** Fraction of simulations checked against exact draws */
+    double approximation_verify;
+    /** Length of a compact parameter vector, as dispatched to workers */
+    int nParams;
+    parameterLayout layout;
+    priorDensity prior;
+};
+
+/** Check that the model components were supplied in order and describe
+ * the same locations and time points, stopping otherwise.*/
+void checkModelComponents(dataModel* dataModel_,
+                          exposureModel* exposureModel_,
+                          reinfectionModel* reinfectionModel_,
+                          distanceModel* distanceModel_,
+                          transitionPriors* transitionPriors_,
+                          initialValueContainer* initialValueContainer_,
+                          samplingControl* samplingControl_);
+
+/** The observed cells of a data model */
+std::shared_ptr<const observedData> buildObservedData(dataModel* dataModel_);
+
+/** Collect the read-only description of a model. The observations are
+ * taken from observed when it is given, and from the data model
+ * otherwise.*/
+std::shared_ptr<const simulationContext> buildSimulationContext(
+        dataModel* dataModel_,
+        exposureModel* exposureModel_,
+        reinfectionModel* reinfectionModel_,
+        distanceModel* distanceModel_,
+        transitionPriors* transitionPriors_,
+        initialValueContainer* initialValueContainer_,
+        samplingControl* samplingControl_,
+        std::shared_ptr<const observedData> observed = nullptr);
+
+/** A copy of context made by the calling thread, for workers which should
+ * read a replica in memory local to their NUMA node. The observations are
+ * taken from observed when it is given, and copied otherwise.*/
+std::shared_ptr<const simulationContext> copySimulationContext(
+        const simulationContext& context,
+        std::shared_ptr<const observedData> observed = nullptr);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SPATIALSEIR_SIMULATION_DIAGNOSTICS
+#define SPATIALSEIR_SIMULATION_DIAGNOSTICS
+
+#include <Rcpp.h>
+#include <array>
+
+// Define SPATIALSEIR_NO_DIAGNOSTICS to remove the diagnostics counters
+// from the simulation kernel altogether.
+//#define SPATIALSEIR_NO_DIAGNOSTICS
+
+#ifdef SPATIALSEIR_NO_DIAGNOSTICS
+#define SEIR_DIAGNOSTIC(statement)
+#else
+#define SEIR_DIAGNOSTIC(statement) statement
+#endif
+
+/** Wall time histogram buckets: powers of two microseconds */
+#define SIM_TIME_BUCKETS 32
+
+/** Counts of the work done by simulations, kept by each simulation node
+ * without synchronization and added together by the pool once its
+ * workers are idle. They show why some particles simulate far more
+ * slowly than others: large epidemics make many costly binomial draws,
+ * long transition paths many bucket visits.*/
+struct simulationDiagnostics
+{
+    simulationDiagnostics();
+    long long simulations;
+    /** Binomial draws by branch of binomialDraw: no trials or a certain
+     * outcome, fewer than ten expected events in the smaller tail (drawn
+     * by inversion), and the rest (drawn by rejection).*/
+    long long binomial_trivial;
+    long long binomial_small;
+    long long binomial_large;
+    /** Bucket visits while advancing path specific and Weibull paths */
+    long long path_iterations;
+    /** Time steps simulated, over every replicate */
+    long long time_steps;
+    /** Heap buffers allocated for the working state of simulations */
+    long long allocations;
+    /** Simulations by wall time: bucket 0 holds those under one
+     * microsecond, and bucket b those of 2^(b-1) up to 2^b microseconds.
+     * The last bucket also holds any longer ones.*/
+    std::array<long long, SIM_TIME_BUCKETS> time_histogram;
+
+    /** Count a binomial draw of n trials with probability p */
+    inline void countBinomial(int n, double p)
+    {
+        if (n <= 0 || !(p > 0) || p >= 1)
+        {
+            binomial_trivial++;
+        }
+        else if (n*(p > 0.5 ? 1.0 - p : p) < 10.0)
+        {
+            binomial_small++;
+        }
+        else
+        {
+            binomial_large++;
+        }
+    }
+    void recordTime(double microseconds);
+    void add(const simulationDiagnostics& other);
+    void reset();
+    /** The counters, and the histogram with the upper bound of each
+     * bucket in microseconds */
+    Rcpp::List toList() const;
+};
+
+#endif
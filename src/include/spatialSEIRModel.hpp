@@ -4,6 +4,8 @@
 #include <Rcpp.h>
 #include <memory>
 #include <random>
+#include <deque>
+#include <functional>
 #include "./dataModel.hpp"
 #include "./distanceModel.hpp"
 #include "./exposureModel.hpp"
@@ -37,6 +39,8 @@ struct simulationResultSet
     Eigen::MatrixXd rho;
     Eigen::MatrixXd beta;
     Eigen::MatrixXd result; 
+    /** Time steps not simulated because a replicate was screened out */
+    int stepsSkipped;
 };
 
 class dataModel;
@@ -67,6 +71,34 @@ class spatialSEIRModel
         Rcpp::List sample(SEXP nSample, SEXP returnComps, SEXP verbose);
         /** Evaluate the prior distribution of a particular set of parameters*/
         double evalPrior(Eigen::VectorXd param_values);
+        /** Evaluate the prior distribution of each row of params on the
+         * worker pool */
+        Eigen::VectorXd evalPriorRows(const Eigen::MatrixXd& params);
+        /** Evaluate the prior density of each row of params, given in the
+         * full layout exchanged with R. Fixed and implied initial values
+         * are point masses, so rows which disagree with them have density
+         * zero.*/
+        Eigen::VectorXd evalPriorDensity(Eigen::MatrixXd params);
+        /** Simulate an epidemic for each parameter row, as sample does
+         * with the simulation algorithm, but return only per-(time,
+         * location) means, variances and probs quantiles of the named
+         * compartments (see posteriorSummary).*/
+        Rcpp::List summarize(Eigen::VectorXd probs,
+                             std::vector<std::string> compartments,
+                             int verbose);
+        /** Reproductive numbers of the simulations whose S and I
+         * compartments are stacked, nTpt rows per parameter row, with
+         * populations N (one row per simulation). Returns the stacked R_EA
+         * matrices and an nTpt by simulations matrix R_NGM (see
+         * reproductiveNumber).*/
+        Rcpp::List computeR0(Eigen::MatrixXi S, Eigen::MatrixXi I, 
+                             Eigen::MatrixXd N);
+        /** Use samplingControl_ from now on, as if the model had been
+         * constructed with it. The worker threads are kept and reseeded
+         * unless the number of cores, the backend or the worker placement
+         * change, and the shared model description is rebuilt only when
+         * the replicates, distance or precision change.*/
+        void setSamplingControl(samplingControl& samplingControl_);
         /** Assign the parameter values manually */
         bool setParameters(Eigen::MatrixXd param_values, 
                            Eigen::VectorXd weights,
@@ -91,6 +123,13 @@ class spatialSEIRModel
         ~spatialSEIRModel();
 
     private:
+        /** Seed the generator and clear the particles, as for a newly
+         * constructed model */
+        void initializeState();
+
+        /** Start the worker pool for the current sampling control */
+        void createWorkerPool();
+
         /** Set parameters from prior distribution*/
         Eigen::MatrixXd generateParamsPrior(int N);
 
@@ -100,6 +139,37 @@ class spatialSEIRModel
                              Eigen::MatrixXd* result_recip,
                              std::vector<simulationResultSet>* result_c_recip);
 
+        /** Simulate proposals as a stream, keeping the worker pool supplied
+         * while results are examined in proposal order. propose fills a
+         * block of rows starting at the given stream index and returns the
+         * number of proposals it discarded without simulating, which count
+         * against budget; accept reports whether a (params, result) pair
+         * was kept. Stops after needed acceptances or budget proposals,
+         * cancelling leftover work, and returns the number accepted.*/
+        int run_simulations_streaming(
+                std::function<int(int, Eigen::MatrixXd&)> propose,
+                std::function<bool(const Eigen::VectorXd&, const Eigen::VectorXd&)> accept,
+                int needed,
+                int budget,
+                int* simulated,
+                int* wasted);
+
+        /** Append the hit rates of the prior and simulation setup caches
+         * since the last call, printing them when verbose > 1. Nothing is
+         * recorded when caching is disabled.*/
+        void recordCacheRates(std::vector<double>& priorRate,
+                              std::vector<double>& setupRate,
+                              int verbose);
+        /** Append how far the distances of the simulations checked since
+         * the last call moved under the binomial approximation: the
+         * relative change of their mean and the Kolmogorov-Smirnov
+         * distance between the exact and approximate distances. Printed
+         * when verbose > 1; nothing is recorded unless checks are
+         * requested.*/
+        void recordApproximationCheck(std::vector<double>& shift,
+                                      std::vector<double>& ks,
+                                      int verbose);
+
         /** Run simulation using basic ABC algorithm */
         Rcpp::List sample_basic(int nSample, int verbose, 
                                 std::string sim_type_atom);
@@ -193,9 +263,21 @@ class spatialSEIRModel
         /** Pointer to a samplingControl object.*/
         samplingControl* samplingControlInstance;
 
+        /** Read-only model description shared with the workers */
+        std::shared_ptr<const simulationContext> model_context;
+
         /** Thread pool */
         std::unique_ptr<NodePool> worker_pool; 
 
+        /** Prior densities of particles already evaluated in this call of
+         * sample; resampled and unmoved particles are served from here */
+        particleCache<double> prior_cache;
+
+        /** Cores, backend and worker placement the pool was started with */
+        int pool_cores;
+        int pool_backend;
+        int pool_placement;
+
         /** A persistant pointer to a properly initialized random 
          * number generator.*/
         std::mt19937* generator;
@@ -18,5 +18,34 @@ class compartment_tap{
         Eigen::MatrixXi compartment;
 };
 
+/** Ring of the most recent nLags vectors of length n; get(0) is the 
+ * vector pushed last.*/
+template <typename Scalar>
+class vector_tap{
+    public:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        vector_tap(int nLags, int n)
+        {
+            idx = 0;
+            values = std::vector<Vector>(nLags > 0 ? nLags : 1, 
+                                         Vector::Zero(n));
+        }
+        void push(const Vector& value)
+        {
+            values[idx] = value;
+            idx += 1;
+            idx = (idx >= (int) values.size() ? 0 : idx);
+        }
+        const Vector& get(int lag) const
+        {
+            int proposed = (idx - lag - 1) % (int) values.size();
+            return(values[proposed < 0 ? proposed + values.size() : proposed]);
+        }
+
+    private:
+        int idx;
+        std::vector<Vector> values;
+};
+
 
 #endif
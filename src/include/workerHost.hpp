@@ -0,0 +1,58 @@
+#ifndef SPATIALSEIR_WORKER_HOST
+#define SPATIALSEIR_WORKER_HOST
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class NodeWorker;
+
+/** The threads of the process, shared by every NodePool. A pool attaches
+ * its workers, each holding the simulation nodes and generators for its
+ * models, and hands a worker to the host whenever its queue has work. A
+ * host thread then runs the worker until the queue is empty, so creating
+ * and destroying model objects starts and joins no threads.
+ *
+ * Threads are started as needed, up to the limit, and are kept for the
+ * life of the process. At most limit workers run at once, whatever the
+ * number of pools and of cores each asks for, so several models in use
+ * together do not oversubscribe the host.*/
+class workerHost
+{
+    public:
+        /** The host of the process */
+        static workerHost& instance();
+        /** Run worker on a host thread until its pool has no tasks. The
+         * thread is first bound to the NUMA node of the worker, if it has
+         * one.*/
+        void submit(NodeWorker* worker);
+        /** Set the number of workers which may run at once */
+        void setThreadLimit(int limit);
+        int threadLimit();
+        /** Number of threads started so far */
+        int threadCount();
+        /** Largest number of workers which have run at once since the
+         * last call */
+        int peakRunning();
+        /** Stop and join every thread, when the library is unloaded or
+         * before the process forks. Threads start again as workers are
+         * submitted.*/
+        void shutdown();
+
+    private:
+        workerHost();
+        void run();
+        std::vector<std::thread> threads;
+        std::deque<NodeWorker*> jobs;
+        std::mutex host_mutex;
+        std::condition_variable condition;
+        int limit;
+        int running;
+        int peak;
+        int waiting;
+        bool exit;
+};
+
+#endif
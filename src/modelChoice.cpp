@@ -0,0 +1,503 @@
+#include <Rcpp.h>
+#include <Eigen/Core>
+#include <RcppEigen.h>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <modelChoice.hpp>
+#include <SEIRSimNodes.hpp>
+
+// Share of each model proposal kept from the proposal the generation
+// started with, so that a model is not abandoned on the strength of a
+// few early acceptances, and share of the parameter proposals drawn from
+// the prior, which bounds the importance weights.
+#define MODEL_CHOICE_DEFENSIVE_SHARE 0.1
+
+/** log(sum(exp(x))) */
+static double logSumExp(const std::vector<double>& x)
+{
+    double mx = -std::numeric_limits<double>::infinity();
+    for (unsigned int i = 0; i < x.size(); i++)
+    {
+        mx = std::max(mx, x[i]);
+    }
+    if (!std::isfinite(mx))
+    {
+        return(mx);
+    }
+    double total = 0.0;
+    for (unsigned int i = 0; i < x.size(); i++)
+    {
+        total += std::exp(x[i] - mx);
+    }
+    return(mx + std::log(total));
+}
+
+/** Index drawn from probabilities summing to one */
+static int drawIndex(const Eigen::VectorXd& probs, std::mt19937* generator)
+{
+    double drw = std::uniform_real_distribution<double>(0,1)(*generator);
+    int last = 0;
+    for (int i = 0; i < probs.size(); i++)
+    {
+        if (probs(i) > 0)
+        {
+            last = i;
+            drw -= probs(i);
+            if (drw <= 0)
+            {
+                return(i);
+            }
+        }
+    }
+    return(last);
+}
+
+modelChoiceSampler::modelChoiceSampler(samplingControl& samplingControl_)
+{
+    if (samplingControl_.getModelComponentType() != LSS_SAMPLING_CONTROL_MODEL_TYPE)
+    {
+        Rcpp::stop("Error: a samplingControl object is required. \n");
+    }
+    samplingControlInstance = &samplingControl_;
+
+    std::minstd_rand0 lc_generator(samplingControlInstance -> random_seed + 1);
+    std::uint_least32_t seed_data[std::mt19937::state_size];
+    std::generate_n(seed_data, std::mt19937::state_size, std::ref(lc_generator));
+    std::seed_seq q(std::begin(seed_data), std::end(seed_data));
+    generator = new std::mt19937{q};
+}
+
+void modelChoiceSampler::addModel(dataModel& dataModel_,
+                                  exposureModel& exposureModel_,
+                                  reinfectionModel& reinfectionModel_,
+                                  distanceModel& distanceModel_,
+                                  transitionPriors& transitionPriors_,
+                                  initialValueContainer& initialValueContainer_,
+                                  Eigen::MatrixXd params,
+                                  Eigen::VectorXd weights,
+                                  double prior)
+{
+    checkModelComponents(&dataModel_, &exposureModel_, &reinfectionModel_,
+                         &distanceModel_, &transitionPriors_,
+                         &initialValueContainer_, samplingControlInstance);
+    std::shared_ptr<const observedData> observed = buildObservedData(&dataModel_);
+    if (!contexts.empty())
+    {
+        if (!(*observed == *(contexts[0] -> observed)))
+        {
+            Rcpp::stop("Only models of the same data may be compared.\n");
+        }
+        observed = contexts[0] -> observed;
+    }
+    std::shared_ptr<const simulationContext> context = buildSimulationContext(
+            &dataModel_, &exposureModel_, &reinfectionModel_, &distanceModel_,
+            &transitionPriors_, &initialValueContainer_, samplingControlInstance,
+            observed);
+
+    if (params.cols() != (context -> layout).nFull)
+    {
+        Rcpp::stop("Number of supplied parameters does not match model specification.\n");
+    }
+    if (params.rows() != weights.size() || params.rows() == 0)
+    {
+        Rcpp::stop("Number of weights not equal to number of particles.\n");
+    }
+    if (!(prior > 0) || !(weights.minCoeff() >= 0) || !(weights.sum() > 0))
+    {
+        Rcpp::stop("Model prior probabilities and particle weights must be positive.\n");
+    }
+    Eigen::MatrixXd compact = (context -> layout).compress(params);
+    Eigen::VectorXd logPrior(compact.rows());
+    (context -> prior).logDensity(compact, 0, compact.rows(), logPrior);
+    for (int i = 0; i < compact.rows(); i++)
+    {
+        if (weights(i) > 0 && !std::isfinite(logPrior(i)))
+        {
+            Rcpp::Rcout << "  Param: \n" << params.row(i) << "\n";
+            Rcpp::stop("Not a valid parameter.");
+        }
+    }
+
+    contexts.push_back(context);
+    model_prior.push_back(prior);
+    particles.push_back(compact);
+    particle_weights.push_back(weights/weights.sum());
+    tau.push_back(Eigen::VectorXd::Ones(compact.cols()));
+    updateScales(contexts.size() - 1);
+    // The pool serves a fixed set of models
+    worker_pool.reset();
+}
+
+void modelChoiceSampler::updateScales(int k)
+{
+    const Eigen::MatrixXd& population = particles[k];
+    if (population.rows() < 2)
+    {
+        // Keep the previous scales
+        return;
+    }
+    tau[k] = 1.41421*(population.rowwise() -
+             (population.colwise()).mean()
+             ).colwise().norm()/std::sqrt((double)
+                 (population.rows())-1.0);
+    const int startIVC = (contexts[k] -> layout).nHead;
+    for (int i = 0; i < tau[k].size(); i++)
+    {
+        if (tau[k](i) == 0)
+        {
+            // Discrete initial values may well be constant
+            tau[k](i) = (i < startIVC ? 0.1 : 1.0);
+        }
+    }
+}
+
+void modelChoiceSampler::propose(int k, int n, Eigen::MatrixXd& out,
+                                 Eigen::VectorXd& logPrior)
+{
+    const Eigen::MatrixXd& population = particles[k];
+    const int p = population.cols();
+    out.resize(n, p);
+    logPrior.resize(n);
+    // A defensive share of the proposals comes straight from the prior
+    const int nPrior = std::binomial_distribution<int>(n,
+            MODEL_CHOICE_DEFENSIVE_SHARE)(*generator);
+    if (nPrior > 0)
+    {
+        Eigen::MatrixXd fromPrior(nPrior, p);
+        Eigen::VectorXd fromPriorDensity;
+        worker_pool -> samplePrior(fromPrior, (*generator)(), k);
+        worker_pool -> evaluatePrior(fromPrior, fromPriorDensity, k);
+        out.topRows(nPrior) = fromPrior;
+        logPrior.head(nPrior) = fromPriorDensity;
+    }
+    // Proposals outside the prior support are kept, unlike in the Beaumont
+    // sampler: drawing them again would truncate the kernel mixture by a
+    // share which differs between models, and which logProposalDensity
+    // does not know. The caller rejects them without simulation.
+    const int nKernel = n - nPrior;
+    if (nKernel > 0)
+    {
+        Eigen::MatrixXd candidates(nKernel, p);
+        Eigen::VectorXd candidatePrior;
+        for (int r = 0; r < nKernel; r++)
+        {
+            candidates.row(r) = population.row(drawIndex(particle_weights[k],
+                        generator));
+            for (int j = 0; j < p; j++)
+            {
+                candidates(r,j) += std::normal_distribution<double>(0.0,
+                        tau[k](j))(*generator);
+            }
+        }
+        worker_pool -> evaluatePrior(candidates, candidatePrior, k);
+        out.bottomRows(nKernel) = candidates;
+        logPrior.tail(nKernel) = candidatePrior;
+    }
+}
+
+double modelChoiceSampler::logProposalDensity(int k,
+                                              const Eigen::VectorXd& params,
+                                              double logPrior) const
+{
+    // The kernel densities are normalized: models of different dimension
+    // are compared through them.
+    const Eigen::MatrixXd& population = particles[k];
+    std::vector<double> terms;
+    for (int j = 0; j < population.rows(); j++)
+    {
+        if (particle_weights[k](j) > 0)
+        {
+            double lk = std::log(particle_weights[k](j));
+            for (int d = 0; d < params.size(); d++)
+            {
+                lk += R::dnorm(params(d), population(j, d), tau[k](d), 1);
+            }
+            terms.push_back(lk);
+        }
+    }
+    std::vector<double> mixture(2);
+    mixture[0] = std::log(1.0 - MODEL_CHOICE_DEFENSIVE_SHARE) + logSumExp(terms);
+    mixture[1] = std::log(MODEL_CHOICE_DEFENSIVE_SHARE) + logPrior;
+    return(logSumExp(mixture));
+}
+
+Rcpp::List modelChoiceSampler::sample(int nSample, double epsilon,
+                                      int generations, double shrinkage,
+                                      int verbose)
+{
+    const int K = contexts.size();
+    if (K == 0)
+    {
+        Rcpp::stop("No models to compare.\n");
+    }
+    if (nSample < 1 || generations < 1 || !(epsilon > 0) || !(shrinkage > 0))
+    {
+        Rcpp::stop("Sample size, generations, epsilon and shrinkage must be positive.\n");
+    }
+    const int batchSize = samplingControlInstance -> batch_size;
+    const int maxBatches = samplingControlInstance -> max_batches;
+    const bool screening = samplingControlInstance -> screening;
+    if (!worker_pool)
+    {
+        worker_pool = std::unique_ptr<NodePool>(
+                new NodePool(&batch_results,
+                             &batch_results_complete,
+                             &batch_result_idx,
+                             (unsigned int) samplingControlInstance -> CPU_cores,
+                             samplingControlInstance -> random_seed,
+                             contexts,
+                             samplingControlInstance -> backend,
+                             samplingControlInstance -> workerPlacement()));
+        worker_pool -> resolveMessages();
+    }
+    // Diagnostics cover this call only
+    worker_pool -> takeDiagnostics();
+    worker_pool -> setProgressInterval(verbose > 1 ? 2000 : 0);
+    // Every model draws replicate w from the same stream, so that their
+    // distances differ by the models rather than by the noise
+    worker_pool -> setCommonStreams(samplingControlInstance -> common_random_numbers,
+            samplingControlInstance -> common_random_numbers ? (*generator)() : 0);
+
+    Eigen::VectorXd logModelPrior(K);
+    Eigen::VectorXd modelProbs(K);
+    for (int k = 0; k < K; k++)
+    {
+        modelProbs(k) = model_prior[k];
+    }
+    modelProbs /= modelProbs.sum();
+    logModelPrior = modelProbs.array().log().matrix();
+
+    std::vector<double> epsilonHistory;
+    std::vector<Eigen::VectorXd> probHistory;
+    std::vector<Eigen::VectorXi> simHistory;
+    std::vector<Eigen::VectorXi> outsideHistory;
+    std::vector<Eigen::VectorXi> acceptHistory;
+
+    double eps = epsilon;
+    int generation;
+    bool terminate = false;
+    for (generation = 0; generation < generations && !terminate; generation++)
+    {
+        Rcpp::checkUserInterrupt();
+        if (generation > 0)
+        {
+            eps *= shrinkage;
+        }
+        if (verbose > 0)
+        {
+            Rcpp::Rcout << "Generation " << generation << ", eps: " << eps << "\n";
+        }
+        const Eigen::VectorXd startProposal = modelProbs;
+        Eigen::VectorXd modelProposal = startProposal;
+        Eigen::VectorXi simulations = Eigen::VectorXi::Zero(K);
+        Eigen::VectorXi outsideSupport = Eigen::VectorXi::Zero(K);
+
+        std::vector<int> acceptedModel;
+        std::vector<Eigen::VectorXd> acceptedParams;
+        std::vector<double> acceptedLogWeight;
+        // Running weight total of each model, on the log scale
+        std::vector<std::vector<double> > modelLogWeights(K);
+
+        worker_pool -> setAcceptanceThreshold(eps);
+        if (screening)
+        {
+            // Only result(0) < eps is ever looked at
+            worker_pool -> setScreeningThreshold(eps);
+        }
+        int nBatches = 0;
+        while ((int) acceptedModel.size() < nSample && nBatches < maxBatches)
+        {
+            Rcpp::checkUserInterrupt();
+            // Choose the model of each proposal, then propose parameters
+            // for each model as one block
+            Eigen::VectorXi batchCounts = Eigen::VectorXi::Zero(K);
+            std::vector<int> batchModel(batchSize);
+            for (int i = 0; i < batchSize; i++)
+            {
+                batchModel[i] = drawIndex(modelProposal, generator);
+                batchCounts(batchModel[i])++;
+            }
+            std::vector<Eigen::MatrixXd> blockParams(K);
+            std::vector<Eigen::VectorXd> blockPrior(K);
+            for (int k = 0; k < K; k++)
+            {
+                if (batchCounts(k) > 0)
+                {
+                    propose(k, batchCounts(k), blockParams[k], blockPrior[k]);
+                }
+            }
+
+            // Simulations of every model share the pool and one barrier.
+            // Proposals outside the prior support have zero weight, and are
+            // rejected without being simulated.
+            batch_results.resize(batchSize, samplingControlInstance -> m);
+            std::vector<int> blockRow(batchSize);
+            Eigen::VectorXi used = Eigen::VectorXi::Zero(K);
+            for (int i = 0; i < batchSize; i++)
+            {
+                const int k = batchModel[i];
+                blockRow[i] = used(k)++;
+                if (!std::isfinite(blockPrior[k](blockRow[i])))
+                {
+                    batch_results.row(i).fill(std::numeric_limits<double>::infinity());
+                    outsideSupport(k)++;
+                    continue;
+                }
+                worker_pool -> enqueue(sim_atom, i,
+                        blockParams[k].row(blockRow[i]), k);
+                simulations(k)++;
+            }
+            worker_pool -> awaitFinished();
+
+            for (int i = 0; i < batchSize && (int) acceptedModel.size() < nSample; i++)
+            {
+                if (batch_results(i, 0) < eps)
+                {
+                    const int k = batchModel[i];
+                    const Eigen::VectorXd params = blockParams[k].row(blockRow[i]).transpose();
+                    const double logWeight = logModelPrior(k) - std::log(modelProposal(k))
+                        + blockPrior[k](blockRow[i])
+                        - logProposalDensity(k, params, blockPrior[k](blockRow[i]));
+                    acceptedModel.push_back(k);
+                    acceptedParams.push_back(params);
+                    acceptedLogWeight.push_back(logWeight);
+                    modelLogWeights[k].push_back(logWeight);
+                }
+            }
+            nBatches++;
+
+            // Follow the running estimate of the model posterior
+            if (!acceptedModel.empty())
+            {
+                const double total = logSumExp(acceptedLogWeight);
+                for (int k = 0; k < K; k++)
+                {
+                    const double estimate = (modelLogWeights[k].empty() ? 0.0 :
+                            std::exp(logSumExp(modelLogWeights[k]) - total));
+                    modelProposal(k) = (1.0 - MODEL_CHOICE_DEFENSIVE_SHARE)*estimate
+                        + MODEL_CHOICE_DEFENSIVE_SHARE*startProposal(k);
+                }
+                modelProposal /= modelProposal.sum();
+            }
+            if (verbose > 1)
+            {
+                Rcpp::Rcout << "  batch " << nBatches << ", " << acceptedModel.size()
+                    << "/" << nSample << " accepted, model proposal: "
+                    << modelProposal.transpose() << "\n";
+            }
+        }
+        worker_pool -> setScreeningThreshold(std::numeric_limits<double>::infinity());
+
+        if (acceptedModel.empty())
+        {
+            if (generation == 0)
+            {
+                Rcpp::stop("No simulations were accepted; increase epsilon or the number of batches.\n");
+            }
+            if (verbose > 0)
+            {
+                Rcpp::Rcout << "No simulations accepted, returning the previous generation\n";
+            }
+            break;
+        }
+        if ((int) acceptedModel.size() < nSample)
+        {
+            if (verbose > 0)
+            {
+                Rcpp::Rcout << "Maximum batches exceeded: " << acceptedModel.size()
+                    << "/" << nSample << " acceptances in " << nBatches << " batches\n";
+            }
+            terminate = true;
+        }
+
+        // The accepted particles of each model become its population, and
+        // the shares of the total weight estimate the model posterior
+        const double total = logSumExp(acceptedLogWeight);
+        Eigen::VectorXi accepted = Eigen::VectorXi::Zero(K);
+        for (unsigned int i = 0; i < acceptedModel.size(); i++)
+        {
+            accepted(acceptedModel[i])++;
+        }
+        for (int k = 0; k < K; k++)
+        {
+            if (accepted(k) == 0)
+            {
+                modelProbs(k) = 0.0;
+                continue;
+            }
+            const double modelTotal = logSumExp(modelLogWeights[k]);
+            modelProbs(k) = std::exp(modelTotal - total);
+            particles[k].resize(accepted(k), particles[k].cols());
+            particle_weights[k].resize(accepted(k));
+            int row = 0;
+            for (unsigned int i = 0; i < acceptedModel.size(); i++)
+            {
+                if (acceptedModel[i] == k)
+                {
+                    particles[k].row(row) = acceptedParams[i].transpose();
+                    particle_weights[k](row) = std::exp(acceptedLogWeight[i] - modelTotal);
+                    row++;
+                }
+            }
+            updateScales(k);
+        }
+        modelProbs /= modelProbs.sum();
+        if (verbose > 0)
+        {
+            Rcpp::Rcout << "  " << simulations.sum() << " simulations, model probabilities: "
+                << modelProbs.transpose() << "\n";
+        }
+
+        epsilonHistory.push_back(eps);
+        probHistory.push_back(modelProbs);
+        simHistory.push_back(simulations);
+        outsideHistory.push_back(outsideSupport);
+        acceptHistory.push_back(accepted);
+    }
+
+    const int G = probHistory.size();
+    Eigen::MatrixXd probOut(G, K);
+    Eigen::MatrixXi simOut(G, K);
+    Eigen::MatrixXi outsideOut(G, K);
+    Eigen::MatrixXi acceptOut(G, K);
+    for (int g = 0; g < G; g++)
+    {
+        probOut.row(g) = probHistory[g].transpose();
+        simOut.row(g) = simHistory[g].transpose();
+        outsideOut.row(g) = outsideHistory[g].transpose();
+        acceptOut.row(g) = acceptHistory[g].transpose();
+    }
+    Rcpp::List params;
+    Rcpp::List weights;
+    for (int k = 0; k < K; k++)
+    {
+        params[std::to_string(k)] = Rcpp::wrap((contexts[k] -> layout).expand(particles[k]));
+        weights[std::to_string(k)] = Rcpp::wrap(particle_weights[k]);
+    }
+    Rcpp::List outList;
+    outList["modelProbabilities"] = Rcpp::wrap(probOut);
+    outList["epsilon"] = Rcpp::wrap(epsilonHistory);
+    outList["simulations"] = Rcpp::wrap(simOut);
+    outList["outsideSupport"] = Rcpp::wrap(outsideOut);
+    outList["accepted"] = Rcpp::wrap(acceptOut);
+    outList["params"] = params;
+    outList["weights"] = weights;
+    outList["completedGenerations"] = G;
+    SEIR_DIAGNOSTIC(outList["diagnostics"] = (worker_pool -> takeDiagnostics()).toList());
+    return(outList);
+}
+
+modelChoiceSampler::~modelChoiceSampler()
+{
+    delete generator;
+}
+
+RCPP_MODULE(mod_modelChoice)
+{
+    using namespace Rcpp;
+    class_<modelChoiceSampler>( "modelChoiceSampler" )
+    .constructor<samplingControl&>()
+    .method("addModel", &modelChoiceSampler::addModel)
+    .method("sample", &modelChoiceSampler::sample);
+}
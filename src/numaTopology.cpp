@@ -0,0 +1,157 @@
+#include <Rcpp.h>
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <numaTopology.hpp>
+
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#endif
+
+#ifdef __linux__
+/** CPUs of a sysfs cpulist such as "0-7,16-23" */
+static std::vector<int> parseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ','))
+    {
+        int first, last;
+        char dash;
+        std::stringstream parts(range);
+        if (!(parts >> first))
+        {
+            continue;
+        }
+        if (!(parts >> dash >> last))
+        {
+            last = first;
+        }
+        for (int cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return(cpus);
+}
+#endif
+
+const numaTopology& numaTopology::instance()
+{
+    static numaTopology topology;
+    return(topology);
+}
+
+numaTopology::numaTopology()
+{
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                process_cpus.push_back(cpu);
+            }
+        }
+    }
+    std::vector<int> node_ids;
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir != nullptr)
+    {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            int id;
+            char rest;
+            if (sscanf(entry -> d_name, "node%d%c", &id, &rest) == 1)
+            {
+                node_ids.push_back(id);
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(node_ids.begin(), node_ids.end());
+    for (unsigned int i = 0; i < node_ids.size(); i++)
+    {
+        std::ifstream file("/sys/devices/system/node/node" +
+                           std::to_string(node_ids[i]) + "/cpulist");
+        std::string list;
+        std::getline(file, list);
+        // Nodes without CPUs the process may use hold memory only
+        std::vector<int> cpus;
+        std::vector<int> listed = parseCpuList(list);
+        for (unsigned int j = 0; j < listed.size(); j++)
+        {
+            if (std::find(process_cpus.begin(), process_cpus.end(),
+                          listed[j]) != process_cpus.end())
+            {
+                cpus.push_back(listed[j]);
+            }
+        }
+        if (cpus.size() > 0)
+        {
+            node_cpus.push_back(cpus);
+        }
+    }
+#endif
+    if (node_cpus.size() == 0)
+    {
+        node_cpus.push_back(process_cpus);
+    }
+}
+
+int numaTopology::nodeCount() const
+{
+    return((int) node_cpus.size());
+}
+
+bool numaTopology::bindThread(int node) const
+{
+#ifdef __linux__
+    const std::vector<int>& cpus = (node < 0 ? process_cpus : node_cpus[node]);
+    if (cpus.size() == 0)
+    {
+        return(false);
+    }
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (unsigned int i = 0; i < cpus.size(); i++)
+    {
+        CPU_SET(cpus[i], &mask);
+    }
+    return(pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0);
+#else
+    return(false);
+#endif
+}
+
+void numaTopology::runOnNode(int node, const std::function<void()>& f) const
+{
+    std::exception_ptr error = nullptr;
+    std::thread thread([&](){
+            bindThread(node);
+            try
+            {
+                f();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+        });
+    thread.join();
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,92 @@
+#include <parameterLayout.hpp>
+
+parameterLayout::parameterLayout()
+{
+    nHead = 0;
+    nLoc = 0;
+    nFull = 0;
+    nFree = 0;
+    estimateIVC = false;
+}
+
+parameterLayout::parameterLayout(int nHead_,
+                                 const Eigen::VectorXi& S0_,
+                                 const Eigen::VectorXi& E0_,
+                                 const Eigen::VectorXi& I0_,
+                                 const Eigen::VectorXi& R0_,
+                                 bool estimateIVC_)
+{
+    nHead = nHead_;
+    nLoc = S0_.size();
+    estimateIVC = estimateIVC_;
+    nFull = nHead + 4*nLoc;
+    nFree = nHead + (estimateIVC ? 3*nLoc : 0);
+    S0 = S0_;
+    E0 = E0_;
+    I0 = I0_;
+    R0 = R0_;
+    N = (S0 + E0 + I0 + R0).cast<double>();
+}
+
+Eigen::MatrixXd parameterLayout::expand(const Eigen::MatrixXd& compact) const
+{
+    Eigen::MatrixXd full(compact.rows(), nFull);
+    full.leftCols(nHead) = compact.leftCols(nHead);
+    if (estimateIVC)
+    {
+        full.middleCols(nHead + nLoc, 3*nLoc) = compact.middleCols(nHead, 3*nLoc);
+        for (int j = 0; j < nLoc; j++)
+        {
+            // Computed as the samplers always have, before truncation
+            full.col(nHead + j) = N(j) - compact.col(nHead + j).array()
+                - compact.col(nHead + nLoc + j).array()
+                - compact.col(nHead + 2*nLoc + j).array();
+        }
+    }
+    else
+    {
+        for (int j = 0; j < nLoc; j++)
+        {
+            full.col(nHead + j).setConstant(S0(j));
+            full.col(nHead + nLoc + j).setConstant(E0(j));
+            full.col(nHead + 2*nLoc + j).setConstant(I0(j));
+            full.col(nHead + 3*nLoc + j).setConstant(R0(j));
+        }
+    }
+    return(full);
+}
+
+Eigen::MatrixXd parameterLayout::compress(const Eigen::MatrixXd& full) const
+{
+    Eigen::MatrixXd compact(full.rows(), nFree);
+    compact.leftCols(nHead) = full.leftCols(nHead);
+    if (estimateIVC)
+    {
+        compact.rightCols(3*nLoc) = full.middleCols(nHead + nLoc, 3*nLoc);
+    }
+    return(compact);
+}
+
+void parameterLayout::initialValues(const Eigen::Ref<const Eigen::VectorXd>& compact,
+                                    Eigen::VectorXi& S, Eigen::VectorXi& E,
+                                    Eigen::VectorXi& I, Eigen::VectorXi& R) const
+{
+    if (!estimateIVC)
+    {
+        S = S0;
+        E = E0;
+        I = I0;
+        R = R0;
+        return;
+    }
+    for (int j = 0; j < nLoc; j++)
+    {
+        const double e = compact(nHead + j);
+        const double i = compact(nHead + nLoc + j);
+        const double r = compact(nHead + 2*nLoc + j);
+        S(j) = (int) (N(j) - e - i - r);
+        E(j) = (int) e;
+        I(j) = (int) i;
+        R(j) = (int) r;
+    }
+}
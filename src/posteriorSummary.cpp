@@ -0,0 +1,214 @@
+#include <Rcpp.h>
+#include <cmath>
+#include <algorithm>
+#include <posteriorSummary.hpp>
+#include <spatialSEIRModel.hpp>
+
+posteriorSummary::posteriorSummary(int nTpt_, int nLoc_,
+                                   const std::vector<std::string>& compartments_,
+                                   const Eigen::VectorXd& probs_,
+                                   int shards)
+    : nTpt(nTpt_), nLoc(nLoc_), nCells(nTpt_*nLoc_),
+      compartments(compartments_), probs(probs_), next_shard(0)
+{
+    for (unsigned int k = 0; k < compartments.size(); k++)
+    {
+        const std::string& c = compartments[k];
+        if (c == "S") members.push_back(&simulationResultSet::S);
+        else if (c == "E") members.push_back(&simulationResultSet::E);
+        else if (c == "I") members.push_back(&simulationResultSet::I);
+        else if (c == "R") members.push_back(&simulationResultSet::R);
+        else if (c == "S_star") members.push_back(&simulationResultSet::S_star);
+        else if (c == "E_star") members.push_back(&simulationResultSet::E_star);
+        else if (c == "I_star") members.push_back(&simulationResultSet::I_star);
+        else if (c == "R_star") members.push_back(&simulationResultSet::R_star);
+        else
+        {
+            Rcpp::stop("Unknown compartment: " + c + "\n");
+        }
+    }
+    for (int j = 0; j < probs.size(); j++)
+    {
+        if (!(probs(j) > 0 && probs(j) < 1))
+        {
+            Rcpp::stop("Quantile probabilities must lie strictly between zero and one.\n");
+        }
+    }
+
+    shards = std::max(1, std::min(shards, nCells));
+    for (int s = 0; s <= shards; s++)
+    {
+        shard_start.push_back((int) (((long) nCells*s)/shards));
+    }
+    shard_count = std::vector<int>(shards, 0);
+    shard_mutex = std::unique_ptr<std::mutex[]>(new std::mutex[shards]);
+
+    const long nStat = (long) members.size()*nCells;
+    mean = std::vector<double>(nStat, 0.0);
+    m2 = std::vector<double>(nStat, 0.0);
+    heights = std::vector<double>(5*nStat*probs.size(), 0.0);
+    positions = std::vector<int>(5*nStat*probs.size(), 0);
+}
+
+void posteriorSummary::add(const simulationResultSet& result)
+{
+    std::vector<const Eigen::MatrixXi*> values;
+    for (unsigned int k = 0; k < members.size(); k++)
+    {
+        values.push_back(&(result.*members[k]));
+    }
+    // Start at a different shard for each simulation so that concurrent
+    // threads tend to hold different locks.
+    const int nShards = shard_count.size();
+    const int first = (int) (next_shard++ % nShards);
+    for (int i = 0; i < nShards; i++)
+    {
+        const int s = (first + i) % nShards;
+        std::lock_guard<std::mutex> lock(shard_mutex[s]);
+        addShard(s, values);
+    }
+}
+
+void posteriorSummary::addShard(int s, const std::vector<const Eigen::MatrixXi*>& values)
+{
+    const int n = ++shard_count[s];
+    const int nProbs = probs.size();
+    for (unsigned int k = 0; k < values.size(); k++)
+    {
+        // Compartments are column major nTpt by nLoc, as are the cells
+        const int* data = values[k] -> data();
+        for (int cell = shard_start[s]; cell < shard_start[s + 1]; cell++)
+        {
+            const long idx = (long) k*nCells + cell;
+            const double x = data[cell];
+            const double delta = x - mean[idx];
+            mean[idx] += delta/n;
+            m2[idx] += delta*(x - mean[idx]);
+            for (int j = 0; j < nProbs; j++)
+            {
+                const long marker = 5*(idx*nProbs + j);
+                updateMarkers(&heights[marker], &positions[marker], probs(j), n, x);
+            }
+        }
+    }
+}
+
+void posteriorSummary::updateMarkers(double* q, int* pos, double p,
+                                     int n, double x) const
+{
+    int i, k;
+    if (n <= 5)
+    {
+        // The first five observations are kept sorted
+        for (i = n - 1; i > 0 && q[i - 1] > x; i--)
+        {
+            q[i] = q[i - 1];
+        }
+        q[i] = x;
+        pos[n - 1] = n;
+        return;
+    }
+    if (x < q[0])
+    {
+        q[0] = x;
+        k = 0;
+    }
+    else if (x >= q[4])
+    {
+        q[4] = x;
+        k = 3;
+    }
+    else
+    {
+        for (k = 0; k < 3 && x >= q[k + 1]; k++) {}
+    }
+    for (i = k + 1; i < 5; i++)
+    {
+        pos[i]++;
+    }
+
+    const double increment[5] = {0.0, p/2, p, (1 + p)/2, 1.0};
+    for (i = 1; i < 4; i++)
+    {
+        const double d = 1.0 + (n - 1)*increment[i] - pos[i];
+        if ((d >= 1 && pos[i + 1] - pos[i] > 1) ||
+            (d <= -1 && pos[i - 1] - pos[i] < -1))
+        {
+            const int ds = (d > 0 ? 1 : -1);
+            // Piecewise parabolic prediction, falling back to linear
+            const double parabolic = q[i] + ((double) ds)/(pos[i + 1] - pos[i - 1])*(
+                (pos[i] - pos[i - 1] + ds)*(q[i + 1] - q[i])/(pos[i + 1] - pos[i]) +
+                (pos[i + 1] - pos[i] - ds)*(q[i] - q[i - 1])/(pos[i] - pos[i - 1]));
+            if (q[i - 1] < parabolic && parabolic < q[i + 1])
+            {
+                q[i] = parabolic;
+            }
+            else
+            {
+                q[i] += ds*(q[i + ds] - q[i])/(pos[i + ds] - pos[i]);
+            }
+            pos[i] += ds;
+        }
+    }
+}
+
+double posteriorSummary::estimate(const double* q, double p, int n) const
+{
+    if (n == 0)
+    {
+        return(NA_REAL);
+    }
+    if (n <= 5)
+    {
+        // Nearest rank of the sorted observations
+        return(q[std::min(n - 1, (int) std::floor(p*(n - 1) + 0.5))]);
+    }
+    return(q[2]);
+}
+
+int posteriorSummary::count() const
+{
+    return(shard_count.size() > 0 ? shard_count[0] : 0);
+}
+
+Rcpp::List posteriorSummary::toList() const
+{
+    const int nProbs = probs.size();
+    const int nShards = shard_count.size();
+    Rcpp::List out;
+    for (unsigned int k = 0; k < members.size(); k++)
+    {
+        Rcpp::NumericMatrix meanOut(nTpt, nLoc);
+        Rcpp::NumericMatrix varianceOut(nTpt, nLoc);
+        std::vector<Rcpp::NumericMatrix> quantileOut;
+        for (int j = 0; j < nProbs; j++)
+        {
+            quantileOut.push_back(Rcpp::NumericMatrix(nTpt, nLoc));
+        }
+        for (int s = 0; s < nShards; s++)
+        {
+            const int n = shard_count[s];
+            for (int cell = shard_start[s]; cell < shard_start[s + 1]; cell++)
+            {
+                const long idx = (long) k*nCells + cell;
+                meanOut[cell] = (n > 0 ? mean[idx] : NA_REAL);
+                varianceOut[cell] = (n > 1 ? m2[idx]/(n - 1) : NA_REAL);
+                for (int j = 0; j < nProbs; j++)
+                {
+                    quantileOut[j][cell] = estimate(&heights[5*(idx*nProbs + j)],
+                            probs(j), n);
+                }
+            }
+        }
+        Rcpp::List quantiles;
+        for (int j = 0; j < nProbs; j++)
+        {
+            quantiles.push_back(quantileOut[j]);
+        }
+        out[compartments[k]] = Rcpp::List::create(
+                Rcpp::Named("mean") = meanOut,
+                Rcpp::Named("variance") = varianceOut,
+                Rcpp::Named("quantiles") = quantiles);
+    }
+    return(out);
+}
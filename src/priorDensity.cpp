@@ -0,0 +1,301 @@
+#include <cmath>
+#include <limits>
+#include <priorDensity.hpp>
+#include <dataModel.hpp>
+#include <exposureModel.hpp>
+#include <reinfectionModel.hpp>
+#include <distanceModel.hpp>
+#include <transitionPriors.hpp>
+#include <initialValueContainer.hpp>
+
+static const double LOG_SQRT_2PI = 0.5*std::log(2.0*M_PI);
+
+/** a*log(x), taking 0*log(0) to be 0 */
+static inline double xlogy(double a, double x)
+{
+    return(a == 0.0 ? 0.0 : a*std::log(x));
+}
+
+/** a*log(1-x), taking 0*log(0) to be 0 */
+static inline double xlog1my(double a, double x)
+{
+    return(a == 0.0 ? 0.0 : a*std::log1p(-x));
+}
+
+static inline double logBetaKernel(double x, double a, double b)
+{
+    if (x < 0.0 || x > 1.0)
+    {
+        return(-std::numeric_limits<double>::infinity());
+    }
+    return(xlogy(a - 1.0, x) + xlog1my(b - 1.0, x));
+}
+
+static inline double logGammaKernel(double x, double shape, double rate,
+                                    bool strict)
+{
+    if (x < 0.0 || (strict && x <= 0.0))
+    {
+        return(-std::numeric_limits<double>::infinity());
+    }
+    return(xlogy(shape - 1.0, x) - rate*x);
+}
+
+priorDensity::priorDensity()
+{
+    nParams = 0;
+}
+
+priorDensity::priorDensity(dataModel* dataModel_,
+                           exposureModel* exposureModel_,
+                           reinfectionModel* reinfectionModel_,
+                           distanceModel* distanceModel_,
+                           transitionPriors* transitionPriors_,
+                           initialValueContainer* initialValueContainer_)
+{
+    const bool hasReinfection = (reinfectionModel_ -> betaPriorPrecision)(0) > 0;
+    const bool hasSpatial = (dataModel_ -> Y).cols() > 1;
+    const std::string& transitionMode = transitionPriors_ -> mode;
+    int i;
+
+    nBeta = (exposureModel_ -> X).cols();
+    nBetaRS = (reinfectionModel_ -> X_rs).cols()*hasReinfection;
+    nRho = ((distanceModel_ -> dm_list).size() +
+            (distanceModel_ -> tdm_list)[0].size())*hasSpatial;
+    transitionType = (transitionMode == "exponential" ? 0 :
+                     (transitionMode == "weibull" ? 1 : 2));
+    nTrans = (transitionType == 0 ? 2 : (transitionType == 1 ? 4 : 0));
+    nReport = (dataModel_ -> dataModelType == 2 ? 1 : 0);
+    nLoc = (initialValueContainer_ -> S0).size();
+    estimateIVC = (initialValueContainer_ -> type == 2);
+    nParams = nBeta + nBetaRS + nRho + nTrans + nReport + 3*nLoc*estimateIVC;
+
+    // Normal priors are parameterized by mean and 1/sd
+    beta_mean = (exposureModel_ -> betaPriorMean).array();
+    beta_sd = 1.0/(exposureModel_ -> betaPriorPrecision).array();
+    beta_const = -(beta_sd.log() + LOG_SQRT_2PI);
+    if (nBetaRS > 0)
+    {
+        rs_mean = (reinfectionModel_ -> betaPriorMean).array();
+        rs_sd = 1.0/(reinfectionModel_ -> betaPriorPrecision).array();
+        rs_const = -(rs_sd.log() + LOG_SQRT_2PI);
+    }
+
+    // The rho density is a beta, while draws come from a gamma restricted
+    // to sum to at most one.
+    rho_alpha = (distanceModel_ -> spatial_prior)(0);
+    rho_beta = (distanceModel_ -> spatial_prior)(1);
+    rho_const = std::lgamma(rho_alpha + rho_beta) - std::lgamma(rho_alpha)
+        - std::lgamma(rho_beta);
+
+    trans_shape = Eigen::ArrayXd(nTrans);
+    trans_rate = Eigen::ArrayXd(nTrans);
+    const Eigen::MatrixXd& EI = transitionPriors_ -> E_to_I_params;
+    const Eigen::MatrixXd& IR = transitionPriors_ -> I_to_R_params;
+    if (transitionType == 0)
+    {
+        trans_shape << EI(0,0), IR(0,0);
+        trans_rate << EI(1,0), IR(1,0);
+    }
+    else if (transitionType == 1)
+    {
+        trans_shape << EI(0,0), EI(2,0), IR(0,0), IR(2,0);
+        trans_rate << EI(1,0), EI(3,0), IR(1,0), IR(3,0);
+    }
+    trans_const = Eigen::ArrayXd(nTrans);
+    for (i = 0; i < nTrans; i++)
+    {
+        trans_const(i) = trans_shape(i)*std::log(trans_rate(i))
+            - std::lgamma(trans_shape(i));
+    }
+
+    rf_alpha = (nReport ? (dataModel_ -> report_fraction)*
+            (dataModel_ -> report_fraction_ess) : -1.0);
+    rf_beta = (nReport ? (1.0 - dataModel_ -> report_fraction)*
+            (dataModel_ -> report_fraction_ess) : -1.0);
+    rf_const = (nReport ? std::lgamma(rf_alpha + rf_beta) -
+            std::lgamma(rf_alpha) - std::lgamma(rf_beta) : 0.0);
+
+    S0 = (initialValueContainer_ -> S0).array();
+    E0 = (initialValueContainer_ -> E0).array();
+    I0 = (initialValueContainer_ -> I0).array();
+    R0 = (initialValueContainer_ -> R0).array();
+    N = S0 + E0 + I0 + R0;
+    S0_max = (initialValueContainer_ -> S0_max).array();
+    E0_max = (initialValueContainer_ -> E0_max).array();
+    I0_max = (initialValueContainer_ -> I0_max).array();
+    R0_max = (initialValueContainer_ -> R0_max).array();
+    fixedIVCValid = true;
+    for (i = 0; i < nLoc && !estimateIVC; i++)
+    {
+        fixedIVCValid = fixedIVCValid && validIVC(S0(i), E0(i), I0(i), R0(i), i);
+    }
+}
+
+bool priorDensity::validIVC(int S, int E, int I, int R, int loc) const
+{
+    return((S >= 0 && S <= S0_max(loc)) &&
+           (E >= 0 && E <= E0_max(loc)) &&
+           (I >= 0 && I <= I0_max(loc)) &&
+           (R >= 0 && R <= R0_max(loc)));
+}
+
+double priorDensity::logDensity(const Eigen::Ref<const Eigen::VectorXd>& params) const
+{
+    Eigen::MatrixXd row = params.transpose();
+    Eigen::VectorXd out(1);
+    logDensity(row, 0, 1, out);
+    return(out(0));
+}
+
+void priorDensity::logDensity(const Eigen::MatrixXd& params, int start,
+                              int count, Eigen::VectorXd& out) const
+{
+    const double negInf = -std::numeric_limits<double>::infinity();
+    Eigen::VectorXd::SegmentReturnType lp = out.segment(start, count);
+    lp.setZero();
+    int i, j;
+    int paramIdx = 0;
+    // Terms are added in parameter order, column by column
+    for (j = 0; j < nBeta; j++, paramIdx++)
+    {
+        lp.array() += beta_const(j) - 0.5*((params.col(paramIdx).segment(start,
+                        count).array() - beta_mean(j))/beta_sd(j)).square();
+    }
+    for (j = 0; j < nBetaRS; j++, paramIdx++)
+    {
+        lp.array() += rs_const(j) - 0.5*((params.col(paramIdx).segment(start,
+                        count).array() - rs_mean(j))/rs_sd(j)).square();
+    }
+    if (nRho > 0)
+    {
+        Eigen::ArrayXd rhoTot = Eigen::ArrayXd::Zero(count);
+        for (j = 0; j < nRho; j++, paramIdx++)
+        {
+            for (i = 0; i < count; i++)
+            {
+                const double x = params(start + i, paramIdx);
+                rhoTot(i) += x;
+                lp(i) += logBetaKernel(x, rho_alpha, rho_beta) + rho_const;
+            }
+        }
+        lp = (rhoTot > 1.0).select(negInf, lp.array()).matrix();
+    }
+    for (j = 0; j < nTrans; j++, paramIdx++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            lp(i) += logGammaKernel(params(start + i, paramIdx), trans_shape(j),
+                    trans_rate(j), transitionType == 1) + trans_const(j);
+        }
+    }
+    if (nReport)
+    {
+        for (i = 0; i < count; i++)
+        {
+            lp(i) += logBetaKernel(params(start + i, paramIdx), rf_alpha,
+                    rf_beta) + rf_const;
+        }
+        paramIdx++;
+    }
+    if (!estimateIVC)
+    {
+        if (!fixedIVCValid)
+        {
+            lp.setConstant(negInf);
+        }
+        return;
+    }
+    // S0 is implied by the population size, as in parameterLayout
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < nLoc; j++)
+        {
+            const double E = params(start + i, paramIdx + j);
+            const double I = params(start + i, paramIdx + j + nLoc);
+            const double R = params(start + i, paramIdx + j + 2*nLoc);
+            if (!validIVC((int) (N(j) - E - I - R), (int) E, (int) I, (int) R, j))
+            {
+                lp(i) = negInf;
+            }
+        }
+    }
+}
+
+int priorDensity::sample(Eigen::MatrixXd& params, int start, int count,
+                         std::mt19937* generator) const
+{
+    std::normal_distribution<double> standardNormal(0,1);
+    std::gamma_distribution<double> rhoDist(rho_alpha, 1.0/rho_beta);
+    int i, j;
+    int paramIdx = 0;
+    int failures = 0;
+    for (j = 0; j < nBeta; j++, paramIdx++)
+    {
+        for (i = start; i < start + count; i++)
+        {
+            params(i, paramIdx) = beta_mean(j) + standardNormal(*generator)*beta_sd(j);
+        }
+    }
+    for (j = 0; j < nBetaRS; j++, paramIdx++)
+    {
+        for (i = start; i < start + count; i++)
+        {
+            params(i, paramIdx) = rs_mean(j) + standardNormal(*generator)*rs_sd(j);
+        }
+    }
+    if (nRho > 0)
+    {
+        for (i = start; i < start + count; i++)
+        {
+            double rhoTot = 2.0;
+            int rhoItrs = 0;
+            while (rhoTot > 1.0 && rhoItrs < 100)
+            {
+                rhoTot = 0.0;
+                for (j = 0; j < nRho; j++)
+                {
+                   params(i, paramIdx + j) = rhoDist(*generator);
+                   rhoTot += params(i, paramIdx + j);
+                }
+                rhoItrs++;
+            }
+            failures += (rhoTot > 1.0);
+        }
+        paramIdx += nRho;
+    }
+    for (j = 0; j < nTrans; j++, paramIdx++)
+    {
+        std::gamma_distribution<double> transDist(trans_shape(j),
+                1.0/trans_rate(j));
+        for (i = start; i < start + count; i++)
+        {
+            params(i, paramIdx) = transDist(*generator);
+        }
+    }
+    if (nReport)
+    {
+        std::gamma_distribution<double> rfAlphaDist(rf_alpha, 1.0);
+        std::gamma_distribution<double> rfBetaDist(rf_beta, 1.0);
+        for (i = start; i < start + count; i++)
+        {
+            double x = rfAlphaDist(*generator);
+            double y = rfBetaDist(*generator);
+            params(i, paramIdx) = x/(x+y);
+        }
+        paramIdx++;
+    }
+    for (i = start; i < start + count && estimateIVC; i++)
+    {
+        for (j = 0; j < nLoc; j++)
+        {
+            params(i, paramIdx + j) = std::uniform_int_distribution<int>(
+                    0, E0_max(j))(*generator);
+            params(i, paramIdx + j + nLoc) = std::uniform_int_distribution<int>(
+                    0, I0_max(j))(*generator);
+            params(i, paramIdx + j + 2*nLoc) = std::uniform_int_distribution<int>(
+                    0, R0_max(j))(*generator);
+        }
+    }
+    return(failures);
+}
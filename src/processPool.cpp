@@ -0,0 +1,646 @@
+#include <Rcpp.h>
+#include <cmath>
+#include <limits>
+#include <atomic>
+#include <new>
+#include <cerrno>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <processPool.hpp>
+#include <SEIRSimNodes.hpp>
+#include <spatialSEIRModel.hpp>
+#include <workerHost.hpp>
+#include <fastRandom.hpp>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+// Slot life cycle: the parent fills a free slot and marks it ready, a worker
+// claims it by swapping in SLOT_RUNNING + its worker id, and hands it back as
+// done. Only the parent frees slots.
+#define SLOT_FREE 0
+#define SLOT_READY 1
+#define SLOT_DONE 2
+#define SLOT_RUNNING 3
+
+// Times a particle is simulated before the exits of the workers holding it
+// are blamed on the particle, and standby processes kept to replace workers
+// which exit
+#define SPATIALSEIR_PROCESS_ATTEMPTS 2
+#define SPATIALSEIR_PROCESS_STANDBY 3
+// First stream of the restart seeds, clear of the common streams
+#define SPATIALSEIR_RESTART_STREAM 0x80000000u
+
+struct processRingHeader
+{
+    std::atomic<int> shutdown;
+};
+
+/** Set to the id of the worker a standby process replaces */
+struct processStandby
+{
+    std::atomic<int> worker_id;
+};
+
+struct processRingSlot
+{
+    std::atomic<int> state;
+    int param_idx;
+    int attempts;
+    int status;
+    int skipped;
+    int common_streams;
+    unsigned int common_seed;
+    double threshold;
+};
+
+static size_t alignTo(size_t sz, size_t alignment)
+{
+    return(((sz + alignment - 1)/alignment)*alignment);
+}
+
+bool ProcessPool::available()
+{
+#ifdef _WIN32
+    return(false);
+#else
+    return(ATOMIC_INT_LOCK_FREE == 2);
+#endif
+}
+
+processStandby* ProcessPool::standby(int idx)
+{
+    return(reinterpret_cast<processStandby*>(mapping +
+                alignTo(sizeof(processRingHeader), 64)) + idx);
+}
+
+processRingSlot* ProcessPool::slot(int idx)
+{
+    return(reinterpret_cast<processRingSlot*>(mapping + slots_offset +
+                idx*slot_stride));
+}
+
+int ProcessPool::restartSeed(int idx)
+{
+    streamEngine engine;
+    engine.seed((unsigned int) base_seed, SPATIALSEIR_RESTART_STREAM + idx);
+    long long seed = (long long) (engine() >> 33);
+    // Stay off the seeds base_seed + 1000*k of the first workers
+    if ((seed - base_seed) % 1000 == 0)
+    {
+        seed++;
+    }
+    return((int) seed);
+}
+
+double* ProcessPool::slotParams(int idx)
+{
+    return(reinterpret_cast<double*>(reinterpret_cast<char*>(slot(idx)) +
+                alignTo(sizeof(processRingSlot), sizeof(double))));
+}
+
+double* ProcessPool::slotResult(int idx)
+{
+    return(slotParams(idx) + nParams);
+}
+
+#ifndef _WIN32
+
+ProcessPool::ProcessPool(int processes,
+                         int random_seed,
+                         std::shared_ptr<const simulationContext> ctx)
+    : context(ctx), nextStandby(0), base_seed(random_seed),
+      header(nullptr), mapping(nullptr), mapping_size(0),
+      nParams(ctx -> nParams), m(ctx -> m), inFlight(0), screened(0),
+      skippedSteps(0), common_streams(false), common_seed(0)
+{
+    int i;
+    // A few slots per worker keep everyone busy while the parent is
+    // collecting results.
+    nSlots = 4*(processes > 1 ? processes : 1);
+    slot_stride = alignTo(alignTo(sizeof(processRingSlot), sizeof(double)) +
+                          (nParams + m)*sizeof(double), 64);
+    slots_offset = alignTo(alignTo(sizeof(processRingHeader), 64) +
+                           SPATIALSEIR_PROCESS_STANDBY*sizeof(processStandby), 64);
+    mapping_size = slots_offset + nSlots*slot_stride;
+
+    void* mem = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        Rcpp::stop("Unable to allocate shared memory for worker processes.\n");
+    }
+    mapping = static_cast<char*>(mem);
+    header = new (mapping) processRingHeader();
+    header -> shutdown.store(0);
+    for (i = 0; i < SPATIALSEIR_PROCESS_STANDBY; i++)
+    {
+        processStandby* sb = new (standby(i)) processStandby();
+        sb -> worker_id.store(-1);
+    }
+    for (i = 0; i < nSlots; i++)
+    {
+        processRingSlot* s = new (slot(i)) processRingSlot();
+        s -> state.store(SLOT_FREE);
+        s -> param_idx = -1;
+        s -> attempts = 0;
+        s -> status = 0;
+        s -> skipped = 0;
+        s -> common_streams = 0;
+        s -> common_seed = 0;
+    }
+
+    // No thread but this one may hold a lock a child inherits. Every
+    // process of the pool is forked now, so that replacing a worker later
+    // never disturbs the threads other models are using.
+    workerHost& host = workerHost::instance();
+    if (host.threadCount() > 0)
+    {
+        host.shutdown();
+    }
+    for (i = 0; i < processes; i++)
+    {
+        if (!spawnWorker(i))
+        {
+            break;
+        }
+    }
+    if (pids.size() == 0)
+    {
+        munmap(mapping, mapping_size);
+        Rcpp::stop("Unable to start simulation worker processes.\n");
+    }
+    for (i = 0; i < SPATIALSEIR_PROCESS_STANDBY; i++)
+    {
+        if (!spawnStandby(i))
+        {
+            break;
+        }
+    }
+}
+
+// The children never return to R: R's handlers would try to interact with
+// the session, and an interrupt at the console is the parent's to handle.
+static void detachFromSession()
+{
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGBUS, SIG_DFL);
+    signal(SIGILL, SIG_DFL);
+    signal(SIGFPE, SIG_DFL);
+    signal(SIGABRT, SIG_DFL);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, SIG_IGN);
+}
+
+bool ProcessPool::spawnWorker(int worker_id)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        detachFromSession();
+        workerMain(worker_id, base_seed + 1000*(worker_id + 1));
+        _exit(0);
+    }
+    else if (pid < 0)
+    {
+        return(false);
+    }
+    pids.push_back((int) pid);
+    alive.push_back(true);
+    return(true);
+}
+
+bool ProcessPool::spawnStandby(int idx)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        detachFromSession();
+        standbyMain(idx);
+        _exit(0);
+    }
+    else if (pid < 0)
+    {
+        return(false);
+    }
+    standby_pids.push_back((int) pid);
+    return(true);
+}
+
+void ProcessPool::standbyMain(int idx)
+{
+    const pid_t parent_pid = getppid();
+    processStandby* sb = standby(idx);
+    while (header -> shutdown.load(std::memory_order_acquire) == 0)
+    {
+        const int worker_id = sb -> worker_id.load(std::memory_order_acquire);
+        if (worker_id >= 0)
+        {
+            workerMain(worker_id, restartSeed(idx));
+            return;
+        }
+        if (getppid() != parent_pid)
+        {
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void ProcessPool::workerMain(int worker_id, int random_seed)
+{
+    const pid_t parent_pid = getppid();
+    std::unique_ptr<SEIR_sim_node> node;
+    try
+    {
+        node = std::unique_ptr<SEIR_sim_node>(new SEIR_sim_node(nullptr,
+                    random_seed, context));
+    }
+    catch (...)
+    {
+        _exit(1);
+    }
+
+    Eigen::VectorXd params(nParams);
+    Eigen::VectorXd result(m);
+    int idle_us = 10;
+    int i, j, s;
+    while (header -> shutdown.load(std::memory_order_acquire) == 0)
+    {
+        bool claimed = false;
+        for (j = 0; j < nSlots; j++)
+        {
+            s = (j + worker_id) % nSlots;
+            processRingSlot* sl = slot(s);
+            int expected = SLOT_READY;
+            if (!(sl -> state).compare_exchange_strong(expected,
+                        SLOT_RUNNING + worker_id, std::memory_order_acq_rel))
+            {
+                continue;
+            }
+            claimed = true;
+            const double* p = slotParams(s);
+            for (i = 0; i < nParams; i++)
+            {
+                params(i) = p[i];
+            }
+            node -> setCommonStreams(sl -> common_streams != 0,
+                                     sl -> common_seed);
+            try
+            {
+                simulationResultSet sim = node -> simulate(params, false,
+                        sl -> threshold);
+                result = sim.result;
+                sl -> skipped = sim.stepsSkipped;
+                sl -> status = 0;
+            }
+            catch (...)
+            {
+                result = Eigen::VectorXd::Constant(m,
+                        std::numeric_limits<double>::infinity());
+                sl -> skipped = 0;
+                sl -> status = 1;
+            }
+            double* r = slotResult(s);
+            for (i = 0; i < m; i++)
+            {
+                r[i] = result(i);
+            }
+            (sl -> state).store(SLOT_DONE, std::memory_order_release);
+        }
+        if (claimed)
+        {
+            idle_us = 10;
+        }
+        else
+        {
+            if (getppid() != parent_pid)
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(idle_us));
+            idle_us = (idle_us < 1000 ? 2*idle_us : 1000);
+        }
+    }
+}
+
+void ProcessPool::enqueue(int param_idx, const Eigen::VectorXd& params,
+                          double threshold)
+{
+    processTask task;
+    task.param_idx = param_idx;
+    task.attempts = 0;
+    task.threshold = threshold;
+    task.common_streams = common_streams;
+    task.common_seed = common_seed;
+    task.params = params;
+    pending.push_back(task);
+}
+
+void ProcessPool::setCommonStreams(bool enabled, unsigned int seed)
+{
+    common_streams = enabled;
+    common_seed = seed;
+}
+
+void ProcessPool::takeScreeningStats(int* scr, long* skipped_steps)
+{
+    *scr = screened;
+    *skipped_steps = skippedSteps;
+    screened = 0;
+    skippedSteps = 0;
+}
+
+void ProcessPool::cancelPending()
+{
+    pending.clear();
+}
+
+void ProcessPool::reapWorkers(std::vector<std::pair<int, Eigen::VectorXd> >& completed,
+                              std::deque<std::string>& messages)
+{
+    int status, s;
+    pid_t ret;
+    // Standby processes left for workers which exit from now on
+    int spare = (int) standby_pids.size() - nextStandby;
+    for (unsigned int w = 0; w < pids.size(); w++)
+    {
+        spare -= (alive[w] ? 0 : 1);
+    }
+    for (unsigned int w = 0; w < pids.size(); w++)
+    {
+        if (!alive[w])
+        {
+            continue;
+        }
+        status = 0;
+        ret = waitpid((pid_t) pids[w], &status, WNOHANG);
+        if (ret == 0 || (ret < 0 && errno == EINTR))
+        {
+            continue;
+        }
+        if (ret < 0 && errno != ECHILD)
+        {
+            // The worker can no longer be watched, so its slots could never
+            // be reclaimed; make sure it is gone.
+            kill((pid_t) pids[w], SIGKILL);
+            waitpid((pid_t) pids[w], &status, 0);
+        }
+        alive[w] = false;
+        std::stringstream msg;
+        msg << "Simulation worker process " << w << " exited unexpectedly";
+        if (ret == pids[w] && WIFSIGNALED(status))
+        {
+            msg << " (signal " << WTERMSIG(status) << ")";
+        }
+        msg << ".";
+        // Anything it had claimed will never be finished by it
+        for (s = 0; s < nSlots; s++)
+        {
+            processRingSlot* sl = slot(s);
+            if ((sl -> state).load(std::memory_order_acquire) != SLOT_RUNNING + (int) w)
+            {
+                continue;
+            }
+            if (sl -> attempts + 1 < SPATIALSEIR_PROCESS_ATTEMPTS)
+            {
+                processTask task;
+                task.param_idx = sl -> param_idx;
+                task.attempts = sl -> attempts + 1;
+                task.threshold = sl -> threshold;
+                task.common_streams = (sl -> common_streams != 0);
+                task.common_seed = sl -> common_seed;
+                task.params = Eigen::Map<Eigen::VectorXd>(slotParams(s), nParams);
+                pending.push_front(task);
+                msg << " Particle " << sl -> param_idx << " was queued again.";
+            }
+            else
+            {
+                completed.push_back(std::pair<int, Eigen::VectorXd>(sl -> param_idx,
+                    Eigen::VectorXd::Constant(m, std::numeric_limits<double>::infinity())));
+                msg << " Particle " << sl -> param_idx << " was rejected.";
+            }
+            (sl -> state).store(SLOT_FREE, std::memory_order_release);
+            inFlight--;
+        }
+        if (spare-- > 0)
+        {
+            msg << " It will be started again.";
+        }
+        messages.push_back(msg.str());
+    }
+}
+
+void ProcessPool::restartWorkers()
+{
+    int status;
+    for (unsigned int w = 0; w < pids.size(); w++)
+    {
+        while (!alive[w] && nextStandby < (int) standby_pids.size())
+        {
+            const int idx = nextStandby++;
+            // A standby which has itself exited is passed over
+            if (waitpid((pid_t) standby_pids[idx], &status, WNOHANG) != 0)
+            {
+                continue;
+            }
+            standby(idx) -> worker_id.store((int) w, std::memory_order_release);
+            pids[w] = standby_pids[idx];
+            alive[w] = true;
+        }
+    }
+}
+
+int ProcessPool::poll(std::vector<std::pair<int, Eigen::VectorXd> >& completed,
+                      std::deque<std::string>& messages)
+{
+    int i, s;
+    for (s = 0; s < nSlots; s++)
+    {
+        processRingSlot* sl = slot(s);
+        if ((sl -> state).load(std::memory_order_acquire) != SLOT_DONE)
+        {
+            continue;
+        }
+        Eigen::VectorXd result(m);
+        const double* r = slotResult(s);
+        for (i = 0; i < m; i++)
+        {
+            result(i) = r[i];
+        }
+        if (sl -> status != 0)
+        {
+            messages.push_back("Simulation of particle " +
+                    std::to_string(sl -> param_idx) +
+                    " failed in a worker process and was rejected.");
+        }
+        if (sl -> skipped > 0)
+        {
+            screened++;
+            skippedSteps += sl -> skipped;
+        }
+        completed.push_back(std::pair<int, Eigen::VectorXd>(sl -> param_idx, result));
+        (sl -> state).store(SLOT_FREE, std::memory_order_release);
+        inFlight--;
+    }
+
+    reapWorkers(completed, messages);
+    bool anyAlive = (nextStandby < (int) standby_pids.size());
+    for (unsigned int w = 0; w < alive.size(); w++)
+    {
+        anyAlive = anyAlive || alive[w];
+    }
+    if (!anyAlive && (inFlight > 0 || !pending.empty()))
+    {
+        Rcpp::stop("All simulation worker processes have exited; consider the 'threads' backend.\n");
+    }
+
+    for (s = 0; s < nSlots && !pending.empty(); s++)
+    {
+        processRingSlot* sl = slot(s);
+        if ((sl -> state).load(std::memory_order_acquire) != SLOT_FREE)
+        {
+            continue;
+        }
+        const Eigen::VectorXd& params = pending.front().params;
+        double* p = slotParams(s);
+        for (i = 0; i < nParams; i++)
+        {
+            p[i] = params(i);
+        }
+        sl -> param_idx = pending.front().param_idx;
+        sl -> attempts = pending.front().attempts;
+        sl -> threshold = pending.front().threshold;
+        sl -> common_streams = pending.front().common_streams;
+        sl -> common_seed = pending.front().common_seed;
+        sl -> status = 0;
+        sl -> skipped = 0;
+        (sl -> state).store(SLOT_READY, std::memory_order_release);
+        pending.pop_front();
+        inFlight++;
+    }
+    return(inFlight + (int) pending.size());
+}
+
+void ProcessPool::shutdown()
+{
+    int status;
+    header -> shutdown.store(1, std::memory_order_release);
+    for (unsigned int w = 0; w < pids.size(); w++)
+    {
+        if (!alive[w])
+        {
+            continue;
+        }
+        // Workers notice the flag within a millisecond unless they are in
+        // the middle of a simulation; give them a while before insisting.
+        int waited_ms = 0;
+        while (waitpid((pid_t) pids[w], &status, WNOHANG) == 0 && waited_ms < 5000)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            waited_ms++;
+        }
+        if (waited_ms >= 5000)
+        {
+            kill((pid_t) pids[w], SIGKILL);
+            waitpid((pid_t) pids[w], &status, 0);
+        }
+        alive[w] = false;
+    }
+    // Standbys which were never needed notice the flag within a millisecond
+    for (int idx = nextStandby; idx < (int) standby_pids.size(); idx++)
+    {
+        while (waitpid((pid_t) standby_pids[idx], &status, 0) < 0 &&
+               errno == EINTR)
+        {
+        }
+    }
+    nextStandby = (int) standby_pids.size();
+}
+
+ProcessPool::~ProcessPool()
+{
+    shutdown();
+    munmap(mapping, mapping_size);
+}
+
+#else
+
+ProcessPool::ProcessPool(int processes,
+                         int random_seed,
+                         std::shared_ptr<const simulationContext> ctx)
+    : context(ctx), nextStandby(0), base_seed(random_seed),
+      header(nullptr), mapping(nullptr), mapping_size(0),
+      nParams(ctx -> nParams), m(ctx -> m), inFlight(0), screened(0),
+      skippedSteps(0), common_streams(false), common_seed(0)
+{
+    Rcpp::stop("The process backend is not available on this platform.\n");
+}
+
+bool ProcessPool::spawnWorker(int worker_id)
+{
+    return(false);
+}
+
+bool ProcessPool::spawnStandby(int idx)
+{
+    return(false);
+}
+
+void ProcessPool::workerMain(int worker_id, int random_seed)
+{
+}
+
+void ProcessPool::standbyMain(int idx)
+{
+}
+
+void ProcessPool::enqueue(int param_idx, const Eigen::VectorXd& params,
+                          double threshold)
+{
+}
+
+void ProcessPool::setCommonStreams(bool enabled, unsigned int seed)
+{
+}
+
+void ProcessPool::takeScreeningStats(int* scr, long* skipped_steps)
+{
+    *scr = 0;
+    *skipped_steps = 0;
+}
+
+void ProcessPool::reapWorkers(std::vector<std::pair<int, Eigen::VectorXd> >& completed,
+                              std::deque<std::string>& messages)
+{
+}
+
+void ProcessPool::restartWorkers()
+{
+}
+
+int ProcessPool::poll(std::vector<std::pair<int, Eigen::VectorXd> >& completed,
+                      std::deque<std::string>& messages)
+{
+    return(0);
+}
+
+void ProcessPool::cancelPending()
+{
+}
+
+void ProcessPool::shutdown()
+{
+}
+
+ProcessPool::~ProcessPool()
+{
+}
+
+#endif
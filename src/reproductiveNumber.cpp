@@ -0,0 +1,191 @@
+#include <cmath>
+#include <algorithm>
+#include <reproductiveNumber.hpp>
+
+// Power iteration stops once successive estimates agree to this relative
+// tolerance, or after the maximum number of products.
+#define R0_POWER_TOLERANCE 1e-10
+#define R0_POWER_MAX_ITERATIONS 1000
+
+reproductiveNumber::reproductiveNumber(const simulationContext& ctx)
+    : context(ctx)
+{
+    has_spatial = (ctx.observed -> Y.cols() > 1);
+    has_ts_spatial = (ctx.TDM_index.size() > 0 && ctx.TDM_index[0].size() > 0);
+    nBeta = ctx.nBeta;
+    nReinf = (ctx.reinfection_precision(0) > 0 ? ctx.X_rs.cols() : 0);
+    nRho = (has_spatial && has_ts_spatial ? ctx.DM_vec.size() + ctx.TDM_index[0].size() :
+           (has_spatial ? ctx.DM_vec.size() : 0));
+}
+
+Eigen::VectorXd reproductiveNumber::infectiousSurvival(const Eigen::VectorXd& params) const
+{
+    const int nTpt = context.observed -> Y.rows();
+    const int transition = nBeta + nReinf + nRho;
+    // Remaining infectious k steps on contributes through time t + k,
+    // clamped to the last time point, so later terms are folded into
+    // the last weight.
+    Eigen::VectorXd weights = Eigen::VectorXd::Zero(nTpt);
+    if (context.transitionMode == "exponential")
+    {
+        const double p_ir = 1.0 - std::exp(-params(transition + 1));
+        double survival = 1.0;
+        int k = 0;
+        weights(0) = 1.0;
+        while (survival > 1e-8 && k < nTpt - 1)
+        {
+            survival *= (1.0 - p_ir);
+            k++;
+            weights(k) += survival;
+        }
+        if (survival > 1e-8)
+        {
+            // Geometric tail, all at the last time point
+            weights(nTpt - 1) += survival*(1.0 - p_ir)/p_ir;
+        }
+    }
+    else
+    {
+        const double shape = params(transition + 2);
+        const double scale = params(transition + 3);
+        // Steps until all but 1e-4 of the infectious period has elapsed
+        const int n = (int) std::ceil(scale*std::pow(-std::log(1e-4), 1.0/shape));
+        double survival = 1.0;
+        weights(0) = 1.0;
+        for (int k = 0; k < n && survival > 1e-8; k++)
+        {
+            survival *= std::exp(std::pow(k/scale, shape)
+                                 - std::pow((k + 1)/scale, shape));
+            weights(std::min(k + 1, nTpt - 1)) += survival;
+        }
+    }
+    return(weights);
+}
+
+double reproductiveNumber::spectralRadius(int t, double duration,
+                                          const Eigen::VectorXd& rho,
+                                          const Eigen::VectorXd& susceptible,
+                                          const Eigen::VectorXd& transmissibility,
+                                          Eigen::VectorXd& x) const
+{
+    const int nDM = context.DM_vec.size();
+    const double scale = duration*context.offset(t);
+    Eigen::VectorXd u(x.size());
+    Eigen::VectorXd y(x.size());
+    double lambda = 0.0;
+    double previous = -1.0;
+    for (int iteration = 0; iteration < R0_POWER_MAX_ITERATIONS; iteration++)
+    {
+        u = transmissibility.cwiseProduct(x);
+        y = u;
+        if (has_spatial)
+        {
+            for (int k = 0; k < nDM; k++)
+            {
+                context.DM_vec[k].multiplyAdd(rho(k), u, y);
+            }
+        }
+        if (has_ts_spatial)
+        {
+            for (int lag = 0; lag < (int) context.TDM_index[t].size(); lag++)
+            {
+                context.TDM_store.get(context.TDM_index[t][lag]).multiplyAdd(
+                        rho(nDM + lag), u, y);
+            }
+        }
+        y = scale*susceptible.cwiseProduct(y);
+        // x sums to one
+        lambda = y.sum();
+        // Iterating with K + I rather than K converges even when the
+        // contact structure is periodic; x still sums to one.
+        x = (y + x)/(lambda + 1.0);
+        if (std::abs(lambda - previous) <= R0_POWER_TOLERANCE*std::max(1.0, lambda))
+        {
+            break;
+        }
+        previous = lambda;
+    }
+    return(lambda);
+}
+
+void reproductiveNumber::compute(const reproductiveNumberBatch& batch, int i) const
+{
+    const int nTpt = context.observed -> Y.rows();
+    const int nLoc = context.observed -> Y.cols();
+    const int nDM = context.DM_vec.size();
+    const Eigen::VectorXd params = batch.params -> row(i).transpose();
+    const Eigen::VectorXd beta = params.segment(0, nBeta);
+    const Eigen::VectorXd rho = (has_spatial ?
+            Eigen::VectorXd(params.segment(nBeta + nReinf, nRho)) : Eigen::VectorXd());
+    const Eigen::VectorXd N = batch.N -> row(i).transpose();
+
+    // Equivalent R expression:
+    // exp(matrix(X %*% beta, nrow = nrow(Y), ncol = ncol(Y)))
+    Eigen::VectorXd eta = (context.single_precision ?
+            Eigen::VectorXd(context.X_single.cast<double>()*beta) :
+            Eigen::VectorXd(context.X*beta)).array().exp().matrix();
+    Eigen::Map<Eigen::MatrixXd> components(eta.data(), nTpt, nLoc);
+
+    Eigen::MatrixXd S = batch.S -> middleRows(i*nTpt, nTpt).cast<double>();
+    Eigen::MatrixXd I = batch.I -> middleRows(i*nTpt, nTpt).cast<double>();
+
+    const Eigen::VectorXd weights = infectiousSurvival(params);
+    const double duration = weights.sum();
+
+    Eigen::MatrixXd instantaneous(nTpt, nLoc);
+    Eigen::VectorXd transmissibility(nLoc);
+    Eigen::VectorXd pressure(nLoc);
+    Eigen::VectorXd expected(nLoc);
+    Eigen::VectorXd eigenvector = Eigen::VectorXd::Constant(nLoc, 1.0/nLoc);
+    int a, t, k;
+    for (t = 0; t < nTpt; t++)
+    {
+        for (a = 0; a < nLoc; a++)
+        {
+            transmissibility(a) = (N(a) > 0 ? components(t, a)/N(a) : 0.0);
+            pressure(a) = I(t, a)*transmissibility(a);
+            // Infections within the location
+            expected(a) = S(t, a)*(1.0 - std::exp(-context.offset(t)*pressure(a)));
+        }
+        const Eigen::VectorXd susceptible = S.row(t).transpose();
+        if (has_spatial)
+        {
+            for (k = 0; k < nDM; k++)
+            {
+                context.DM_vec[k].expectedExposures(rho(k)*context.offset(t),
+                        pressure, susceptible, expected);
+            }
+        }
+        if (has_ts_spatial)
+        {
+            // Lagged contacts expose the susceptibles of later time points
+            for (int lag = 0; lag < (int) context.TDM_index[t].size(); lag++)
+            {
+                const int later = std::min(t + lag + 1, nTpt - 1);
+                context.TDM_store.get(context.TDM_index[t][lag]).expectedExposures(
+                        rho(nDM + lag)*context.offset(later), pressure,
+                        S.row(later).transpose(), expected);
+            }
+        }
+        for (a = 0; a < nLoc; a++)
+        {
+            instantaneous(t, a) = (I(t, a) == 0 ? 0.0 : expected(a)/I(t, a));
+        }
+        (*(batch.R_NGM))(t, i) = spectralRadius(t, duration, rho, susceptible,
+                transmissibility, eigenvector);
+    }
+
+    // Accumulate over the infectious period
+    Eigen::Ref<Eigen::MatrixXd> R_EA = batch.R_EA -> middleRows(i*nTpt, nTpt);
+    R_EA.setZero();
+    for (t = 0; t < nTpt; t++)
+    {
+        for (k = 0; k < nTpt; k++)
+        {
+            if (weights(k) != 0)
+            {
+                R_EA.row(t) += weights(k)*instantaneous.row(std::min(t + k, nTpt - 1));
+            }
+        }
+    }
+}
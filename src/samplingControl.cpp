@@ -10,10 +10,10 @@ samplingControl::samplingControl(SEXP integerParameters,
     Rcpp::IntegerVector inIntegerParams(integerParameters);
     Rcpp::NumericVector inNumericParams(numericParameters);
 
-    if (inIntegerParams.size() != 10 ||
-        inNumericParams.size() != 4)
+    if (inIntegerParams.size() < 10 ||
+        inNumericParams.size() < 4)
     {
-        Rcpp::stop("Exactly 15 samplingControl parameters are required.");
+        Rcpp::stop("At least 14 samplingControl parameters are required.");
     }
 
     simulation_width = inIntegerParams(0);
@@ -26,6 +26,19 @@ samplingControl::samplingControl(SEXP integerParameters,
     max_batches = inIntegerParams(7);
     multivariatePerturbation = inIntegerParams(8) != 0;
     m = inIntegerParams(9);
+    // Optional trailing parameters
+    backend = (inIntegerParams.size() > 10 ? inIntegerParams(10) : SIM_BACKEND_THREADS);
+    adaptive_batch = (inIntegerParams.size() > 11 ? inIntegerParams(11) != 0 : false);
+    min_batch_size = (inIntegerParams.size() > 12 ? inIntegerParams(12) : 4*CPU_cores);
+    streaming = (inIntegerParams.size() > 13 ? inIntegerParams(13) != 0 : false);
+    screening = (inIntegerParams.size() > 14 ? inIntegerParams(14) != 0 : false);
+    emulator = (inIntegerParams.size() > 15 ? inIntegerParams(15) != 0 : false);
+    single_precision = (inIntegerParams.size() > 16 ? inIntegerParams(16) != 0 : false);
+    affinity = (inIntegerParams.size() > 17 ? inIntegerParams(17) != 0 : false);
+    numa_replicas = (inIntegerParams.size() > 18 ? inIntegerParams(18) != 0 : false);
+    cache_size = (inIntegerParams.size() > 19 ? inIntegerParams(19) : 0);
+    common_random_numbers = (inIntegerParams.size() > 20 ? inIntegerParams(20) != 0 : false);
+    binomial_approximation = (inIntegerParams.size() > 21 ? inIntegerParams(21) : SIM_APPROX_NONE);
 #ifdef SPATIALSEIR_SINGLETHREAD
     if (CPU_cores > 1)
     {
@@ -38,6 +51,11 @@ samplingControl::samplingControl(SEXP integerParameters,
     shrinkage = inNumericParams(1);
     lpow = inNumericParams(2);
     target_eps = inNumericParams(3);
+    emulator_verify = (inNumericParams.size() > 4 ? inNumericParams(4) : 0.1);
+    emulator_margin = (inNumericParams.size() > 5 ? inNumericParams(5) : 1.25);
+    resample_ess = (inNumericParams.size() > 6 ? inNumericParams(6) : 1.0);
+    approximation_threshold = (inNumericParams.size() > 7 ? inNumericParams(7) : 1000.0);
+    approximation_verify = (inNumericParams.size() > 8 ? inNumericParams(8) : 0.0);
     
 
     if (algorithm != ALG_BasicABC && 
@@ -51,6 +69,44 @@ samplingControl::samplingControl(SEXP integerParameters,
     {
         Rcpp::stop("max_batches must be greater than zero.");
     }
+    if (min_batch_size <= 0)
+    {
+        Rcpp::stop("min_batch_size must be greater than zero.");
+    }
+    if (emulator_verify < 0 || emulator_verify > 1)
+    {
+        Rcpp::stop("emulator_verify must be between zero and one.");
+    }
+    if (emulator_margin < 1)
+    {
+        Rcpp::stop("emulator_margin must be at least one.");
+    }
+    if (!(resample_ess > 0) || resample_ess > 1)
+    {
+        Rcpp::stop("resample_ess must be greater than zero and at most one.");
+    }
+    if (cache_size < 0)
+    {
+        Rcpp::stop("cache_size must not be negative.");
+    }
+    if (binomial_approximation != SIM_APPROX_NONE && 
+        binomial_approximation != SIM_APPROX_NORMAL &&
+        binomial_approximation != SIM_APPROX_POISSON)
+    {
+        Rcpp::stop("binomial_approximation must be 0 (none), 1 (normal) or 2 (poisson).");
+    }
+    if (!(approximation_threshold > 0))
+    {
+        Rcpp::stop("approximation_threshold must be greater than zero.");
+    }
+    if (approximation_verify < 0 || approximation_verify > 1)
+    {
+        Rcpp::stop("approximation_verify must be between zero and one.");
+    }
+    if (backend != SIM_BACKEND_THREADS && backend != SIM_BACKEND_PROCESSES)
+    {
+        Rcpp::stop("backend must be 0 (threads) or 1 (processes).");
+    }
 }
 
 void samplingControl::summary()
@@ -67,6 +123,25 @@ void samplingControl::summary()
     Rcpp::Rcout << "    max_batches: " << max_batches << "\n";
     Rcpp::Rcout << "    multivariatePerturbation: " << multivariatePerturbation << "\n";
     Rcpp::Rcout << "    m: " << m << "\n";
+    Rcpp::Rcout << "    adaptive_batch: " << adaptive_batch << "\n";
+    Rcpp::Rcout << "    min_batch_size: " << min_batch_size << "\n";
+    Rcpp::Rcout << "    streaming: " << streaming << "\n";
+    Rcpp::Rcout << "    screening: " << screening << "\n";
+    Rcpp::Rcout << "    emulator: " << emulator << "\n";
+    Rcpp::Rcout << "    emulator_verify: " << emulator_verify << "\n";
+    Rcpp::Rcout << "    emulator_margin: " << emulator_margin << "\n";
+    Rcpp::Rcout << "    resample_ess: " << resample_ess << "\n";
+    Rcpp::Rcout << "    precision: " << (single_precision ? "single" : "double") << "\n";
+    Rcpp::Rcout << "    backend: " << (backend == SIM_BACKEND_PROCESSES ? "processes" : "threads") << "\n";
+    Rcpp::Rcout << "    affinity: " << affinity << "\n";
+    Rcpp::Rcout << "    numa_replicas: " << numa_replicas << "\n";
+    Rcpp::Rcout << "    cache_size: " << cache_size << "\n";
+    Rcpp::Rcout << "    common_random_numbers: " << common_random_numbers << "\n";
+    Rcpp::Rcout << "    binomial_approximation: " << 
+        (binomial_approximation == SIM_APPROX_NORMAL ? "normal" :
+         (binomial_approximation == SIM_APPROX_POISSON ? "poisson" : "none")) << "\n";
+    Rcpp::Rcout << "    approximation_threshold: " << approximation_threshold << "\n";
+    Rcpp::Rcout << "    approximation_verify: " << approximation_verify << "\n";
     Rcpp::Rcout << "    accept_fraction: " << accept_fraction << "\n";
     Rcpp::Rcout << "    shrinkage: " << shrinkage << "\n";
     Rcpp::Rcout << "    lpow: " << lpow << "\n";
@@ -82,6 +157,16 @@ samplingControl::~samplingControl()
     }
 }
 
+int samplingControl::workerPlacement()
+{
+    // Replicas are only local to workers which stay on their node
+    if (numa_replicas)
+    {
+        return(SIM_PLACEMENT_REPLICATED);
+    }
+    return(affinity ? SIM_PLACEMENT_PINNED : SIM_PLACEMENT_FLOATING);
+}
+
 int samplingControl::getModelComponentType()
 {
     return(LSS_SAMPLING_CONTROL_MODEL_TYPE);
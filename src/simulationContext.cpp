@@ -0,0 +1,224 @@
+#include <Rcpp.h>
+#include <Eigen/Core>
+#include <simulationContext.hpp>
+#include <dataModel.hpp>
+#include <exposureModel.hpp>
+#include <reinfectionModel.hpp>
+#include <distanceModel.hpp>
+#include <transitionPriors.hpp>
+#include <initialValueContainer.hpp>
+#include <samplingControl.hpp>
+
+bool observedData::operator==(const observedData& other) const
+{
+    return(Y.rows() == other.Y.rows() && Y.cols() == other.Y.cols() &&
+           Y == other.Y && obs_start == other.obs_start &&
+           obs_loc == other.obs_loc &&
+           (obs_value == other.obs_value).all());
+}
+
+void checkModelComponents(dataModel* dataModel_,
+                          exposureModel* exposureModel_,
+                          reinfectionModel* reinfectionModel_,
+                          distanceModel* distanceModel_,
+                          transitionPriors* transitionPriors_,
+                          initialValueContainer* initialValueContainer_,
+                          samplingControl* samplingControl_)
+{
+    // Make sure these pointers go to the real deal
+    int err = (((dataModel_ -> getModelComponentType()) != LSS_DATA_MODEL_TYPE) ||
+            ((exposureModel_ -> getModelComponentType()) != LSS_EXPOSURE_MODEL_TYPE) ||
+            ((reinfectionModel_ -> getModelComponentType()) != LSS_REINFECTION_MODEL_TYPE) ||
+            ((distanceModel_ -> getModelComponentType()) != LSS_DISTANCE_MODEL_TYPE) ||
+            ((transitionPriors_ -> getModelComponentType()) != LSS_TRANSITION_MODEL_TYPE) ||
+            ((initialValueContainer_ -> getModelComponentType()) != LSS_INIT_CONTAINER_TYPE) ||
+            ((samplingControl_ -> getModelComponentType()) != LSS_SAMPLING_CONTROL_MODEL_TYPE));
+    if (err != 0)
+    {
+        Rcpp::stop("Error: model components were not provided in the correct order. \n");
+    }
+
+    // Check for model component compatibility
+    if ((dataModel_ -> nLoc) != (exposureModel_ -> nLoc))
+    {
+        Rcpp::stop(("Exposure model and data model imply different number of locations: "
+                + std::to_string(dataModel_ -> nLoc) + ", "
+                + std::to_string(exposureModel_ -> nLoc) + ".\n").c_str());
+    }
+    if ((dataModel_ -> nTpt) != (exposureModel_ -> nTpt))
+    {
+        Rcpp::stop(("Exposure model and data model imply different number of time points:"
+                    + std::to_string(dataModel_ -> nTpt) + ", "
+                    + std::to_string(exposureModel_ -> nTpt) + ".\n").c_str());
+    }
+    if ((dataModel_ -> nLoc) != (distanceModel_ -> numLocations))
+    {
+        Rcpp::stop(("Data model and distance model imply different number of locations:"
+                    + std::to_string(dataModel_ -> nLoc) + ", "
+                    + std::to_string(distanceModel_ -> numLocations) + ".\n").c_str()
+                );
+    }
+    if ((int) (distanceModel_ -> tdm_list).size() != (dataModel_ -> nTpt))
+    {
+        Rcpp::stop("TDistance model and data model imply a different number of time points.\n");
+    }
+    int sz1 = (distanceModel_ -> tdm_list)[0].size();
+    for (int i = 0; i < (int) (distanceModel_ -> tdm_list).size(); i++)
+    {
+        if ((int) distanceModel_ -> tdm_list[i].size() != sz1)
+        {
+            Rcpp::stop("Differing number of lagged contact matrices across time points.\n");
+        }
+    }
+    if ((dataModel_ -> nLoc) != (initialValueContainer_ -> S0.size()))
+    {
+        Rcpp::stop("Data model and initial value container have different dimensions\n");
+    }
+    if ((reinfectionModel_ -> reinfectionMode) == 3)
+    {
+        // No reinfection
+    }
+    else
+    {
+        if (((reinfectionModel_ -> X_rs).rows()) != (dataModel_ -> nTpt))
+        {
+            Rcpp::stop("Reinfection and data mode time points differ.\n");
+        }
+    }
+
+    if (transitionPriors_ -> mode != "exponential" &&
+            transitionPriors_ -> mode != "path_specific" &&
+            transitionPriors_ -> mode != "weibull")
+    {
+        Rcpp::stop("Invalid transition mode: " +
+                (transitionPriors_ -> mode));
+    }
+}
+
+std::shared_ptr<const observedData> buildObservedData(dataModel* dataModel_)
+{
+    std::shared_ptr<observedData> observed(new observedData());
+    const Eigen::MatrixXi& Y = dataModel_ -> Y;
+    const MatrixXb& na_mask = dataModel_ -> na_mask;
+    std::vector<double> values;
+    observed -> Y = Y;
+    observed -> obs_start.push_back(0);
+    for (int t = 0; t < Y.rows(); t++)
+    {
+        for (int l = 0; l < Y.cols(); l++)
+        {
+            if (!na_mask(t, l))
+            {
+                observed -> obs_loc.push_back(l);
+                values.push_back(Y(t, l));
+            }
+        }
+        observed -> obs_start.push_back((int) values.size());
+    }
+    observed -> obs_value = Eigen::Map<Eigen::ArrayXd>(values.data(),
+            values.size());
+    return(observed);
+}
+
+std::shared_ptr<const simulationContext> buildSimulationContext(
+        dataModel* dataModel_,
+        exposureModel* exposureModel_,
+        reinfectionModel* reinfectionModel_,
+        distanceModel* distanceModel_,
+        transitionPriors* transitionPriors_,
+        initialValueContainer* initialValueContainer_,
+        samplingControl* samplingControl_,
+        std::shared_ptr<const observedData> observed)
+{
+    const bool hasReinfection = (reinfectionModel_ ->
+            betaPriorPrecision)(0) > 0;
+    const bool hasSpatial = (dataModel_ -> Y).cols() > 1;
+    std::string transitionMode = transitionPriors_ -> mode;
+
+    const int nBeta = (exposureModel_ -> X).cols();
+    const int nBetaRS = (reinfectionModel_ -> X_rs).cols()*hasReinfection;
+    const int nRho = ((distanceModel_ -> dm_list).size() +
+                      (distanceModel_ -> tdm_list)[0].size())*hasSpatial;
+    const int nTrans = (transitionMode == "exponential" ? 2 :
+                       (transitionMode == "weibull" ? 4 : 0));
+    const int nReport = (dataModel_ -> dataModelType == 2 ? 1 : 0);
+
+    // Constant initial values, and S0 when the others are estimated, are
+    // held once by the layout rather than carried in every particle.
+    const parameterLayout layout(nBeta + nBetaRS + nRho + nTrans + nReport,
+                                 initialValueContainer_ -> S0,
+                                 initialValueContainer_ -> E0,
+                                 initialValueContainer_ -> I0,
+                                 initialValueContainer_ -> R0,
+                                 initialValueContainer_ -> type == 2);
+
+    std::shared_ptr<simulationContext> context(new simulationContext());
+    context -> S0 = initialValueContainer_ -> S0;
+    context -> E0 = initialValueContainer_ -> E0;
+    context -> I0 = initialValueContainer_ -> I0;
+    context -> R0 = initialValueContainer_ -> R0;
+    context -> offset = exposureModel_ -> offset;
+    context -> observed = (observed ? observed : buildObservedData(dataModel_));
+    context -> dataModelType = dataModel_ -> dataModelType;
+    // The single precision mode stores the force of infection inputs as
+    // float, halving the memory traffic of the contact products.
+    const bool single = samplingControl_ -> single_precision;
+    context -> single_precision = single;
+    for (unsigned int d = 0; d < (distanceModel_ -> dm_list).size(); d++)
+    {
+        context -> DM_vec.push_back(contactMatrix(
+                    (distanceModel_ -> dm_list)[d], single));
+    }
+    context -> TDM_index = distanceModel_ -> tdm_list;
+    context -> TDM_store = (single ? (distanceModel_ -> tdm_store).toSingle() :
+                            distanceModel_ -> tdm_store);
+    context -> TDM_empty = distanceModel_ -> tdm_empty;
+    // Each precision reads only its own copy of the design matrix
+    if (single)
+    {
+        context -> X_single = (exposureModel_ -> X).cast<float>();
+    }
+    else
+    {
+        context -> X = exposureModel_ -> X;
+    }
+    context -> nBeta = nBeta;
+    context -> X_rs = reinfectionModel_ -> X_rs;
+    context -> transitionMode = transitionPriors_ -> mode;
+    context -> E_to_I_prior = transitionPriors_ -> E_to_I_params;
+    context -> I_to_R_prior = transitionPriors_ -> I_to_R_params;
+    context -> inf_mean = transitionPriors_ -> inf_mean;
+    context -> spatial_prior = distanceModel_ -> spatial_prior;
+    context -> exposure_precision = exposureModel_ -> betaPriorPrecision;
+    context -> reinfection_precision = reinfectionModel_ -> betaPriorPrecision;
+    context -> exposure_mean = exposureModel_ -> betaPriorMean;
+    context -> reinfection_mean = reinfectionModel_ -> betaPriorMean;
+    context -> phi = dataModel_ -> phi;
+    context -> data_compartment = dataModel_ -> dataModelCompartment;
+    context -> cumulative = dataModel_ -> cumulative;
+    context -> m = samplingControl_ -> m;
+    context -> lpow = samplingControl_ -> lpow;
+    context -> binomial_approximation = samplingControl_ -> binomial_approximation;
+    context -> approximation_threshold = samplingControl_ -> approximation_threshold;
+    context -> approximation_verify = samplingControl_ -> approximation_verify;
+    context -> nParams = layout.nFree;
+    context -> layout = layout;
+    context -> prior = priorDensity(dataModel_,
+                                    exposureModel_,
+                                    reinfectionModel_,
+                                    distanceModel_,
+                                    transitionPriors_,
+                                    initialValueContainer_);
+    return(context);
+}
+
+std::shared_ptr<const simulationContext> copySimulationContext(
+        const simulationContext& context,
+        std::shared_ptr<const observedData> observed)
+{
+    std::shared_ptr<simulationContext> copy(new simulationContext(context));
+    copy -> observed = (observed ? observed :
+            std::shared_ptr<const observedData>(
+                new observedData(*(context.observed))));
+    return(copy);
+}
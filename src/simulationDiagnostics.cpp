@@ -0,0 +1,78 @@
+#include <Rcpp.h>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <simulationDiagnostics.hpp>
+
+simulationDiagnostics::simulationDiagnostics()
+{
+    reset();
+}
+
+void simulationDiagnostics::recordTime(double microseconds)
+{
+    int bucket = 0;
+    if (microseconds >= 1.0)
+    {
+        bucket = 1 + (int) std::floor(std::log2(microseconds));
+    }
+    time_histogram[bucket < SIM_TIME_BUCKETS ? bucket : SIM_TIME_BUCKETS - 1]++;
+    simulations++;
+}
+
+void simulationDiagnostics::add(const simulationDiagnostics& other)
+{
+    simulations += other.simulations;
+    binomial_trivial += other.binomial_trivial;
+    binomial_small += other.binomial_small;
+    binomial_large += other.binomial_large;
+    path_iterations += other.path_iterations;
+    time_steps += other.time_steps;
+    allocations += other.allocations;
+    for (int b = 0; b < SIM_TIME_BUCKETS; b++)
+    {
+        time_histogram[b] += other.time_histogram[b];
+    }
+}
+
+void simulationDiagnostics::reset()
+{
+    simulations = 0;
+    binomial_trivial = 0;
+    binomial_small = 0;
+    binomial_large = 0;
+    path_iterations = 0;
+    time_steps = 0;
+    allocations = 0;
+    time_histogram.fill(0);
+}
+
+Rcpp::List simulationDiagnostics::toList() const
+{
+    // Counts are returned as doubles, as they may exceed the range of R
+    // integers
+    std::vector<double> upper(SIM_TIME_BUCKETS);
+    std::vector<double> counts(SIM_TIME_BUCKETS);
+    for (int b = 0; b < SIM_TIME_BUCKETS; b++)
+    {
+        upper[b] = (b == SIM_TIME_BUCKETS - 1 ?
+                    std::numeric_limits<double>::infinity() : std::ldexp(1.0, b));
+        counts[b] = (double) time_histogram[b];
+    }
+    Rcpp::List binomial;
+    binomial["trivial"] = (double) binomial_trivial;
+    binomial["small"] = (double) binomial_small;
+    binomial["large"] = (double) binomial_large;
+    Rcpp::List histogram;
+    histogram["upper_us"] = Rcpp::wrap(upper);
+    histogram["count"] = Rcpp::wrap(counts);
+
+    Rcpp::List outList;
+    outList["simulations"] = (double) simulations;
+    outList["binomialDraws"] = binomial;
+    outList["pathIterations"] = (double) path_iterations;
+    outList["timeSteps"] = (double) time_steps;
+    outList["allocations"] = (double) allocations;
+    outList["timeHistogram"] = histogram;
+    return(outList);
+}
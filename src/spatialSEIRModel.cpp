@@ -3,6 +3,7 @@
 #include <RcppEigen.h>
 #include <cmath>
 #include <math.h>
+#include <algorithm>
 #include <spatialSEIRModel.hpp>
 #include <dataModel.hpp>
 #include <exposureModel.hpp>
@@ -16,16 +17,6 @@
 
 using namespace Rcpp; 
 
-double rbeta(double a, double b, std::mt19937* generator){
-    double x = std::gamma_distribution<double>(a,1)(*generator);
-    double y = std::gamma_distribution<double>(b,1)(*generator);
-    return(x/(x+y));
-}
-
-double rdunif(int a, int b, std::mt19937* generator){
-    return((double) std::uniform_int_distribution<int>(a,b)(*generator));
-}
-
 spatialSEIRModel::spatialSEIRModel(dataModel& dataModel_,
                                    exposureModel& exposureModel_,
                                    reinfectionModel& reinfectionModel_,
@@ -34,18 +25,9 @@ spatialSEIRModel::spatialSEIRModel(dataModel& dataModel_,
                                    initialValueContainer& initialValueContainer_,
                                    samplingControl& samplingControl_)
 {
-    // Make sure these pointers go to the real deal
-    int err = (((dataModel_.getModelComponentType()) != LSS_DATA_MODEL_TYPE) ||
-            ((exposureModel_.getModelComponentType()) != LSS_EXPOSURE_MODEL_TYPE) ||
-            ((reinfectionModel_.getModelComponentType()) != LSS_REINFECTION_MODEL_TYPE) ||
-            ((distanceModel_.getModelComponentType()) != LSS_DISTANCE_MODEL_TYPE) ||
-            ((transitionPriors_.getModelComponentType()) != LSS_TRANSITION_MODEL_TYPE) ||
-            ((initialValueContainer_.getModelComponentType()) != LSS_INIT_CONTAINER_TYPE) ||
-            ((samplingControl_.getModelComponentType()) != LSS_SAMPLING_CONTROL_MODEL_TYPE));
-    if (err != 0)
-    { 
-        Rcpp::stop("Error: model components were not provided in the correct order. \n");
-    }
+    checkModelComponents(&dataModel_, &exposureModel_, &reinfectionModel_,
+                         &distanceModel_, &transitionPriors_,
+                         &initialValueContainer_, &samplingControl_);
 
     // Store model components
     dataModelInstance = &dataModel_;
@@ -56,66 +38,6 @@ spatialSEIRModel::spatialSEIRModel(dataModel& dataModel_,
     initialValueContainerInstance = &initialValueContainer_;
     samplingControlInstance = &samplingControl_;
 
-    // Check for model component compatibility
-    if ((dataModelInstance -> nLoc) != (exposureModelInstance -> nLoc))
-    { 
-        Rcpp::stop(("Exposure model and data model imply different number of locations: " 
-                + std::to_string(dataModelInstance -> nLoc) + ", " 
-                + std::to_string(exposureModelInstance -> nLoc) + ".\n").c_str());
-    }
-    if ((dataModelInstance -> nTpt) != (exposureModelInstance -> nTpt))
-    { 
-        Rcpp::stop(("Exposure model and data model imply different number of time points:"
-                    + std::to_string(dataModelInstance -> nTpt) + ", "
-                    + std::to_string(exposureModelInstance -> nTpt) + ".\n").c_str());  
-    }
-    if ((dataModelInstance -> nLoc) != (distanceModelInstance -> numLocations))
-    {       
-        Rcpp::stop(("Data model and distance model imply different number of locations:"
-                    + std::to_string(dataModelInstance -> nLoc) + ", "
-                    + std::to_string(distanceModelInstance -> numLocations) + ".\n").c_str()
-                );
-    }
-    if ((int) (distanceModelInstance -> tdm_list).size() != (dataModelInstance -> nTpt))
-    {
-        Rcpp::stop("TDistance model and data model imply a different number of time points.\n");
-    }
-    int sz1 = (distanceModelInstance -> tdm_list)[0].size();
-    for (int i = 0; i < (int) (distanceModelInstance -> tdm_list).size(); i++)
-    {
-        if ((int) distanceModelInstance -> tdm_list[i].size() != sz1)
-        {
-            Rcpp::stop("Differing number of lagged contact matrices across time points.\n");
-        }
-    }
-    if ((dataModelInstance -> nLoc) != (initialValueContainerInstance -> S0.size())) 
-    { 
-        Rcpp::stop("Data model and initial value container have different dimensions\n");
-    }
-    if ((reinfectionModelInstance -> reinfectionMode) == 3)
-    {
-        // No reinfection
-    }
-    else
-    {
-        if (((reinfectionModelInstance -> X_rs).rows()) != (dataModelInstance -> nTpt))
-        { 
-            Rcpp::stop("Reinfection and data mode time points differ.\n");
-        }
-    }
-    if ((reinfectionModelInstance -> reinfectionMode) > 2)
-    {
-        // pass
-    }
-
-    if (transitionPriorsInstance -> mode != "exponential" && 
-            transitionPriorsInstance -> mode != "path_specific" &&
-            transitionPriorsInstance -> mode != "weibull")
-    {
-        Rcpp::stop("Invalid transition mode: " + 
-                (transitionPriorsInstance -> mode));
-    }
-
     // Optionally, set up transition distribution
     if (transitionPriorsInstance -> mode == "weibull")
     {
@@ -138,28 +60,31 @@ spatialSEIRModel::spatialSEIRModel(dataModel& dataModel_,
         IR_transition_dist = std::unique_ptr<weibullTransitionDistribution>(new 
             weibullTransitionDistribution(DummyParams));
     }
+
+    // Collect the read-only model description shared by all workers
+    model_context = buildSimulationContext(dataModelInstance,
+                                           exposureModelInstance,
+                                           reinfectionModelInstance,
+                                           distanceModelInstance,
+                                           transitionPriorsInstance,
+                                           initialValueContainerInstance,
+                                           samplingControlInstance);
+    generator = nullptr;
+    initializeState();
+    createWorkerPool();
+}
+
+void spatialSEIRModel::initializeState()
+{
     // Set up param matrix
-    const bool hasReinfection = (reinfectionModelInstance -> 
-            betaPriorPrecision)(0) > 0;
-    const bool hasSpatial = (dataModelInstance -> Y).cols() > 1;
-    std::string transitionMode = transitionPriorsInstance -> mode;
-
-    const int nBeta = (exposureModelInstance -> X).cols();
-    const int nBetaRS = (reinfectionModelInstance -> X_rs).cols()*hasReinfection;
-    const int nRho = ((distanceModelInstance -> dm_list).size() + 
-                      (distanceModelInstance -> tdm_list)[0].size())*hasSpatial;
-    const int nTrans = (transitionMode == "exponential" ? 2 :
-                       (transitionMode == "weibull" ? 4 : 0));
-    const int nReport = (dataModelInstance -> dataModelType == 2 ? 1 : 0);
-
-    const int nIVC = (initialValueContainerInstance -> S0).size()*4;
-    const int nParams = nBeta + nBetaRS + nRho + nTrans + nReport + nIVC;
+    const int nParams = model_context -> nParams;
 
     // Set up random number provider 
     std::minstd_rand0 lc_generator(samplingControlInstance -> random_seed + 1);
     std::uint_least32_t seed_data[std::mt19937::state_size];
     std::generate_n(seed_data, std::mt19937::state_size, std::ref(lc_generator));
     std::seed_seq q(std::begin(seed_data), std::end(seed_data));
+    delete generator;
     generator = new std::mt19937{q};   
 
     // Parameters are not initialized
@@ -179,240 +104,80 @@ spatialSEIRModel::spatialSEIRModel(dataModel& dataModel_,
     parameterICovDet = 0.0;
 
     result_idx = std::vector<int>();
+}
 
-    // Create the worker pool
+void spatialSEIRModel::createWorkerPool()
+{
+    worker_pool.reset();
     worker_pool = std::unique_ptr<NodePool>(
                 new NodePool(&results_double,
                      &results_complete,
                      &result_idx,
                      (unsigned int) samplingControlInstance -> CPU_cores,
-                     samplingControlInstance->random_seed,
-                     initialValueContainerInstance -> S0,
-                     initialValueContainerInstance -> E0,
-                     initialValueContainerInstance -> I0,
-                     initialValueContainerInstance -> R0,
-                     exposureModelInstance -> offset,
-                     dataModelInstance -> Y,
-                     dataModelInstance -> na_mask,
-                     dataModelInstance -> dataModelType,
-                     distanceModelInstance -> dm_list,
-                     distanceModelInstance -> tdm_list,
-                     distanceModelInstance -> tdm_empty,
-                     exposureModelInstance -> X,
-                     reinfectionModelInstance -> X_rs,
-                     transitionPriorsInstance -> mode,
-                     transitionPriorsInstance -> E_to_I_params,
-                     transitionPriorsInstance -> I_to_R_params,
-                     transitionPriorsInstance -> inf_mean,
-                     distanceModelInstance -> spatial_prior,
-                     exposureModelInstance -> betaPriorPrecision,
-                     reinfectionModelInstance -> betaPriorPrecision, 
-                     exposureModelInstance -> betaPriorMean,
-                     reinfectionModelInstance -> betaPriorMean,
-                     dataModelInstance -> phi,
-                     dataModelInstance -> dataModelCompartment,
-                     dataModelInstance -> cumulative,
-                     samplingControlInstance -> m,
-                     samplingControlInstance -> lpow
+                     samplingControlInstance -> random_seed,
+                     model_context,
+                     samplingControlInstance -> backend,
+                     samplingControlInstance -> workerPlacement()
                 ));
+    pool_cores = samplingControlInstance -> CPU_cores;
+    pool_backend = samplingControlInstance -> backend;
+    pool_placement = samplingControlInstance -> workerPlacement();
 }
 
-Eigen::MatrixXd spatialSEIRModel::generateParamsPrior(int nParticles)
+void spatialSEIRModel::setSamplingControl(samplingControl& samplingControl_)
 {
-    const bool hasReinfection = (reinfectionModelInstance -> 
-            betaPriorPrecision)(0) > 0;
-    const bool hasSpatial = (dataModelInstance -> Y).cols() > 1;
-    std::string transitionMode = transitionPriorsInstance -> mode;
-    
-    const bool estimateIVC = initialValueContainerInstance -> type == 2;
-
-    const int nBeta = (exposureModelInstance -> X).cols();
-    const int nBetaRS = (reinfectionModelInstance -> X_rs).cols()*hasReinfection;
-    const int nRho = ((distanceModelInstance -> dm_list).size() + 
-                      (distanceModelInstance -> tdm_list)[0].size())*hasSpatial;
-    const int nTrans = (transitionMode == "exponential" ? 2 :
-                       (transitionMode == "weibull" ? 4 : 0));
-    const int nReport = (dataModelInstance -> dataModelType == 2 ? 1 : 0);
-    const int nIVC = (initialValueContainerInstance -> S0).size()*4;
-    const int nParams = nBeta + nBetaRS + nRho + nTrans + nReport + nIVC;
-
-    int N = nParticles;
-
-    int i, j;
-
-    double rf_alpha = (dataModelInstance -> dataModelType == 2  ?
-                       (dataModelInstance -> report_fraction)*(dataModelInstance -> report_fraction_ess) :
-                       -1.0);
-    double rf_beta = (dataModelInstance -> dataModelType == 2 ?
-                       (1.0 - dataModelInstance -> report_fraction)*(dataModelInstance -> report_fraction_ess) :
-                       -1.0);
-
-
-
-    Eigen::MatrixXd outParams = Eigen::MatrixXd::Zero(N, nParams);
-
-
-    // Set up random samplers 
-    // beta, beta_RS
-    std::normal_distribution<double> standardNormal(0,1); 
-    // rho  
-    std::gamma_distribution<> rhoDist(
-            (distanceModelInstance -> spatial_prior)(0),
-        1.0/(distanceModelInstance -> spatial_prior)(1));
-    // Hyperprior distributions for E to I and I to R transitions
-    std::vector<std::gamma_distribution<> > gammaEIDist;
-    std::vector<std::gamma_distribution<> > gammaIRDist;
-
-    if (transitionMode == "exponential")
-    {
-        gammaEIDist.push_back(std::gamma_distribution<>(
-                (transitionPriorsInstance -> E_to_I_params)(0,0),
-            1.0/(transitionPriorsInstance -> E_to_I_params)(1,0)));
-        gammaIRDist.push_back(std::gamma_distribution<>(
-                (transitionPriorsInstance -> I_to_R_params)(0,0),
-            1.0/(transitionPriorsInstance -> I_to_R_params)(1,0)));
-    }   
-    else if (transitionMode == "weibull")
-    {
-        gammaEIDist.push_back(std::gamma_distribution<>(
-                (transitionPriorsInstance -> E_to_I_params)(0,0),
-            1.0/(transitionPriorsInstance -> E_to_I_params)(1,0)));
-        gammaEIDist.push_back(std::gamma_distribution<>(
-                (transitionPriorsInstance -> E_to_I_params)(2,0),
-            1.0/(transitionPriorsInstance -> E_to_I_params)(3,0)));
-
-        gammaIRDist.push_back(std::gamma_distribution<>(
-                (transitionPriorsInstance -> I_to_R_params)(0,0),
-            1.0/(transitionPriorsInstance -> I_to_R_params)(1,0)));
-        gammaIRDist.push_back(std::gamma_distribution<>(
-                (transitionPriorsInstance -> I_to_R_params)(2,0),
-            1.0/(transitionPriorsInstance -> I_to_R_params)(3,0)));
-    }
-    // If this is too slow, consider column-wise operations
-    double rhoTot = 0.0;
-    int rhoItrs = 0;
-    for (i = 0; i < nParticles; i++)
-    {
-        // Draw beta
-        for (j = 0; j < nBeta; j++)
-        {
-            outParams(i, j) = (exposureModelInstance -> betaPriorMean(j)) + 
-                                 standardNormal(*generator) /
-                                 (exposureModelInstance -> betaPriorPrecision(j));
-        }
-    }
-    // draw gammaEI, gammaIR
-    if (transitionMode == "exponential")
-    {
-        for (i = 0; i < nParticles; i++)
-        {
-            // Draw gamma_ei
-            outParams(i, nBeta + nBetaRS + nRho) = 
-                gammaEIDist[0](*generator);
-            // Draw gamma_ir
-            outParams(i, nBeta + nBetaRS + nRho + 1) = 
-                gammaIRDist[0](*generator);
-        }
-    }
-    else if (transitionMode == "weibull")
+    if (samplingControl_.getModelComponentType() != LSS_SAMPLING_CONTROL_MODEL_TYPE)
     {
-        for (i = 0; i < nParticles; i++)
-        {
-            outParams(i, nBeta + nBetaRS + nRho) = gammaEIDist[0](*generator);
-            outParams(i, nBeta + nBetaRS + nRho + 1) = gammaEIDist[1](*generator);
-            outParams(i, nBeta + nBetaRS + nRho + 2) = gammaIRDist[0](*generator);
-            outParams(i, nBeta + nBetaRS + nRho + 3) = gammaIRDist[1](*generator);
-        }
+        Rcpp::stop("Error: a samplingControl object is required. \n");
     }
-    // Draw reinfection parameters
-    if (hasReinfection)
+    samplingControlInstance = &samplingControl_;
+
+    // The context holds the replicate count, the distance and the draws;
+    // the other components are unchanged, so it is rebuilt only when these
+    // differ.
+    if ((model_context -> m) != (samplingControlInstance -> m) ||
+        (model_context -> lpow) != (samplingControlInstance -> lpow) ||
+        (model_context -> single_precision) != 
+            (samplingControlInstance -> single_precision) ||
+        (model_context -> binomial_approximation) !=
+            (samplingControlInstance -> binomial_approximation) ||
+        (model_context -> approximation_threshold) !=
+            (samplingControlInstance -> approximation_threshold) ||
+        (model_context -> approximation_verify) !=
+            (samplingControlInstance -> approximation_verify))
     {
-        for (i = 0; i < nParticles; i++)
-        {
-            for (j = nBeta; j < nBeta + nBetaRS; j++)
-            {
-                outParams(i, j) = 
-                    (reinfectionModelInstance -> betaPriorMean(j-nBeta)) + 
-                     standardNormal(*generator) /
-                    (reinfectionModelInstance -> betaPriorPrecision(j-nBeta));           
-            }
-        }
-    }
-    // Draw rho
-    if (hasSpatial)
+        worker_pool.reset();
+        model_context = buildSimulationContext(dataModelInstance,
+                                               exposureModelInstance,
+                                               reinfectionModelInstance,
+                                               distanceModelInstance,
+                                               transitionPriorsInstance,
+                                               initialValueContainerInstance,
+                                               samplingControlInstance,
+                                               model_context -> observed);
+    }
+    initializeState();
+    // Idle threads are kept, restarted from the new seed
+    if (!worker_pool || 
+        pool_cores != (samplingControlInstance -> CPU_cores) ||
+        pool_backend != (samplingControlInstance -> backend) ||
+        pool_placement != (samplingControlInstance -> workerPlacement()) ||
+        !(worker_pool -> reseed(samplingControlInstance -> random_seed)))
     {
-        for (i = 0; i < nParticles; i++)
-        {
-            rhoTot = 2.0; 
-            rhoItrs = 0;
-            while (rhoTot > 1.0 && rhoItrs < 100)
-            {
-                rhoTot = 0.0;
-                for (j = nBeta + nBetaRS; j < nBeta + nBetaRS + nRho; j++)
-                {
-                   outParams(i, j) = rhoDist(*generator); 
-                   rhoTot += outParams(i,j);
-                }
-                rhoItrs++;
-            }
-            if (rhoTot > 1.0)
-            {
-                Rcpp::Rcout << "Error, valid rho value not obtained\n";
-            }
-        }
+        createWorkerPool();
     }
-    // Draw report fraction
-    if (dataModelInstance -> dataModelType == 2)
+}
+
+Eigen::MatrixXd spatialSEIRModel::generateParamsPrior(int nParticles)
+{
+    Eigen::MatrixXd outParams = Eigen::MatrixXd::Zero(nParticles, 
+            model_context -> nParams);
+    // Blocks are drawn on the workers, each from its own seed
+    int failures = worker_pool -> samplePrior(outParams, (*generator)());
+    for (int i = 0; i < failures; i++)
     {
-        int reportcol = nBeta + nBetaRS + nRho + nTrans;
-        
-        for (i = 0; i < nParticles; i++)
-        {
-            outParams(i,reportcol) = rbeta(rf_alpha, rf_beta, generator);
-        }
+        Rcpp::Rcout << "Error, valid rho value not obtained\n";
     }
-	
-	int ivcstartcol = nBeta + nBetaRS + nRho + nTrans + nReport;
-    int sz = (initialValueContainerInstance -> S0).size();    
-    if (estimateIVC){
-        //const int nIVC = (estimateIVC ? (initialValueContainerInstance -> S0).size()*4 : 0);
-        
-        auto N = (initialValueContainerInstance -> S0) + 
-                (initialValueContainerInstance -> E0) + 
-                (initialValueContainerInstance -> I0) + 
-                (initialValueContainerInstance -> R0); 
-
-        for (i = 0; i < nParticles; i++)
-        {
-            for (j = 0; j < sz; j++){
-                // E
-                outParams(i,ivcstartcol+j+sz) = rdunif(0, initialValueContainerInstance -> E0_max(j), generator);
-                // I
-                outParams(i,ivcstartcol+j+2*sz) = rdunif(0, initialValueContainerInstance -> I0_max(j), generator);
-                // R
-                outParams(i,ivcstartcol+j+3*sz) = rdunif(0, initialValueContainerInstance -> R0_max(j), generator);
-                // S
-                outParams(i,ivcstartcol+j) = N(j) - 
-                    outParams(i,ivcstartcol+j+sz) - 
-                    outParams(i,ivcstartcol+j+2*sz) - 
-                    outParams(i,ivcstartcol+j+3*sz);
-            }
-        }
-    } else {
-		for (i = 0; i < nParticles; i++)
-        {
-            for (j = 0; j < sz; j++){
-                // S
-                outParams(i,ivcstartcol+j) = (initialValueContainerInstance -> S0(j));
-                // E
-                outParams(i,ivcstartcol+j+sz) = (initialValueContainerInstance -> E0(j));
-                // I
-                outParams(i,ivcstartcol+j+2*sz) = (initialValueContainerInstance -> I0(j));
-                // R
-                outParams(i,ivcstartcol+j+3*sz) = (initialValueContainerInstance -> R0(j));
-            }
-        }
-	}
     return(outParams);
 }
 
@@ -432,18 +197,37 @@ Rcpp::List spatialSEIRModel::sample(SEXP nSample, SEXP returnComps, SEXP verbose
     }
 
     std::string sim_type_atom = (R ? sim_result_atom : sim_atom);
+    // A previous call may have been interrupted while screening
+    worker_pool -> setScreeningThreshold(std::numeric_limits<double>::infinity());
+    // Diagnostics cover this call only
+    worker_pool -> takeDiagnostics();
+    // Progress comes from the counters of the workers, so that verbose
+    // runs cost the simulations nothing
+    worker_pool -> setAcceptanceThreshold(std::numeric_limits<double>::infinity());
+    worker_pool -> setProgressInterval(V > 1 ? 2000 : 0);
+    // Cached prior densities and setups cover this call only
+    prior_cache.setCapacity(samplingControlInstance -> cache_size);
+    worker_pool -> setCacheSize(samplingControlInstance -> cache_size);
+    // So do the approximation checks
+    std::vector<double> staleExact, staleApproximate;
+    worker_pool -> takeApproximationCheck(staleExact, staleApproximate);
+    // The streams are drawn afresh for each call, and only when used, so
+    // that the other draws of the sampler are unchanged
+    worker_pool -> setCommonStreams(samplingControlInstance -> common_random_numbers,
+            samplingControlInstance -> common_random_numbers ? (*generator)() : 0);
     
+    Rcpp::List outList;
     if (samplingControlInstance -> algorithm == ALG_BasicABC)
     {
-        return(sample_basic(N, V, sim_type_atom));
+        outList = sample_basic(N, V, sim_type_atom);
     }
     else if (samplingControlInstance -> algorithm == ALG_ModifiedBeaumont2009)
     {
-        return(sample_Beaumont2009(N, V, sim_type_atom));
+        outList = sample_Beaumont2009(N, V, sim_type_atom);
     }
     else if (samplingControlInstance -> algorithm == ALG_DelMoral2012)
     {
-        return(sample_DelMoral2012(N, V, sim_type_atom));
+        outList = sample_DelMoral2012(N, V, sim_type_atom);
     }
     else 
     {
@@ -457,29 +241,15 @@ Rcpp::List spatialSEIRModel::sample(SEXP nSample, SEXP returnComps, SEXP verbose
         }
         return(sample_Simulate(N, 0, V));
     }
+    SEIR_DIAGNOSTIC(outList["diagnostics"] = (worker_pool -> takeDiagnostics()).toList());
+    return(outList);
 }
 
 bool spatialSEIRModel::setParameters(Eigen::MatrixXd params, 
         Eigen::VectorXd weights, Eigen::MatrixXd results, double eps)
 {
-    const bool hasReinfection = (reinfectionModelInstance ->                    
-                        betaPriorPrecision)(0) > 0; 
-    const bool hasSpatial = (dataModelInstance -> Y).cols() > 1;                
-    std::string transitionMode = transitionPriorsInstance -> mode;
-    const bool estimateIVC = initialValueContainerInstance -> type == 2;
-    
-    const int nBeta = (exposureModelInstance -> X).cols();
-    const int nBetaRS = (reinfectionModelInstance -> X_rs).cols()*hasReinfection;
-    const int nRho = ((distanceModelInstance -> dm_list).size() + 
-                      (distanceModelInstance -> tdm_list)[0].size())*hasSpatial;
-
-    const int nTrans = (transitionMode == "exponential" ? 2 :
-                       (transitionMode == "weibull" ? 4 : 0));
-    const int nReport = (dataModelInstance -> dataModelType == 2 ? 1 : 0);
-    const int nIVC = (initialValueContainerInstance -> S0).size()*4;
-    const int nParams = nBeta + nBetaRS + nRho + nTrans + nReport + nIVC;
-    
-    if (params.cols() != nParams)
+    // Parameters from R use the full layout
+    if (params.cols() != (model_context -> layout).nFull)
     {
         Rcpp::stop("Number of supplied parameters does not match model specification.\n");
     }
@@ -490,8 +260,8 @@ bool spatialSEIRModel::setParameters(Eigen::MatrixXd params,
 
     init_eps = eps;
 
-    init_param_matrix = params; 
-    param_matrix = params;
+    init_param_matrix = (model_context -> layout).compress(params); 
+    param_matrix = init_param_matrix;
 
     init_results_double = results;
     results_double = results;
@@ -503,113 +273,176 @@ bool spatialSEIRModel::setParameters(Eigen::MatrixXd params,
 
 double spatialSEIRModel::evalPrior(Eigen::VectorXd param_vector)
 {
-    double outPrior = 0.0;
-    double constr = 0.0;
-    const bool hasReinfection = (reinfectionModelInstance -> betaPriorPrecision)(0) > 0;
-    const bool hasSpatial = (dataModelInstance -> Y).cols() > 1;
-    std::string transitionMode = transitionPriorsInstance -> mode;
-    const int nBeta = (exposureModelInstance -> X).cols();
-    const int nBetaRS = (reinfectionModelInstance -> X_rs).cols()*hasReinfection;
-    const int nRho = ((distanceModelInstance -> dm_list).size() + 
-                      (distanceModelInstance -> tdm_list)[0].size())*hasSpatial;
-    //const int nReport = (dataModelInstance -> dataModelType == 2 ? 1 : 0);
-    double rf_alpha = (dataModelInstance -> dataModelType == 2 ?
-                       (dataModelInstance -> report_fraction)*(dataModelInstance -> report_fraction_ess) :
-                       -1.0);
-    double rf_beta = (dataModelInstance -> dataModelType == 2 ?
-                       (1.0 - dataModelInstance -> report_fraction)*(dataModelInstance -> report_fraction_ess) :
-                       -1.0);
-
-
+    return(std::exp((model_context -> prior).logDensity(param_vector)));
+}
 
-    int i;
-    int paramIdx = 0;
-    for (i = 0; i < nBeta; i++)
+Eigen::VectorXd spatialSEIRModel::evalPriorDensity(Eigen::MatrixXd params)
+{
+    const parameterLayout& layout = model_context -> layout;
+    if (params.cols() != layout.nFull)
+    {
+        Rcpp::stop("Number of supplied parameters does not match model specification.\n");
+    }
+    const Eigen::MatrixXd compact = layout.compress(params);
+    const Eigen::MatrixXd expanded = layout.expand(compact);
+    // The prior cache is left alone, so its hit rates describe sampling only
+    Eigen::VectorXd density;
+    worker_pool -> evaluatePrior(compact, density);
+    for (int i = 0; i < density.size(); i++)
     {
-        outPrior += R::dnorm(param_vector(paramIdx), 
-                (exposureModelInstance -> betaPriorMean)(i), 
-                1.0/((exposureModelInstance -> betaPriorPrecision)(i)), 1);
-        paramIdx++;
+        density(i) = (expanded.row(i) == params.row(i) ? 
+                std::exp(density(i)) : 0.0);
     }
+    return(density);
+}
 
-    if (nBetaRS > 0)
+Eigen::VectorXd spatialSEIRModel::evalPriorRows(const Eigen::MatrixXd& params)
+{
+    Eigen::VectorXd logDensity;
+    if (!prior_cache.enabled())
     {
-        for (i = 0; i < nBetaRS; i++)
+        worker_pool -> evaluatePrior(params, logDensity);
+        // Scalar exp: the vectorized version does not map -inf to exactly zero
+        for (int i = 0; i < logDensity.size(); i++)
         {
-            outPrior += R::dnorm(param_vector(paramIdx), 
-                    (reinfectionModelInstance -> betaPriorMean)(i), 
-                    1.0/((reinfectionModelInstance -> betaPriorPrecision)(i)), 1);
-            paramIdx++;
+            logDensity(i) = std::exp(logDensity(i));
         }
+        return(logDensity);
     }
 
-    if (nRho > 0)
+    // Only rows neither cached nor repeated earlier in params are evaluated
+    const int N = params.rows();
+    Eigen::VectorXd density(N);
+    std::vector<int> missing;
+    std::vector<int> source(N, -1);
+    particleCache<int> pending(N);
+    for (int i = 0; i < N; i++)
     {
-        for (i = 0; i < nRho; i++)
+        const Eigen::VectorXd key = params.row(i).transpose();
+        const double* cached = prior_cache.find(key);
+        const int* first = (cached != nullptr ? nullptr : pending.find(key));
+        prior_cache.count(cached != nullptr || first != nullptr);
+        if (cached != nullptr)
+        {
+            density(i) = *cached;
+        }
+        else if (first != nullptr)
         {
-             constr += param_vector(paramIdx);
-             outPrior += R::dbeta(param_vector(paramIdx), 
-                         (distanceModelInstance -> spatial_prior)(0),
-                         (distanceModelInstance -> spatial_prior)(1), 1);
-             paramIdx++;
+            source[i] = *first;
         }
-        if (constr > 1){
-            outPrior = -std::numeric_limits<double>::infinity();
+        else
+        {
+            source[i] = missing.size();
+            pending.insert(key, missing.size());
+            missing.push_back(i);
         }
     }
-
-    if (transitionMode == "exponential")
+    if (missing.empty())
     {
-        outPrior += R::dgamma(param_vector(paramIdx), 
-                (transitionPriorsInstance -> E_to_I_params)(0,0),
-                1.0/(transitionPriorsInstance -> E_to_I_params)(1,0), 1);
-        paramIdx++;
-
-        outPrior += R::dgamma(param_vector(paramIdx), 
-                (transitionPriorsInstance -> I_to_R_params)(0,0),
-                1.0/(transitionPriorsInstance -> I_to_R_params)(1,0), 1);
-        paramIdx++;
+        return(density);
     }
-    else if (transitionMode == "weibull")
+    Eigen::MatrixXd rows(missing.size(), params.cols());
+    for (unsigned int k = 0; k < missing.size(); k++)
     {
-        outPrior += EI_transition_dist -> evalParamPrior(
-                param_vector.segment(paramIdx, 2)); 
-        paramIdx += 2;
-        outPrior += IR_transition_dist -> evalParamPrior(
-                param_vector.segment(paramIdx, 2)); 
-        paramIdx += 2;
+        rows.row(k) = params.row(missing[k]);
     }
-    if (dataModelInstance -> dataModelType == 2)
+    worker_pool -> evaluatePrior(rows, logDensity);
+    for (unsigned int k = 0; k < missing.size(); k++)
     {
-        outPrior += R::dbeta(param_vector(paramIdx), 
-                            rf_alpha,
-                            rf_beta,
-                            1);
-        paramIdx++;
+        logDensity(k) = std::exp(logDensity(k));
+        prior_cache.insert(rows.row(k).transpose(), logDensity(k));
     }
+    for (int i = 0; i < N; i++)
+    {
+        if (source[i] >= 0)
+        {
+            density(i) = logDensity(source[i]);
+        }
+    }
+    return(density);
+}
 
+void spatialSEIRModel::recordCacheRates(std::vector<double>& priorRate,
+                                        std::vector<double>& setupRate,
+                                        int verbose)
+{
+    if (!prior_cache.enabled())
+    {
+        return;
+    }
+    long priorHits, priorLookups, setupHits, setupLookups;
+    prior_cache.takeCounts(&priorHits, &priorLookups);
+    worker_pool -> takeCacheCounts(&setupHits, &setupLookups);
+    priorRate.push_back(priorLookups > 0 ? 
+            ((double) priorHits)/priorLookups : NA_REAL);
+    setupRate.push_back(setupLookups > 0 ? 
+            ((double) setupHits)/setupLookups : NA_REAL);
+    if (verbose > 1)
+    {
+        Rcpp::Rcout << "  cache: " << priorHits << " of " << priorLookups 
+            << " prior densities and " << setupHits << " of " << setupLookups
+            << " simulation setups reused\n";
+    }
+}
 
-    auto N = (initialValueContainerInstance -> S0) + 
-            (initialValueContainerInstance -> E0) + 
-            (initialValueContainerInstance -> I0) + 
-            (initialValueContainerInstance -> R0); 
-    int sz = N.size();
-    for (int j = 0; j < sz; j++){
-        int S = param_vector(paramIdx+j);
-        int E = param_vector(paramIdx+j+sz);
-        int I = param_vector(paramIdx+j+2*sz);
-        int R = param_vector(paramIdx+j+3*sz);
-    
-        bool validIVC = ((S >= 0 && S <= initialValueContainerInstance -> S0_max(j)) &&
-                         (E >= 0 && E <= initialValueContainerInstance -> E0_max(j)) &&
-                         (I >= 0 && I <= initialValueContainerInstance -> I0_max(j)) &&
-                         (R >= 0 && R <= initialValueContainerInstance -> R0_max(j)));
-        if (!validIVC){
-            outPrior = -std::numeric_limits<double>::infinity();
+/** The largest difference between the empirical distribution functions
+ * of a and b */
+static double ksDistance(std::vector<double> a, std::vector<double> b)
+{
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    unsigned int i = 0, j = 0;
+    double d = 0.0;
+    while (i < a.size() && j < b.size())
+    {
+        const double x = std::min(a[i], b[j]);
+        while (i < a.size() && a[i] <= x)
+        {
+            i++;
         }
+        while (j < b.size() && b[j] <= x)
+        {
+            j++;
+        }
+        d = std::max(d, std::abs(((double) i)/a.size() - ((double) j)/b.size()));
+    }
+    return(d);
+}
+
+void spatialSEIRModel::recordApproximationCheck(std::vector<double>& shift,
+                                                std::vector<double>& ks,
+                                                int verbose)
+{
+    if (samplingControlInstance -> binomial_approximation == SIM_APPROX_NONE ||
+        !(samplingControlInstance -> approximation_verify > 0))
+    {
+        return;
+    }
+    std::vector<double> exact;
+    std::vector<double> approximate;
+    worker_pool -> takeApproximationCheck(exact, approximate);
+    if (exact.empty())
+    {
+        shift.push_back(NA_REAL);
+        ks.push_back(NA_REAL);
+        return;
+    }
+    double exactMean = 0.0;
+    double approximateMean = 0.0;
+    for (unsigned int i = 0; i < exact.size(); i++)
+    {
+        exactMean += exact[i]/exact.size();
+        approximateMean += approximate[i]/exact.size();
+    }
+    shift.push_back(exactMean > 0 ? 
+            (approximateMean - exactMean)/exactMean : NA_REAL);
+    ks.push_back(ksDistance(exact, approximate));
+    if (verbose > 1)
+    {
+        Rcpp::Rcout << "  approximation: " << exact.size() 
+            << " distances checked, mean moved by " 
+            << 100.0*shift.back() << "%, KS distance " << ks.back() << "\n";
     }
- 
-    return(std::exp(outPrior));
 }
 
 void spatialSEIRModel::run_simulations(Eigen::MatrixXd params, 
@@ -630,6 +463,91 @@ void spatialSEIRModel::run_simulations(Eigen::MatrixXd params,
     worker_pool -> awaitFinished();
 }
 
+int spatialSEIRModel::run_simulations_streaming(
+        std::function<int(int, Eigen::MatrixXd&)> propose,
+        std::function<bool(const Eigen::VectorXd&, const Eigen::VectorXd&)> accept,
+        int needed,
+        int budget,
+        int* simulated,
+        int* wasted)
+{
+    // Results are examined strictly in proposal order: accepting whatever
+    // finishes first would favour parameters which simulate quickly.
+    const int cores = std::max(1, samplingControlInstance -> CPU_cores);
+    const int depth = 4*cores;
+    const int nParams = param_matrix.cols();
+
+    std::deque<Eigen::VectorXd> stream_params;
+    std::deque<Eigen::VectorXd> stream_results;
+    std::deque<bool> stream_done;
+    std::vector<std::pair<int, Eigen::VectorXd> > completed;
+    Eigen::MatrixXd block;
+
+    int issued = 0;
+    int skipped = 0;
+    int examined = 0;
+    int received = 0;
+    int accepted = 0;
+    int i, n, slot;
+    // Whatever interrupts the stream, its queued and running tasks must not
+    // outlive it: the next stream would receive their results.
+    try
+    {
+        while (accepted < needed && 
+               (examined < issued || issued + skipped < budget))
+        {
+            while (issued - examined < depth && issued + skipped < budget)
+            {
+                n = std::min(cores, budget - issued - skipped);
+                block.resize(n, nParams);
+                skipped += propose(issued, block);
+                for (i = 0; i < n; i++)
+                {
+                    stream_params.push_back(block.row(i).transpose());
+                    stream_results.push_back(Eigen::VectorXd());
+                    stream_done.push_back(false);
+                    worker_pool -> enqueue(sim_stream_atom, issued + i, block.row(i));
+                }
+                issued += n;
+            }
+
+            worker_pool -> awaitStreamResults(completed);
+            for (i = 0; i < (int) completed.size(); i++)
+            {
+                slot = completed[i].first - examined;
+                if (slot < 0 || slot >= issued - examined || stream_done[slot])
+                {
+                    continue;
+                }
+                stream_results[slot] = completed[i].second;
+                stream_done[slot] = true;
+                received++;
+            }
+
+            while (!stream_done.empty() && stream_done.front() && accepted < needed)
+            {
+                if (accept(stream_params.front(), stream_results.front()))
+                {
+                    accepted++;
+                }
+                stream_params.pop_front();
+                stream_results.pop_front();
+                stream_done.pop_front();
+                examined++;
+            }
+        }
+    }
+    catch (...)
+    {
+        worker_pool -> cancelStream();
+        throw;
+    }
+    received += worker_pool -> cancelStream();
+    *simulated = received;
+    *wasted = received - examined;
+    return(accepted);
+}
+
 spatialSEIRModel::~spatialSEIRModel()
 {   
     delete generator;
@@ -647,6 +565,10 @@ RCPP_MODULE(mod_spatialSEIRModel)
                  initialValueContainer&,
                  samplingControl&>()
     .method("sample", &spatialSEIRModel::sample)
-    .method("setParameters", &spatialSEIRModel::setParameters);
+    .method("summarize", &spatialSEIRModel::summarize)
+    .method("computeR0", &spatialSEIRModel::computeR0)
+    .method("setParameters", &spatialSEIRModel::setParameters)
+    .method("evalPriorDensity", &spatialSEIRModel::evalPriorDensity)
+    .method("setSamplingControl", &spatialSEIRModel::setSamplingControl);
 }
 
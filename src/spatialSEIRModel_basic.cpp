@@ -138,7 +138,7 @@ Rcpp::List spatialSEIRModel::sample_basic(int nSample, int vb,
     }
        
     outList["result"] = Rcpp::wrap(results_double);
-    outList["params"] = Rcpp::wrap(param_matrix);
+    outList["params"] = Rcpp::wrap((model_context -> layout).expand(param_matrix));
     outList["currentEps"] = results_double.maxCoeff() + 1.0;
 ;
     return(outList);
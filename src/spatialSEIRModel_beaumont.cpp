@@ -13,6 +13,7 @@
 #include <samplingControl.hpp>
 #include <util.hpp>
 #include <SEIRSimNodes.hpp>
+#include <distanceEmulator.hpp>
 
 
                                                                                 
@@ -65,39 +66,47 @@ void proposeParams_beaumont_multivariate(Eigen::MatrixXd* outParams,
 }
 
 
+/** Perturb particles of inParams, drawn by cum_weights, into every row of
+ * outParams. inPrior holds the prior density of each row of inParams; it
+ * does not change within an epoch, so the caller evaluates it once.*/
 void proposeParams_beaumont(Eigen::MatrixXd* outParams,
                             Eigen::MatrixXd* inParams,
                             Eigen::VectorXd* cum_weights,
+                            const Eigen::VectorXd* inPrior,
                             Eigen::VectorXd* tau,
-                            Eigen::VectorXi fixed,
                             std::mt19937* generator,
                             spatialSEIRModel* model)
 {
     // Check if tau is valid
-    int i,j;
+    int i,j,r;
     double drw = 0.0;
     auto U = std::uniform_real_distribution<double>(0,1);
     // Propose new parameters
     int p = (outParams -> cols());
     int N = outParams -> rows();
-    // Check whether any tau's have gotten degenerate
-    bool hasValid;
-    int itrs = 0;
+    int nPrev = cum_weights -> size();
+    // Priors are evaluated for whole blocks of proposals at once, and only
+    // the proposals outside the prior support are drawn again.
+    std::vector<int> remaining(N);
     for (i = 0; i < N; i++)
     {
-        itrs = 0;
-        hasValid = false;
-        for (itrs = 0; itrs < 1000 &&  !hasValid; itrs++)
-        { 
+        remaining[i] = i;
+    }
+    Eigen::MatrixXd candidates;
+    Eigen::VectorXd candidatePrior;
+    for (int itrs = 0; itrs < 1000 && !remaining.empty(); itrs++)
+    { 
+        candidates.resize(remaining.size(), p);
+        for (r = 0; r < (int) remaining.size(); r++)
+        {
+            candidates.row(r) = outParams -> row(remaining[r]);
             drw = U(*generator);
-            for (j = 0; j < N; j++)
+            for (j = 0; j < nPrev; j++)
             {
                 if (drw <= (*cum_weights)(j)) 
                 {
-                    //Rcpp::Rcout << "Selecting " << (*inParams)(j,2) << " at " 
-                    //<< j << ", " << drw << ", " << (*cum_weights)(j) << "\n";
-                    outParams -> row(i) = inParams -> row(j); 
-                    if (!(model -> evalPrior(outParams -> row(i)) > 0)){
+                    candidates.row(r) = inParams -> row(j); 
+                    if (!((*inPrior)(j) > 0)){
                         Rcpp::Rcout << "Starting from parameter with zero probability.\n";
                         Rcpp::Rcout << "  Param: \n" << inParams -> row(j) << "\n";
                         Rcpp::stop("Not a valid parameter.");
@@ -105,24 +114,54 @@ void proposeParams_beaumont(Eigen::MatrixXd* outParams,
                     break;
                 }
             }
+            // Parameters are in the compact layout, so all of them are free
             for (j = 0; j < p; j++)
             {
-                if (!fixed(j)){
-                    (*outParams)(i,j) += std::normal_distribution<double>(0.0, 
-                        (*tau)(j))(*generator);
-                }
+                candidates(r,j) += std::normal_distribution<double>(0.0, 
+                    (*tau)(j))(*generator);
             }
-            hasValid = (model -> evalPrior(outParams -> row(i))) > 0;
         }
-        if (!hasValid)
+        candidatePrior = model -> evalPriorRows(candidates);
+        std::vector<int> rejected;
+        for (r = 0; r < (int) remaining.size(); r++)
         {
-            Rcpp::Rcout << "Unable to generate parameters with nonzero probability.\n";
-            Rcpp::Rcout << "  Param " << i << " of " << outParams -> rows() << "\n"; 
-            Rcpp::Rcout << "  Pror prob: " << (model -> evalPrior(outParams -> row(i)));
-            Rcpp::Rcout << "  Param: \n" << outParams -> row(i) << "\n";
-            Rcpp::stop("No parameters");
+            outParams -> row(remaining[r]) = candidates.row(r);
+            if (!(candidatePrior(r) > 0))
+            {
+                rejected.push_back(remaining[r]);
+            }
         }
+        remaining.swap(rejected);
+    }
+    if (!remaining.empty())
+    {
+        i = remaining[0];
+        Rcpp::Rcout << "Unable to generate parameters with nonzero probability.\n";
+        Rcpp::Rcout << "  Param " << i << " of " << outParams -> rows() << "\n"; 
+        Rcpp::Rcout << "  Pror prob: " << (model -> evalPrior(outParams -> row(i)));
+        Rcpp::Rcout << "  Param: \n" << outParams -> row(i) << "\n";
+        Rcpp::stop("No parameters");
+    }
+}
+
+/** Choose the size of the next batch of proposals from the number of 
+ * particles still needed and the acceptance rate observed so far. The 
+ * estimate is padded so that a single batch usually suffices, and rounded
+ * up to a whole number of batches per core.*/
+int adaptiveBatchSize(int needed, int accepted, int simulated, 
+                      double previousRate, int minBatch, int maxBatch, 
+                      int cores)
+{
+    double rate = (simulated > 0 ? (accepted + 0.5)/(simulated + 1.0) : 
+                   previousRate);
+    rate = std::max(rate, 1e-4);
+    double target = std::ceil(1.2*needed/rate);
+    int batch = (int) std::min(target, (double) maxBatch);
+    if (cores > 1)
+    {
+        batch = ((batch + cores - 1)/cores)*cores;
     }
+    return(std::max(minBatch, std::min(batch, maxBatch)));
 }
 
 Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb, 
@@ -162,6 +201,30 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
     const int Npart = nSample;
 
     const int maxBatches= samplingControlInstance -> max_batches;
+    const bool adaptiveBatch = samplingControlInstance -> adaptive_batch;
+    const bool streaming = samplingControlInstance -> streaming;
+    const bool screening = samplingControlInstance -> screening;
+    const int minBatch = std::min(samplingControlInstance -> min_batch_size, Nsim);
+    // With adaptive batches, max_batches full sized batches become a budget
+    // of simulations per epoch.
+    const int maxEpochSims = maxBatches*Nsim;
+    double acceptRate = 1.0;
+    std::vector<int> totalSimulations;
+    std::vector<int> wastedSimulations;
+    std::vector<double> screeningPassRate;
+    std::vector<double> priorCacheHitRate;
+    std::vector<double> setupCacheHitRate;
+    std::vector<double> approximationShift;
+    std::vector<double> approximationKS;
+    std::vector<double> screeningStepsSaved;
+    const double stepsPerSim = ((double) (dataModelInstance -> Y).rows())*
+                               (samplingControlInstance -> m);
+    int epochScreened;
+    long epochStepsSkipped;
+    std::vector<int> emulatorSkipped;
+    std::vector<int> emulatorVerified;
+    std::vector<int> emulatorFalseRejections;
+    auto U = std::uniform_real_distribution<double>(0,1);
     const bool hasReinfection = (reinfectionModelInstance -> 
                betaPriorPrecision)(0) > 0;
     const bool hasSpatial = (dataModelInstance -> Y).cols() > 1;
@@ -193,6 +256,18 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
     Eigen::VectorXd w1 = Eigen::VectorXd::Zero(Npart).array() + 1.0/((double) Npart);
     Eigen::VectorXd cum_weights = Eigen::VectorXd::Zero(Npart).array() + 1.0/((double) Npart);
  
+    // Every simulated (parameter, distance) pair trains the emulator, which
+    // is consulted before proposals are simulated in the main iterations.
+    // Simulations cut short by screening reach at least the threshold, and
+    // are stored as lower bounds.
+    std::unique_ptr<distanceEmulator> emulator;
+    if (samplingControlInstance -> emulator)
+    {
+        emulator = std::unique_ptr<distanceEmulator>(new distanceEmulator(
+                    nParams, 5000, 10));
+    }
+    const double emulatorVerify = samplingControlInstance -> emulator_verify;
+
     if (!is_initialized)
     {
         if (verbose > 1){Rcpp::Rcout << "Generating starting parameters from prior\n";}
@@ -205,6 +280,11 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
         param_matrix = Eigen::MatrixXd::Zero(Npart, preproposal_params.cols());
 
         run_simulations(preproposal_params, sim_atom, &preproposal_results, &results_complete);
+        if (emulator)
+        {
+            emulator -> add(preproposal_params, preproposal_results,
+                            std::numeric_limits<double>::infinity());
+        }
 
         std::vector<size_t> currentIndex = sort_indexes_eigen(preproposal_results); 
         for (i = 0; i < param_matrix.rows(); i++)
@@ -233,22 +313,8 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
                       ).colwise().norm()/std::sqrt((double) 
                         (param_matrix.rows())-1.0);
 
-    // Determine fixed parameters
-    Eigen::VectorXi fixed = Eigen::VectorXi::Zero(tau.size());
-    int sz = (initialValueContainerInstance -> S0).size();
-    if (initialValueContainerInstance -> type == 1){
-        // In this case, we have all constant parameters for IVC
-        for (i = tau.size()-1; i >= (tau.size()-sz*4); i--){
-            fixed(i) = 1;
-        }
-    } else {
-        // In this case, we need to just "fix" S0 which is deterministically
-        // related to the other compartments
-        for (i = tau.size()-sz*3-1; i >= (tau.size()-sz*4); i--){
-            fixed(i) = 1;
-        }
-
-    }
+    // Estimated initial values follow the continuous parameters
+    const int startIVC = (model_context -> layout).nHead;
 
     for (iteration = 0; iteration < num_iterations && !terminate; iteration++)
     {   
@@ -270,11 +336,9 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
         for (i = 0; i < tau.size(); i++){
             if ((tau)(i) == 0){
                 // Is this expected?
-                if (!(i >= tau.size()- (initialValueContainerInstance -> S0.size())*4)){
+                if (i < startIVC){
                     Rcpp::warning("Degenerate particles detected!");
                     (tau)(i) = 0.1;
-                } else if (initialValueContainerInstance -> type == 1){
-                    // No pasa nada, tudo bem
                 } else {
                     // Not worth warning about, discrete parameters be like that
                     (tau)(i) = 1; 
@@ -306,16 +370,17 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
 
         // Reorder parameters by weight
         reweight_idx = sort_indexes_eigen_vec(w0); 
+        Eigen::MatrixXd reordered_params(param_matrix.rows(), nParams);
         for (i = w0.size()-1; i >= 0; i--){
             w1(i) = w0(reweight_idx[i]);
-            preproposal_params.row(i) = param_matrix.row(reweight_idx[i]);
+            reordered_params.row(i) = param_matrix.row(reweight_idx[i]);
         }
 
         for (i = 0; i < param_matrix.rows(); i++)
         {
             w0(i) = w1(i);
-            param_matrix.row(i) = preproposal_params.row(i);
         }
+        param_matrix = reordered_params;
 
 
         cum_weights(0) = w1(0);
@@ -329,21 +394,148 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
             Rcpp::Rcout << "cumulative weight: " << cum_weights.maxCoeff() << "\n";
             Rcpp::stop("particle weights do not sum to one\n");
         }
+        // Every proposal of the epoch starts from these particles
+        const Eigen::VectorXd currentPrior = evalPriorRows(param_matrix);
 
 
         // Propose params and run simulations
         int currentIdx = 0;
         int nBatches = 0;
+        int epochSims = 0;
+        int epochWasted = 0;
+        worker_pool -> setAcceptanceThreshold(e1);
+        if (screening)
+        {
+            // Only result(0) < e1 is ever looked at, so simulations may stop
+            // as soon as their distance is known to reach e1.
+            worker_pool -> setScreeningThreshold(e1);
+        }
 
-        auto Nvec = (initialValueContainerInstance -> S0) + 
-                    (initialValueContainerInstance -> E0) + 
-                    (initialValueContainerInstance -> I0) + 
-                    (initialValueContainerInstance -> R0); 
-        int sz = (initialValueContainerInstance -> S0).size();
 
-        while (currentIdx < Npart && 
-               nBatches < maxBatches)
+        // Proposals which the emulator expects to miss e1 by the margin are
+        // not simulated, apart from a random fraction which is simulated 
+        // anyway to measure how often that prediction is wrong.
+        int epochSkipped = 0;
+        int epochVerified = 0;
+        int epochFalseRejections = 0;
+        const double emulatorBound = (samplingControlInstance -> emulator_margin)*e1;
+        const bool useEmulator = (emulator && emulator -> ready());
+        if (emulator)
         {
+            emulator -> setScale(tau);
+        }
+        // 0: simulate, 1: simulate to verify the emulator, 2: skip
+        auto emulatorDecision = [&](const Eigen::VectorXd& params){
+            if (!useEmulator || !(emulator -> exceeds(params, emulatorBound)))
+            {
+                return(0);
+            }
+            return(U(*generator) < emulatorVerify ? 1 : 2);
+        };
+        std::vector<int> verifying;
+
+        if (streaming)
+        {
+            if (samplingControlInstance -> multivariatePerturbation)
+            {
+                Rcpp::stop("Multivariate proposals are depricated");
+            }
+            // New proposals are generated while earlier ones simulate
+            Eigen::MatrixXd redraw;
+            std::vector<int> decision;
+            int examinedIdx = 0;
+            run_simulations_streaming(
+                [&](int first, Eigen::MatrixXd& block){
+                    proposeParams_beaumont(&block, 
+                                  &param_matrix,
+                                  &cum_weights,
+                                  &currentPrior,
+                                  &tau,
+                                  generator,
+                                  this);
+                    int pending = 0;
+                    decision.resize(block.rows());
+                    for (int r = 0; r < block.rows(); r++)
+                    {
+                        decision[r] = emulatorDecision(block.row(r).transpose());
+                        pending += (decision[r] == 2);
+                    }
+                    // Skipped proposals are replaced from a single block of
+                    // candidates, no larger than what is left of the budget.
+                    // Rows it cannot fill keep their last proposal, so that
+                    // a poor emulator cannot stall the stream.
+                    int skipped = 0;
+                    const int candidates = std::min(4*pending, 
+                            maxEpochSims - first - (int) block.rows() - epochSkipped);
+                    if (pending > 0 && candidates > 0)
+                    {
+                        redraw.resize(candidates, nParams);
+                        proposeParams_beaumont(&redraw, &param_matrix, 
+                                &cum_weights, &currentPrior, &tau, generator, this);
+                        int c = 0;
+                        for (int r = 0; r < block.rows(); r++)
+                        {
+                            while (decision[r] == 2 && c < redraw.rows())
+                            {
+                                skipped++;
+                                block.row(r) = redraw.row(c++);
+                                decision[r] = emulatorDecision(block.row(r).transpose());
+                            }
+                        }
+                    }
+                    for (int r = 0; r < block.rows(); r++)
+                    {
+                        verifying.push_back(decision[r] == 1);
+                    }
+                    epochSkipped += skipped;
+                    return(skipped);
+                },
+                [&](const Eigen::VectorXd& params, const Eigen::VectorXd& result){
+                    if (emulator)
+                    {
+                        emulator -> add(params, result(0),
+                                        screening && result(0) >= e1);
+                        if (verifying[examinedIdx])
+                        {
+                            epochVerified++;
+                            epochFalseRejections += (result(0) < e1);
+                        }
+                    }
+                    examinedIdx++;
+                    if (result(0) < e1)
+                    {
+                        proposed_param_matrix.row(currentIdx) = params;
+                        proposed_results_double.row(currentIdx) = result;
+                        currentIdx++;
+                        return(true);
+                    }
+                    return(false);
+                },
+                Npart, maxEpochSims, &epochSims, &epochWasted);
+            nBatches = 1;
+        }
+        // Emulator skips count against the simulation budget, so that an
+        // epoch cannot go on forever proposing hopeless parameters.
+        while (!streaming && currentIdx < Npart && 
+               (adaptiveBatch ? epochSims + epochSkipped < maxEpochSims : 
+                                nBatches < maxBatches))
+        {
+            if (adaptiveBatch)
+            {
+                int batch = std::min(adaptiveBatchSize(Npart - currentIdx, 
+                                              currentIdx, epochSims + epochSkipped, 
+                                              acceptRate, minBatch, Nsim,
+                                              samplingControlInstance -> CPU_cores),
+                                     maxEpochSims - epochSims - epochSkipped);
+                preproposal_params.resize(batch, nParams);
+                preproposal_results.resize(batch, samplingControlInstance -> m);
+            }
+            else if (useEmulator)
+            {
+                // The previous batch may have been shortened
+                preproposal_params.resize(Nsim, nParams);
+                preproposal_results.resize(Nsim, samplingControlInstance -> m);
+            }
 
             // perturb parameters
             if (samplingControlInstance -> multivariatePerturbation)
@@ -355,21 +547,30 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
                 proposeParams_beaumont(&preproposal_params, 
                               &param_matrix,
                               &cum_weights,
+                              &currentPrior,
                               &tau,
-                              fixed,
                               generator,
                               this);     
-                // Hack - fix S0, which is subject to constraints
-                //for (int loc = preproposal_params.cols() - 1; loc >= preproposal_params.cols() - sz*4; loc --){
-                int startIVC = preproposal_params.cols() - sz*4;
-                for (int loc = 0; loc < sz; loc ++ ){
-                    for (i = 0; i < preproposal_params.rows(); i++){
-                        preproposal_params(i,startIVC + loc) = Nvec(loc) - 
-                            preproposal_params(i,startIVC + loc+sz) -
-                            preproposal_params(i,startIVC + loc+2*sz) - 
-                            preproposal_params(i,startIVC + loc+3*sz);
+            }
+
+            if (useEmulator)
+            {
+                int kept = 0;
+                verifying.assign(preproposal_params.rows(), 0);
+                for (i = 0; i < preproposal_params.rows(); i++)
+                {
+                    int decision = emulatorDecision(preproposal_params.row(i).transpose());
+                    if (decision == 2)
+                    {
+                        epochSkipped++;
+                        continue;
                     }
+                    preproposal_params.row(kept) = preproposal_params.row(i);
+                    verifying[kept] = (decision == 1);
+                    kept++;
                 }
+                preproposal_params.conservativeResize(kept, nParams);
+                preproposal_results.resize(kept, samplingControlInstance -> m);
             }
 
             // run simulations
@@ -377,9 +578,23 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
                             sim_atom,
                             &preproposal_results, 
                             &results_complete);
+            if (emulator)
+            {
+                emulator -> add(preproposal_params, preproposal_results,
+                                (screening ? e1 : 
+                                 std::numeric_limits<double>::infinity()));
+            }
+            for (i = 0; useEmulator && i < preproposal_results.rows(); i++)
+            {
+                if (verifying[i])
+                {
+                    epochVerified++;
+                    epochFalseRejections += (preproposal_results(i,0) < e1);
+                }
+            }
 
            //std::vector<size_t> preproposal_order = sort_indexes_eigen(preproposal_results); 
-           for (i = 0; i < Nsim && currentIdx < Npart; i++)
+           for (i = 0; i < preproposal_results.rows() && currentIdx < Npart; i++)
            {
                if (preproposal_results(i,0) < e1)
                {
@@ -390,6 +605,9 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
                    currentIdx++;
                }
            }
+           // Simulations past the last needed acceptance are never examined
+           epochWasted += preproposal_results.rows() - i;
+           epochSims += preproposal_results.rows();
            if (currentIdx < Npart && verbose > 1)
            {
                 Rcpp::Rcout << "  batch " << nBatches << ", " << currentIdx << 
@@ -397,6 +615,46 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
            }
            nBatches ++;
         }
+        if (emulator)
+        {
+            // Later phases expect full sized batches
+            preproposal_params.resize(Nsim, nParams);
+            preproposal_results.resize(Nsim, samplingControlInstance -> m);
+        }
+        if (epochSims + epochSkipped - epochWasted > 0)
+        {
+            acceptRate = (currentIdx + 0.5)/(epochSims + epochSkipped - epochWasted + 1.0);
+        }
+        emulatorSkipped.push_back(epochSkipped);
+        emulatorVerified.push_back(epochVerified);
+        emulatorFalseRejections.push_back(epochFalseRejections);
+        totalSimulations.push_back(epochSims);
+        wastedSimulations.push_back(epochWasted);
+        worker_pool -> setScreeningThreshold(std::numeric_limits<double>::infinity());
+        worker_pool -> takeScreeningStats(&epochScreened, &epochStepsSkipped);
+        screeningPassRate.push_back(epochSims > 0 ? 
+                1.0 - ((double) epochScreened)/epochSims : 1.0);
+        screeningStepsSaved.push_back(epochSims > 0 ? 
+                epochStepsSkipped/(stepsPerSim*epochSims) : 0.0);
+        if (verbose > 1)
+        {
+            Rcpp::Rcout << "  " << epochSims << " simulations in " << nBatches 
+                << " batches, " << epochWasted << " wasted\n";
+            if (screening)
+            {
+                Rcpp::Rcout << "  screening: " << epochSims - epochScreened 
+                    << " simulations passed, " << 100.0*screeningStepsSaved.back()
+                    << "% of time steps skipped\n";
+            }
+            if (emulator)
+            {
+                Rcpp::Rcout << "  emulator: " << epochSkipped << " proposals skipped, "
+                    << epochFalseRejections << " of " << epochVerified 
+                    << " verified skips would have been accepted, "
+                    << emulator -> lowerBounds() << " of " << emulator -> size()
+                    << " stored distances are lower bounds\n";
+            }
+        }
         e0 = e1;
         w0 = w1;
         double wtTot = 0.0;
@@ -419,6 +677,7 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
             wtTot = 0.0;
             double newWt, tmpWt;
            
+            Eigen::VectorXd proposalPrior = evalPriorRows(proposed_param_matrix);
             for (i = 0; i < proposed_param_matrix.rows(); i++)
             {
                newWt = 0.0; 
@@ -428,15 +687,13 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
                    tmpWt = 0.0;
                    for (k = 0; k < proposed_param_matrix.cols(); k++)
                    {
-                      if (!fixed(k)){
-                          tmpWt += R::dnorm(proposed_param_matrix(i,k),
-                                        param_matrix(j,k),
-                                        tau(k), 1);
-                      }
+                      tmpWt += R::dnorm(proposed_param_matrix(i,k),
+                                    param_matrix(j,k),
+                                    tau(k), 1);
                    }
                    newWt += w0(j)*std::exp(tmpWt);
                }
-               w1(i) = evalPrior(proposed_param_matrix.row(i))/newWt;    
+               w1(i) = proposalPrior(i)/newWt;    
                if (std::isnan(w1(i)))
                {
                    Rcpp::stop("nan weights encountered.");
@@ -449,6 +706,8 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
         w0 = w1;
         param_matrix = proposed_param_matrix;
         results_double = proposed_results_double;
+        recordCacheRates(priorCacheHitRate, setupCacheHitRate, verbose);
+        recordApproximationCheck(approximationShift, approximationKS, verbose);
     }
 
     Rcpp::List outList;
@@ -475,11 +734,9 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
         for (i = 0; i < tau.size(); i++){
             if ((tau)(i) == 0){
                 // Is this expected?
-                if (!(i >= tau.size()- (initialValueContainerInstance -> S0.size())*4)){
+                if (i < startIVC){
                     Rcpp::warning("Degenerate particles detected!");
                     (tau)(i) = 0.1;
-                } else if (initialValueContainerInstance -> type == 1){
-                    // No pasa nada, tudo bem
                 } else {
                     // Not worth warning about, discrete parameters be like that
                     Rcpp::Rcout << "error!\n";
@@ -508,15 +765,16 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
 
         // Reorder parameters by weight
         reweight_idx = sort_indexes_eigen_vec(w0); 
+        Eigen::MatrixXd reordered_params(param_matrix.rows(), nParams);
         for (i = w0.size()-1; i >= 0; i--){
             w1(i) = w0(reweight_idx[i]);
-            preproposal_params.row(i) = param_matrix.row(reweight_idx[i]);
+            reordered_params.row(i) = param_matrix.row(reweight_idx[i]);
         }
         for (i = 0; i < param_matrix.rows(); i++)
         {
             w0(i) = w1(i);
-            param_matrix.row(i) = preproposal_params.row(i);
         }
+        param_matrix = reordered_params;
 
         cum_weights(0) = w1(0);
         for (i = 1; i < w1.size(); i++)
@@ -528,20 +786,34 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
             Rcpp::Rcout << "cumulative weight: " << cum_weights.maxCoeff() << "\n";
             Rcpp::stop("particle weights do not sum to one\n");
         }
+        // Every proposal of the epoch starts from these particles
+        const Eigen::VectorXd currentPrior = evalPriorRows(param_matrix);
 
         // Propose params and run simulations
         int currentIdx = 0;
         int nBatches = 0;
-        auto Nvec = (initialValueContainerInstance -> S0) + 
-                    (initialValueContainerInstance -> E0) + 
-                    (initialValueContainerInstance -> I0) + 
-                    (initialValueContainerInstance -> R0); 
-        int sz = (initialValueContainerInstance -> S0).size();
 
 
+        int epochSims = 0;
+        int epochWasted = 0;
+        worker_pool -> setAcceptanceThreshold(e1);
+        if (screening)
+        {
+            // Compartment results (sim_result_atom) are never screened
+            worker_pool -> setScreeningThreshold(e1);
+        }
+
         results_complete.clear();
         while (currentIdx < Npart)
         {
+            if (adaptiveBatch)
+            {
+                int batch = adaptiveBatchSize(Npart - currentIdx, currentIdx, 
+                                              epochSims, acceptRate, minBatch, Nsim,
+                                              samplingControlInstance -> CPU_cores);
+                preproposal_params.resize(batch, nParams);
+                preproposal_results.resize(batch, samplingControlInstance -> m);
+            }
             // perturb parameters
             if (samplingControlInstance -> multivariatePerturbation)
             {
@@ -552,21 +824,10 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
                 proposeParams_beaumont(&preproposal_params, 
                               &param_matrix,
                               &cum_weights,
+                              &currentPrior,
                               &tau,
-                              fixed,
                               generator,
                               this);     
-                // Hack - fix S0, which is subject to constraints
-                
-                int startIVC = preproposal_params.cols() - sz*4;
-                for (int loc = 0; loc < sz; loc ++ ){
-                    for (i = 0; i < preproposal_params.rows(); i++){
-                        preproposal_params(i,startIVC + loc) = Nvec(loc) - 
-                            preproposal_params(i,startIVC + loc+sz) -
-                            preproposal_params(i,startIVC + loc+2*sz) - 
-                            preproposal_params(i,startIVC + loc+3*sz);
-                    }
-                }
             }
 
            proposed_results_complete.clear();
@@ -579,7 +840,7 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
                             &proposed_results_complete);
 
            std::vector<size_t> result_order = sort_indexes(result_idx); 
-           for (i = 0; i < Nsim && currentIdx < Npart; i++)
+           for (i = 0; i < preproposal_results.rows() && currentIdx < Npart; i++)
            {
                if (preproposal_results(i,0) < e1)
                {
@@ -592,6 +853,8 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
                    currentIdx++;
                }
            }
+           epochWasted += preproposal_results.rows() - i;
+           epochSims += preproposal_results.rows();
            if (currentIdx < Npart && verbose > 1)
            {
                 Rcpp::Rcout << "  batch " << nBatches << ", " << currentIdx << 
@@ -600,6 +863,14 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
            nBatches ++;
            // Need to use indexes for results complete
         }
+        totalSimulations.push_back(epochSims);
+        wastedSimulations.push_back(epochWasted);
+        worker_pool -> setScreeningThreshold(std::numeric_limits<double>::infinity());
+        worker_pool -> takeScreeningStats(&epochScreened, &epochStepsSkipped);
+        screeningPassRate.push_back(epochSims > 0 ? 
+                1.0 - ((double) epochScreened)/epochSims : 1.0);
+        screeningStepsSaved.push_back(epochSims > 0 ? 
+                epochStepsSkipped/(stepsPerSim*epochSims) : 0.0);
 
         e0 = e1;
         w0 = w1;
@@ -617,6 +888,7 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
             wtTot = 0.0;
             double newWt, tmpWt;
 
+            Eigen::VectorXd proposalPrior = evalPriorRows(proposed_param_matrix);
             for (i = 0; i < proposed_param_matrix.rows(); i++)
             {
                newWt = 0.0; 
@@ -626,15 +898,13 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
                    tmpWt = 0.0;
                    for (k = 0; k < proposed_param_matrix.cols(); k++)
                    {
-                      if (!fixed(k)){
-                          tmpWt += R::dnorm(proposed_param_matrix(i,k),
-                                        param_matrix(j,k),
-                                        tau(k), 1);
-                      }
+                      tmpWt += R::dnorm(proposed_param_matrix(i,k),
+                                    param_matrix(j,k),
+                                    tau(k), 1);
                    }
                    newWt += w0(j)*std::exp(tmpWt);
                }
-               w1(i) = evalPrior(proposed_param_matrix.row(i))/newWt;    
+               w1(i) = proposalPrior(i)/newWt;    
                if (std::isnan(w1(i)))
                {
                    Rcpp::stop("nan weights encountered.");
@@ -648,6 +918,8 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
         w0 = w1;
         param_matrix = proposed_param_matrix;
         results_double = proposed_results_double;
+        recordCacheRates(priorCacheHitRate, setupCacheHitRate, verbose);
+        recordApproximationCheck(approximationShift, approximationKS, verbose);
     
         // Todo: keep an eye on this object handling. It may have unreasonable
         // overhead, and is kind of complex.  
@@ -687,9 +959,20 @@ Rcpp::List spatialSEIRModel::sample_Beaumont2009(int nSample, int vb,
         outList["simulationResults"] = simulationResults;
     }
     outList["result"] = Rcpp::wrap(results_double);
-    outList["params"] = Rcpp::wrap(param_matrix);
+    outList["params"] = Rcpp::wrap((model_context -> layout).expand(param_matrix));
     outList["completedEpochs"] = iteration;
     outList["weights"] = Rcpp::wrap(w1);
     outList["currentEps"] = e1;
+    outList["totalSimulations"] = Rcpp::wrap(totalSimulations);
+    outList["wastedSimulations"] = Rcpp::wrap(wastedSimulations);
+    outList["screeningPassRate"] = Rcpp::wrap(screeningPassRate);
+    outList["screeningStepsSaved"] = Rcpp::wrap(screeningStepsSaved);
+    outList["emulatorSkipped"] = Rcpp::wrap(emulatorSkipped);
+    outList["emulatorVerified"] = Rcpp::wrap(emulatorVerified);
+    outList["emulatorFalseRejections"] = Rcpp::wrap(emulatorFalseRejections);
+    outList["priorCacheHitRate"] = Rcpp::wrap(priorCacheHitRate);
+    outList["setupCacheHitRate"] = Rcpp::wrap(setupCacheHitRate);
+    outList["approximationShift"] = Rcpp::wrap(approximationShift);
+    outList["approximationKS"] = Rcpp::wrap(approximationKS);
     return(outList);
 }
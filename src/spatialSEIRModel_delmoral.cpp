@@ -67,7 +67,9 @@ Eigen::VectorXd calculate_weights_DM(double cur_e,
             num += eps(i,j) < cur_e;
             denom += eps(i,j) < prev_e;
         } 
-        out_wts(i) = (num/denom*prev_wts(i));
+        // Particles dropped earlier stay dropped; their denominator may be
+        // zero
+        out_wts(i) = (prev_wts(i) > 0 ? num/denom*prev_wts(i) : 0.0);
         tot += out_wts(i);
     }
     if (!std::isfinite(tot))
@@ -88,7 +90,7 @@ Eigen::VectorXd calculate_weights_DM(double cur_e,
                 Rcpp::Rcout << "eps(i,j) = " << eps(i,j) << "\n";
                 Rcpp::Rcout << " (n/d) = (" << num << "/" << denom << ")\n";
             } 
-            out_wts(i) = (num/denom*prev_wts(i));
+            out_wts(i) = (prev_wts(i) > 0 ? num/denom*prev_wts(i) : 0.0);
             Rcpp::Rcout << "out_wts(" << i << ") = " << out_wts(i) << "\n"; 
             tot += out_wts(i);
             Rcpp::Rcout << "tot = " << tot << "\n";
@@ -252,6 +254,8 @@ Rcpp::List spatialSEIRModel::sample_DelMoral2012(int nSample, int vb,
         Rcpp::stop("Disparate simulation and particle size temporarily disabled\n");
     }
     const int maxBatches= samplingControlInstance -> max_batches;
+    const double resampleThreshold = (samplingControlInstance -> resample_ess)*Npart;
+    const bool streaming = samplingControlInstance -> streaming;
     const bool hasReinfection = (reinfectionModelInstance -> 
             betaPriorPrecision)(0) > 0;
     const bool hasSpatial = (dataModelInstance -> Y).cols() > 1;
@@ -266,6 +270,10 @@ Rcpp::List spatialSEIRModel::sample_DelMoral2012(int nSample, int vb,
 
     auto U = std::uniform_real_distribution<double>(0,1);
     double drw;
+    std::vector<double> priorCacheHitRate;
+    std::vector<double> setupCacheHitRate;
+    std::vector<double> approximationShift;
+    std::vector<double> approximationKS;
 
     if (verbose > 1)
     {
@@ -349,7 +357,7 @@ Rcpp::List spatialSEIRModel::sample_DelMoral2012(int nSample, int vb,
             Rcpp::Rcout << "\n";
         }
         
-        if (ESS(w1) < Npart)
+        if (ESS(w1) < resampleThreshold)
         {
            // Resample Npart particles 
            // Compute cumulative weights
@@ -380,16 +388,38 @@ Rcpp::List spatialSEIRModel::sample_DelMoral2012(int nSample, int vb,
         }
         else
         {
-            Rcpp::Rcout << "Not Resampling, ESS sufficient.\n";
-            // Do nothing
+            if (verbose > 1)
+            {
+                Rcpp::Rcout << "Not Resampling, ESS sufficient.\n";
+            }
+            // The particles keep their weights
+            proposed_param_matrix = param_matrix;
+            proposed_results_double = results_double;
         }
 
-        for (i = 0; i < proposed_results_double.rows(); i++)
+        // Particles of zero weight are dropped at the next resampling, so
+        // only the others are moved. After resampling every particle is
+        // alive.
+        std::vector<int> alive;
+        for (i = 0; i < Npart; i++)
         {
-            if (proposed_results_double.row(i).minCoeff() > e1)
+            if (w1(i) > 0)
             {
-                Rcpp::Rcout << "Problem: " << i << " e1=" << e1 << ", eps=" <<
-                    proposed_results_double.row(i).minCoeff() << "\n";
+                alive.push_back(i);
+            }
+        }
+        const int nAlive = alive.size();
+        if (verbose > 1 && nAlive < Npart)
+        {
+            Rcpp::Rcout << "  " << nAlive << "/" << Npart << " particles alive\n";
+        }
+
+        for (i = 0; i < nAlive; i++)
+        {
+            if (proposed_results_double.row(alive[i]).minCoeff() > e1)
+            {
+                Rcpp::Rcout << "Problem: " << alive[i] << " e1=" << e1 << ", eps=" <<
+                    proposed_results_double.row(alive[i]).minCoeff() << "\n";
 
             }
         }
@@ -398,9 +428,18 @@ Rcpp::List spatialSEIRModel::sample_DelMoral2012(int nSample, int vb,
         results_double = proposed_results_double;
 
         // Step 3: MCMC update
-        proposal_cache = proposed_param_matrix;
-        preproposal_params = proposed_param_matrix;
-        preproposal_results = proposed_results_double;
+        // Row c of the proposal matrices belongs to particle alive[c]
+        proposal_cache.resize(nAlive, nParams);
+        for (i = 0; i < nAlive; i++)
+        {
+            proposal_cache.row(i) = proposed_param_matrix.row(alive[i]);
+        }
+        preproposal_params = proposal_cache;
+        preproposal_results.resize(nAlive, results_double.cols());
+        for (i = 0; i < nAlive; i++)
+        {
+            preproposal_results.row(i) = proposed_results_double.row(alive[i]);
+        }
 
         /*
         run_simulations(proposed_param_matrix, 
@@ -414,7 +453,41 @@ Rcpp::List spatialSEIRModel::sample_DelMoral2012(int nSample, int vb,
         // Until all < eps
         int currentIdx = 0;
         int nBatches = 0;
-        while (currentIdx < Npart && 
+        if (streaming)
+        {
+            // Stream index k perturbs particle k % nAlive, as batch k/nAlive
+            // would
+            int streamSims, streamWasted;
+            run_simulations_streaming(
+                [&](int first, Eigen::MatrixXd& block){
+                    for (int r = 0; r < block.rows(); r++)
+                    {
+                        block.row(r) = proposal_cache.row((first + r) % nAlive);
+                    }
+                    proposeParams(&block, &tau, generator);
+                    return(0);
+                },
+                [&](const Eigen::VectorXd& params, const Eigen::VectorXd& result){
+                    if (result.minCoeff() < e1)
+                    {
+                        proposed_param_matrix.row(alive[currentIdx]) = params;
+                        proposed_results_double.row(alive[currentIdx]) = result;
+                        currentIdx++;
+                        return(true);
+                    }
+                    return(false);
+                },
+                nAlive, maxBatches*nAlive, &streamSims, &streamWasted);
+            nBatches = (streamSims + nAlive - 1)/nAlive;
+            // Unfilled slots keep their current particle, which the MCMC
+            // step below then leaves unchanged.
+            for (i = currentIdx; i < nAlive; i++)
+            {
+                preproposal_params.row(i) = param_matrix.row(alive[i]);
+                preproposal_results.row(i) = results_double.row(alive[i]);
+            }
+        }
+        while (!streaming && currentIdx < nAlive && 
                nBatches < maxBatches)
         {
            preproposal_params = proposal_cache;
@@ -426,44 +499,47 @@ Rcpp::List spatialSEIRModel::sample_DelMoral2012(int nSample, int vb,
                    &results_complete);
            auto mins = preproposal_results.rowwise().minCoeff();
 
-           for (i = 0; i < Nsim && currentIdx < Npart; i++)
+           for (i = 0; i < nAlive && currentIdx < nAlive; i++)
            {
                if (mins(i) < e1)
                {
-                   proposed_param_matrix.row(currentIdx) = 
+                   proposed_param_matrix.row(alive[currentIdx]) = 
                        preproposal_params.row(i);
-                   proposed_results_double.row(currentIdx) = 
+                   proposed_results_double.row(alive[currentIdx]) = 
                        preproposal_results.row(i);
                    currentIdx++;
                }
            }
-           if (currentIdx < Npart && verbose > 1)
+           if (currentIdx < nAlive && verbose > 1)
            {
                 Rcpp::Rcout << "  batch " << nBatches << ", " << currentIdx << 
-                    "/" << Npart << " accepted\n";
+                    "/" << nAlive << " accepted\n";
            }
            nBatches ++;
         }
-        if (currentIdx + 1 < results_double.rows())
+        if (currentIdx + 1 < nAlive)
         {
             Rcpp::Rcout << "  " << currentIdx + 1 << "/" 
-                << Npart << " acceptances in " << nBatches << " batches\n";
+                << nAlive << " acceptances in " << nBatches << " batches\n";
             // Fill in rest of matrix
-            for (i = currentIdx; i < Npart; i++)
+            for (i = currentIdx; i < nAlive; i++)
             {
-                proposed_results_double.row(i) = preproposal_results.row(i);
-                proposed_param_matrix.row(i) = preproposal_params.row(i);
+                proposed_results_double.row(alive[i]) = preproposal_results.row(i);
+                proposed_param_matrix.row(alive[i]) = preproposal_params.row(i);
             }
         }
 
         int numAccept = 0;
         int numNan = 0;
         double acc_ratio, num, denom, pn, pd;
+        Eigen::VectorXd proposedPrior = evalPriorRows(proposed_param_matrix);
+        Eigen::VectorXd currentPrior = evalPriorRows(param_matrix);
         // Nsim == Npart for following code
-        for (i = 0; i < Nsim; i++)
+        for (int c = 0; c < nAlive; c++)
         {
-            pn = evalPrior(proposed_param_matrix.row(i));
-            pd = evalPrior(param_matrix.row(i));
+            i = alive[c];
+            pn = proposedPrior(i);
+            pd = currentPrior(i);
             num = 0.0;
             denom = 0.0;
 
@@ -496,7 +572,6 @@ Rcpp::List spatialSEIRModel::sample_DelMoral2012(int nSample, int vb,
                 //param_matrix.row(i) = prev_param_matrix.row(i);
             }
         } 
-
         if (numAccept == 0)
         {
             Rcpp::Rcout << "WARNING: THE SAMPLER COLLAPSED.\n"; 
@@ -505,6 +580,8 @@ Rcpp::List spatialSEIRModel::sample_DelMoral2012(int nSample, int vb,
         {
             Rcpp::Rcout << "    MCMC Step Complete. " << numAccept << " accepted\n";
         }
+        recordCacheRates(priorCacheHitRate, setupCacheHitRate, verbose);
+        recordApproximationCheck(approximationShift, approximationKS, verbose);
         e0 = e1;
         w0 = w1;
     }
@@ -554,8 +631,14 @@ Rcpp::List spatialSEIRModel::sample_DelMoral2012(int nSample, int vb,
     {
         outList["result"] = Rcpp::wrap(results_double);
     }
-    outList["params"] = Rcpp::wrap(param_matrix);
+    outList["params"] = Rcpp::wrap((model_context -> layout).expand(param_matrix));
     outList["completedEpochs"] = iteration;
+    // Not uniform when the last iteration did not resample
+    outList["weights"] = Rcpp::wrap(w1);
     outList["currentEps"] = e1;
+    outList["priorCacheHitRate"] = Rcpp::wrap(priorCacheHitRate);
+    outList["setupCacheHitRate"] = Rcpp::wrap(setupCacheHitRate);
+    outList["approximationShift"] = Rcpp::wrap(approximationShift);
+    outList["approximationKS"] = Rcpp::wrap(approximationKS);
     return(outList);
 }
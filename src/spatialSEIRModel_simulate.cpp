@@ -13,6 +13,7 @@
 #include <samplingControl.hpp>
 #include <util.hpp>
 #include <SEIRSimNodes.hpp>
+#include <posteriorSummary.hpp>
 
 Rcpp::List spatialSEIRModel::sample_Simulate(int nSample, 
                                              int enforceEps,
@@ -117,3 +118,75 @@ Rcpp::List spatialSEIRModel::sample_Simulate(int nSample,
     }
     return(outList);
 }
+
+Rcpp::List spatialSEIRModel::summarize(Eigen::VectorXd probs,
+                                       std::vector<std::string> compartments,
+                                       int verbose)
+{
+    if (!is_initialized)
+    {
+        Rcpp::stop("Simulation requires initialized parameters");
+    }
+    const Eigen::MatrixXi& Y = dataModelInstance -> Y;
+    // More shards than threads keeps the workers from queueing on a lock
+    posteriorSummary summary(Y.rows(), Y.cols(), compartments, probs,
+            4*std::max(1, samplingControlInstance -> CPU_cores));
+
+    samplingControlInstance -> m = 1;
+    results_double = Eigen::MatrixXd::Zero(param_matrix.rows(), 1);
+    results_complete.clear();
+    if (verbose)
+    {
+        Rcpp::Rcout << "Summarizing " << param_matrix.rows() << " simulations\n";
+    }
+    worker_pool -> setSummaryDest(&summary);
+    run_simulations(param_matrix, 
+                    sim_summary_atom,
+                    &results_double,
+                    &results_complete); 
+    worker_pool -> setSummaryDest(nullptr);
+
+    Rcpp::List outList = summary.toList();
+    outList["draws"] = summary.count();
+    outList["result"] = Rcpp::wrap(results_double);
+    return(outList);
+}
+
+Rcpp::List spatialSEIRModel::computeR0(Eigen::MatrixXi S, Eigen::MatrixXi I,
+                                       Eigen::MatrixXd N)
+{
+    if (!is_initialized)
+    {
+        Rcpp::stop("Reproductive numbers require initialized parameters");
+    }
+    if (transitionPriorsInstance -> mode != "exponential" &&
+        transitionPriorsInstance -> mode != "weibull")
+    {
+        Rcpp::stop("Reproductive numbers are only available for exponential and weibull transitions");
+    }
+    const int nTpt = (dataModelInstance -> Y).rows();
+    const int nLoc = (dataModelInstance -> Y).cols();
+    const int nSim = param_matrix.rows();
+    if (S.rows() != nSim*nTpt || I.rows() != nSim*nTpt || 
+        S.cols() != nLoc || I.cols() != nLoc ||
+        N.rows() != nSim || N.cols() != nLoc)
+    {
+        Rcpp::stop("Compartment dimensions do not match the parameters");
+    }
+
+    Eigen::MatrixXd R_EA(nSim*nTpt, nLoc);
+    Eigen::MatrixXd R_NGM(nTpt, nSim);
+    reproductiveNumberBatch batch;
+    batch.params = &param_matrix;
+    batch.S = &S;
+    batch.I = &I;
+    batch.N = &N;
+    batch.R_EA = &R_EA;
+    batch.R_NGM = &R_NGM;
+    worker_pool -> computeReproductiveNumbers(batch, nSim);
+
+    Rcpp::List outList;
+    outList["R_EA"] = Rcpp::wrap(R_EA);
+    outList["R_NGM"] = Rcpp::wrap(R_NGM);
+    return(outList);
+}
@@ -0,0 +1,141 @@
+#include <Rcpp.h>
+#include <R_ext/Rdynload.h>
+#include <workerHost.hpp>
+#include <SEIRSimNodes.hpp>
+#include <numaTopology.hpp>
+
+workerHost& workerHost::instance()
+{
+    // Never destroyed: the threads are joined by shutdown when the library
+    // is unloaded, and otherwise end with the process.
+    static workerHost* host = new workerHost();
+    return(*host);
+}
+
+workerHost::workerHost()
+{
+    limit = std::max(1, (int) std::thread::hardware_concurrency());
+    running = 0;
+    peak = 0;
+    waiting = 0;
+    exit = false;
+}
+
+void workerHost::submit(NodeWorker* worker)
+{
+    {
+        std::lock_guard<std::mutex> lock(host_mutex);
+        jobs.push_back(worker);
+        // Waiting threads which have been notified but have not yet woken
+        // are still counted, so compare them with the jobs they will take
+        if ((int) jobs.size() > waiting && (int) threads.size() < limit)
+        {
+            threads.push_back(std::thread([this](){run();}));
+        }
+    }
+    condition.notify_one();
+}
+
+void workerHost::run()
+{
+    // The NUMA node the thread is bound to, if any
+    int bound_node = -1;
+    std::unique_lock<std::mutex> lock(host_mutex);
+    while (true)
+    {
+        waiting++;
+        condition.wait(lock, [this](){
+                return(exit || (!jobs.empty() && running < limit));});
+        waiting--;
+        if (exit)
+        {
+            return;
+        }
+        NodeWorker* worker = jobs.front();
+        jobs.pop_front();
+        running++;
+        peak = std::max(peak, running);
+        lock.unlock();
+        if (worker -> numaNode() != bound_node)
+        {
+            // Follow the worker to its node, or release the thread for
+            // workers which may run anywhere
+            numaTopology::instance().bindThread(worker -> numaNode());
+            bound_node = worker -> numaNode();
+        }
+        (*worker)();
+        lock.lock();
+        running--;
+        // A job held back by the limit may now run
+        condition.notify_one();
+    }
+}
+
+void workerHost::setThreadLimit(int lim)
+{
+    if (lim < 1)
+    {
+        Rcpp::stop("The thread limit must be at least one.\n");
+    }
+    {
+        std::lock_guard<std::mutex> lock(host_mutex);
+        limit = lim;
+    }
+    condition.notify_all();
+}
+
+int workerHost::threadLimit()
+{
+    std::lock_guard<std::mutex> lock(host_mutex);
+    return(limit);
+}
+
+int workerHost::threadCount()
+{
+    std::lock_guard<std::mutex> lock(host_mutex);
+    return((int) threads.size());
+}
+
+int workerHost::peakRunning()
+{
+    std::lock_guard<std::mutex> lock(host_mutex);
+    const int out = peak;
+    peak = running;
+    return(out);
+}
+
+void workerHost::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(host_mutex);
+        exit = true;
+    }
+    condition.notify_all();
+    for (unsigned int i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+    threads.clear();
+    std::lock_guard<std::mutex> lock(host_mutex);
+    exit = false;
+}
+
+// [[Rcpp::export]]
+Rcpp::List worker_threads(int limit)
+{
+    workerHost& host = workerHost::instance();
+    if (limit > 0)
+    {
+        host.setThreadLimit(limit);
+    }
+    return(Rcpp::List::create(Rcpp::Named("limit") = host.threadLimit(),
+                              Rcpp::Named("threads") = host.threadCount(),
+                              Rcpp::Named("peak_running") = host.peakRunning(),
+                              Rcpp::Named("numa_nodes") = 
+                                numaTopology::instance().nodeCount()));
+}
+
+extern "C" void R_unload_ABSEIR(DllInfo* dll)
+{
+    workerHost::instance().shutdown();
+}